@@ -14,6 +14,10 @@ class AdaptiveAvgPoolingLayer : public Layer {
   InferStatus Forward(const std::vector<sftensor>& inputs,
                       std::vector<sftensor>& outputs) override;
 
+  InferStatus InferOutputShape(
+      const std::vector<std::vector<int>>& input_shapes,
+      std::vector<int>& output_shape) const override;
+
   static ParseParameterAttrStatus GetInstace(
       const std::shared_ptr<RuntimeOperator>& op,
       std::shared_ptr<Layer>& adaptive_avgpooling_layer);
@@ -0,0 +1,56 @@
+#ifndef __FREE_INFER_LAYER_BATCHNORM2D_HPP__
+#define __FREE_INFER_LAYER_BATCHNORM2D_HPP__
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "layer.hpp"
+#include "runtime/runtime_ir.hpp"
+#include "runtime/status_code.hpp"
+#include "tensor/tensor.hpp"
+
+namespace free_infer {
+class BatchNorm2dLayer : public Layer {
+ public:
+  /**
+   * @brief Inference batch norm over the channels, the statistics and the
+   * affine parameters are folded into one scale and shift per channel
+   * @param num_features the number of channels
+   * @param eps the value added to the running variance
+   * @param running_mean the mean of every channel
+   * @param running_var the variance of every channel
+   * @param affine_weight the gamma of every channel, empty without affine
+   * @param affine_bias the beta of every channel, empty without affine
+   */
+  explicit BatchNorm2dLayer(uint32_t num_features, float eps,
+                            const std::vector<float>& running_mean,
+                            const std::vector<float>& running_var,
+                            const std::vector<float>& affine_weight = {},
+                            const std::vector<float>& affine_bias = {});
+
+  InferStatus Forward(const std::vector<sftensor>& inputs,
+                      std::vector<sftensor>& outputs) override;
+
+  InferStatus InferOutputShape(
+      const std::vector<std::vector<int>>& input_shapes,
+      std::vector<int>& output_shape) const override;
+
+  static ParseParameterAttrStatus GetInstace(
+      const std::shared_ptr<RuntimeOperator>& op,
+      std::shared_ptr<Layer>& batchnorm_layer);
+
+  /**
+   * @brief The output of channel c is input * scale[c] + shift[c]
+   */
+  const std::vector<float>& scale() const;
+  const std::vector<float>& shift() const;
+
+ private:
+  uint32_t num_features_ = 0;
+  std::vector<float> scale_;
+  std::vector<float> shift_;
+};
+}  // namespace free_infer
+
+#endif  // __FREE_INFER_LAYER_BATCHNORM2D_HPP__
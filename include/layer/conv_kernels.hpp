@@ -0,0 +1,51 @@
+#ifndef __FREE_INFER_CONV_KERNELS_HPP__
+#define __FREE_INFER_CONV_KERNELS_HPP__
+
+#include <cstdint>
+
+namespace free_infer {
+/**
+ * @brief The geometry of a convolution on one input, the input and output
+ * channels are column major (rows, cols) matrices
+ */
+struct ConvGeometry {
+  uint32_t input_h = 0;
+  uint32_t input_w = 0;
+  uint32_t output_h = 0;
+  uint32_t kernel_h = 0;
+  uint32_t kernel_w = 0;
+  uint32_t stride_h = 1;
+  uint32_t stride_w = 1;
+  uint32_t padding_h = 0;
+  uint32_t padding_w = 0;
+  float padding_value = 0.f;
+};
+
+/**
+ * @brief Pack the block of the im2col matrix with rows [row_begin, row_begin
+ * + rows) and columns [col_begin, col_begin + cols) in the layout of
+ * GemmPackA. Row p of the im2col matrix is the output position (p %
+ * output_h, p / output_h) and column q the kernel element (q / (kernel_h *
+ * kernel_w), q % kernel_h, q / kernel_h % kernel_w)
+ * @param input_ptr the first input channel of the group
+ */
+using Im2ColPacker = void (*)(const ConvGeometry& geometry,
+                              const float* input_ptr, uint32_t row_begin,
+                              uint32_t rows, uint32_t col_begin, uint32_t cols,
+                              float* a_packed);
+
+/**
+ * @brief The packer specialized at compile time for the kernel size and the
+ * stride, 1x1 with stride 1 or 2, 3x3 with stride 1 or 2 and 7x7 with stride
+ * 2, or the generic one for any other geometry
+ */
+Im2ColPacker SelectIm2ColPacker(uint32_t kernel_h, uint32_t kernel_w,
+                                uint32_t stride_h, uint32_t stride_w);
+
+/**
+ * @brief The packer taking the whole geometry at runtime
+ */
+Im2ColPacker GenericIm2ColPacker();
+}  // namespace free_infer
+
+#endif  // __FREE_INFER_CONV_KERNELS_HPP__
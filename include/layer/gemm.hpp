@@ -0,0 +1,141 @@
+#ifndef __FREE_INFER_GEMM_HPP__
+#define __FREE_INFER_GEMM_HPP__
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <new>
+#include <vector>
+
+namespace free_infer {
+// the micro tile of C is kGemmMR rows, two AVX-512 vectors, by kGemmNR
+// columns, the kernels of the narrower instruction sets cover it in several
+// passes, so the packed layouts are the same on every CPU
+constexpr uint32_t kGemmMR = 32;
+constexpr uint32_t kGemmNR = 6;
+// the cache blocks, a kGemmMC x kGemmKC block of A stays in L2 while the
+// kGemmKC x kGemmNR panels of B stream through L1
+constexpr uint32_t kGemmMC = 8 * kGemmMR;
+constexpr uint32_t kGemmKC = 256;
+constexpr uint32_t kGemmNC = 16 * kGemmNR;
+constexpr size_t kGemmAlignment = 64;
+
+template <typename T, size_t alignment>
+struct AlignedAllocator {
+  using value_type = T;
+  template <typename U>
+  struct rebind {
+    using other = AlignedAllocator<U, alignment>;
+  };
+
+  AlignedAllocator() = default;
+  template <typename U>
+  AlignedAllocator(const AlignedAllocator<U, alignment>&) {}
+
+  T* allocate(size_t n) {
+    return static_cast<T*>(
+        ::operator new(n * sizeof(T), std::align_val_t(alignment)));
+  }
+  void deallocate(T* ptr, size_t) {
+    ::operator delete(ptr, std::align_val_t(alignment));
+  }
+
+  bool operator==(const AlignedAllocator&) const { return true; }
+  bool operator!=(const AlignedAllocator&) const { return false; }
+};
+
+using AlignedFloats =
+    std::vector<float, AlignedAllocator<float, kGemmAlignment>>;
+
+/**
+ * @brief The B operand of Gemm packed once, e.g. the weights of a layer. The
+ * rows are cut into kGemmKC blocks and the columns into kGemmNR panels, each
+ * panel stores its rows of kGemmNR values one after another and starts on a
+ * 64 byte boundary, so the micro kernel streams it without any gather
+ */
+class PackedMatrix {
+ public:
+  PackedMatrix() = default;
+
+  /**
+   * @brief Pack a rows x cols matrix, element (r, c) is read from
+   * data[r * row_stride + c * col_stride]
+   */
+  void Pack(const float* data, uint32_t rows, uint32_t cols,
+            uint32_t row_stride, uint32_t col_stride);
+
+  uint32_t rows() const;
+  uint32_t cols() const;
+  bool empty() const;
+
+  /**
+   * @brief The panel of columns [panel * kGemmNR, panel * kGemmNR + kGemmNR)
+   * and rows [block * kGemmKC, block * kGemmKC + kGemmKC), the columns past
+   * cols() are zeros
+   */
+  const float* panel(uint32_t block, uint32_t panel) const;
+
+ private:
+  size_t PanelOffset(uint32_t block, uint32_t panel) const;
+
+ private:
+  uint32_t rows_ = 0;
+  uint32_t cols_ = 0;
+  uint32_t panel_count_ = 0;
+  AlignedFloats data_;
+};
+
+/**
+ * @brief Finish the block of C with rows [row_begin, row_begin + rows) and
+ * columns [col_begin, col_begin + cols) right after its last update, while
+ * it is still in cache, e.g. the bias, residual and activation of a layer
+ * @param c the first element of the block
+ * @param ldc the distance between two columns of C
+ */
+using GemmEpilogue =
+    std::function<void(uint32_t row_begin, uint32_t rows, uint32_t col_begin,
+                       uint32_t cols, float* c, uint32_t ldc)>;
+
+/**
+ * @brief C = A * B with column major A (m x k) and C (m x n), split into
+ * cache blocks over the rows and columns of C which run on the thread pool
+ * @param a the A matrix
+ * @param lda the distance between two columns of A
+ * @param b the packed B matrix, k = b.rows() and n = b.cols()
+ * @param m the rows of A and C
+ * @param c the C matrix, overwritten
+ * @param ldc the distance between two columns of C
+ * @param epilogue applied to every block of C once, called concurrently
+ * for distinct blocks, none if empty
+ */
+void Gemm(const float* a, uint32_t lda, const PackedMatrix& b, uint32_t m,
+          float* c, uint32_t ldc, const GemmEpilogue& epilogue = nullptr);
+
+/**
+ * @brief Pack the block of A with rows [row_begin, row_begin + rows) and
+ * columns [col_begin, col_begin + cols) into panels of kGemmMR rows, each
+ * panel stores its columns of kGemmMR values one after another and the rows
+ * of the last panel past the block are zeros
+ */
+using GemmPackA = std::function<void(uint32_t row_begin, uint32_t rows,
+                                     uint32_t col_begin, uint32_t cols,
+                                     float* a_packed)>;
+
+/**
+ * @brief C = A * B where A is never materialized, its cache blocks are
+ * produced by pack_a right before they are used, e.g. the im2col matrix of
+ * a convolution gathered from the input on the fly
+ * @param pack_a packs one block of A, called concurrently for distinct
+ * blocks
+ * @param b the packed B matrix, k = b.rows() and n = b.cols()
+ * @param m the rows of A and C
+ * @param c the C matrix, overwritten
+ * @param ldc the distance between two columns of C
+ * @param epilogue applied to every block of C once, as in Gemm
+ */
+void GemmImplicit(const GemmPackA& pack_a, const PackedMatrix& b, uint32_t m,
+                  float* c, uint32_t ldc,
+                  const GemmEpilogue& epilogue = nullptr);
+}  // namespace free_infer
+
+#endif  // __FREE_INFER_GEMM_HPP__
@@ -1,6 +1,7 @@
 
 #ifndef __FREE_INFER_LAYER_HPP__
 #define __FREE_INFER_LAYER_HPP__
+#include <cstddef>
 #include <memory>
 #include <string>
 #include <utility>
@@ -15,9 +16,39 @@ class Layer {
   explicit Layer(std::string layer_name) : layer_name_(std::move(layer_name)) {}
   virtual ~Layer() = default;
 
+  /**
+   * @brief Run the layer on a batch, the clones of a graph share its layers
+   * and may call Forward at the same time, so Forward must not modify the
+   * layer
+   */
   virtual InferStatus Forward(const std::vector<sftensor>& inputs, std::vector<sftensor>& outputs);
   virtual InferStatus Forward();
 
+  /**
+   * @brief Infer the output operand shape from the input operand shapes, the
+   * shapes keep the batch as the first dimension like the operand shapes. The
+   * default fits the element-wise layers, whose output has the shape of the
+   * inputs
+   * @param input_shapes shapes of the input operands in the operand order
+   * @param output_shape the inferred shape of the output operand
+   * @return kInferSuccess, or the error if the layer does not accept the
+   * input shapes
+   */
+  virtual InferStatus InferOutputShape(
+      const std::vector<std::vector<int>>& input_shapes,
+      std::vector<int>& output_shape) const;
+
+  /**
+   * @brief Floats of scratch memory Forward needs on inputs of the shapes
+   * with the ParallelFor thread count of the calling thread. The graph sizes
+   * its workspace arena by it and lends the arena to Forward through
+   * GetWorkspace, a Forward finding no large enough workspace allocates its
+   * own. The default needs none
+   * @param input_shapes shapes of the input operands in the operand order
+   */
+  virtual size_t WorkspaceSize(
+      const std::vector<std::vector<int>>& input_shapes) const;
+
   virtual const std::string& layer_name() const { return this->layer_name_; }
   void set_runtime_operator(const std::shared_ptr<RuntimeOperator>& runtime_operator);
 
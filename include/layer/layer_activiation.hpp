@@ -1,14 +1,35 @@
-
 #ifndef __FREE_INFER_LAYER_ACTIVIATION_HPP__
 #define __FREE_INFER_LAYER_ACTIVIATION_HPP__
 
+#include <cstdint>
 #include <string>
 #include "layer/layer.hpp"
 namespace free_infer {
+enum class ActivationType {
+  kActivationNone = 0,
+  kActivationRelu = 1,
+  kActivationSigmoid = 2,
+};
+
+/**
+ * @brief Apply the activation in place, the layers computing their output
+ * block by block use it as an epilogue while the block is still in cache
+ * @param activation the activation to apply
+ * @param data the values to activate
+ * @param size the number of values
+ */
+void ApplyActivation(ActivationType activation, float* data, uint32_t size);
+
+/**
+ * @brief The activation computed by an operator type, kActivationNone if the
+ * operator is not an activation which can be fused
+ */
+ActivationType ActivationOfOperator(const std::string& op_type);
+
 class ActiviationLayer : public Layer {
  public:
   explicit ActiviationLayer(std::string layer_name) : Layer(layer_name) {}
 };
 }  // namespace free_infer
 
-#endif  //__FREE_INFER_LAYER_ACTIVIATION_HPP__
\ No newline at end of file
+#endif  //__FREE_INFER_LAYER_ACTIVIATION_HPP__
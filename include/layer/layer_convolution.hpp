@@ -3,16 +3,28 @@
 
 #include <sys/types.h>
 
+#include <cstddef>
 #include <cstdint>
 #include <memory>
 #include <string>
 #include <vector>
 
 #include "layer.hpp"
+#include "layer/conv_kernels.hpp"
+#include "layer/gemm.hpp"
+#include "layer_activiation.hpp"
 #include "runtime/runtime_ir.hpp"
 #include "runtime/status_code.hpp"
 #include "tensor/tensor.hpp"
 namespace free_infer {
+enum class ConvAlgorithm {
+  kConvAlgorithmAuto = 0,
+  kConvAlgorithmIm2Col = 1,
+  kConvAlgorithmWinograd = 2,
+  kConvAlgorithmDepthwise = 3,
+  kConvAlgorithmImplicitGemm = 4,
+};
+
 class ConvolutionLayer : public Layer {
  public:
   explicit ConvolutionLayer(uint32_t output_channel, uint32_t in_channel,
@@ -29,8 +41,57 @@ class ConvolutionLayer : public Layer {
   void set_bias(const std::vector<sftensor>& bias);
   void set_bias(const std::vector<float>& bias);
 
+  /**
+   * @brief Fuse an activation into the layer, it is applied to each output
+   * channel right after the GEMM producing it instead of in a separate pass
+   * @param activation the activation following the convolution
+   */
+  void set_activation(ActivationType activation);
+  ActivationType activation() const;
+
+  /**
+   * @brief Fuse an elementwise add of a second input into the layer, the
+   * inputs then hold the batch of the convolution input followed by the
+   * batch of the residual, which is added to each output channel before the
+   * activation
+   * @param use_residual whether the layer takes the residual input
+   */
+  void set_residual(bool use_residual);
+  bool use_residual() const;
+
+  /**
+   * @brief Choose how the output is computed, kConvAlgorithmAuto picks the
+   * depthwise kernel for layers with one input channel per group, the
+   * Winograd convolution for 3x3 stride 1 layers with enough channels, the
+   * implicit GEMM for the kernel shapes SelectIm2ColPacker specializes and
+   * im2col + GEMM otherwise
+   * @param algorithm the algorithm, Winograd needs a 3x3 stride 1 layer
+   * without groups and depthwise needs one input channel per group
+   */
+  void set_algorithm(ConvAlgorithm algorithm);
+  ConvAlgorithm algorithm() const;
+  bool winograd_supported() const;
+  bool depthwise_supported() const;
+
+  /**
+   * @brief Fold a per output channel affine transform following the
+   * convolution into its weights and bias, e.g. an inference batch norm
+   * @param scale the factor of every output channel
+   * @param shift the offset of every output channel, added after the scale
+   */
+  void FoldScaleShift(const std::vector<float>& scale,
+                      const std::vector<float>& shift);
+
   InferStatus Forward(const std::vector<sftensor>& inputs,
                       std::vector<sftensor>& outputs) override;
+
+  InferStatus InferOutputShape(
+      const std::vector<std::vector<int>>& input_shapes,
+      std::vector<int>& output_shape) const override;
+
+  size_t WorkspaceSize(
+      const std::vector<std::vector<int>>& input_shapes) const override;
+
   static ParseParameterAttrStatus GetInstace(
       const std::shared_ptr<RuntimeOperator>& op,
       std::shared_ptr<Layer>& conv_layer);
@@ -41,15 +102,82 @@ class ConvolutionLayer : public Layer {
   void InitBiasParam(const uint32_t bias_n, const uint32_t bias_c,
                      const uint32_t bias_h, const uint32_t bias_w);
 
+  /**
+   * @brief Prepare the kernels in the layouts of the algorithms, called
+   * whenever the weights change
+   */
+  void InitKernels();
   void InitIm2ColKernel();
+  void InitWinogradKernel();
+  ConvAlgorithm SelectAlgorithm() const;
   void CheckWeighsDim();
+  /**
+   * @brief Floats of the workspace one task of Forward needs, for an input
+   * of (input_c, input_h, input_w)
+   */
+  size_t TaskWorkspaceSize(ConvAlgorithm algorithm, uint32_t input_c,
+                           uint32_t input_h, uint32_t input_w) const;
+  /**
+   * @brief Number of task ranges of Forward running at the same time, each
+   * with its own part of the workspace
+   */
+  uint32_t TaskSlots(uint32_t conv_tasks) const;
+  /**
+   * @brief Unroll the input channels of a group into the workspace, one row
+   * per output position and one column per kernel element, so the rows of a
+   * kernel element are read from one input channel in order
+   * @return a view of the workspace
+   */
   arma::fmat Im2Col(sftensor input, uint32_t kernel_h, uint32_t kernel_w,
                     uint32_t input_h, uint32_t input_w, uint32_t input_c_group,
-                    uint32_t group_i, uint32_t im2col_w, uint32_t im2col_h);
+                    uint32_t group_i, uint32_t im2col_w, uint32_t im2col_h,
+                    float* workspace);
+  /**
+   * @brief The im2col matrix of a 1x1 convolution without padding, a view of
+   * the input channels of the group for stride 1, which already are the GEMM
+   * operand, and a plain subsampling of them into the workspace otherwise
+   */
+  arma::fmat PointwiseInput(sftensor input, uint32_t input_c_group,
+                            uint32_t group_i, uint32_t output_h,
+                            uint32_t output_w, float* workspace);
+  /**
+   * @brief Compute the output channels of a group with one GEMM against the
+   * packed kernels written into the output tensor, the bias, residual and
+   * activation are applied to each block of it as soon as it is final
+   */
   void ConvGemm(const arma::fmat& im2col_input, sftensor output, uint32_t group,
-                uint32_t kernel_i, uint32_t kernel_n_group,
-                const arma::frowvec& kernel, uint32_t output_w,
-                uint32_t output_h);
+                uint32_t kernel_n_group, const sftensor& residual,
+                uint32_t output_w, uint32_t output_h);
+  /**
+   * @brief Compute the output channels of a group with the GEMM of ConvGemm
+   * without the im2col matrix, each cache block of it is gathered from the
+   * input right before the GEMM uses it
+   */
+  void ImplicitConvGemm(const sftensor& input, const sftensor& output,
+                        uint32_t group, uint32_t kernel_n_group,
+                        const sftensor& residual);
+  /**
+   * @brief Compute the output channels of a group with one input channel
+   * directly, the kernel taps are accumulated along the output columns so
+   * the inner loop runs over contiguous rows
+   */
+  void DepthwiseConv(const sftensor& input, const sftensor& output,
+                     uint32_t group, uint32_t kernel_n_group,
+                     const sftensor& residual);
+  /**
+   * @brief Add the bias and the residual to a range of an output channel and
+   * apply the activation in one pass
+   * @param residual_ptr the same range of the residual channel, nullptr if
+   * there is none
+   */
+  void ConvEpilogue(float* output_ptr, uint32_t channel,
+                    const float* residual_ptr, uint32_t size);
+  /**
+   * @brief ConvEpilogue of every block of output channels, fused into the
+   * GEMM of a group whose first output channel is channel_begin
+   */
+  GemmEpilogue ConvGemmEpilogue(uint32_t channel_begin,
+                                const sftensor& residual);
 
  private:
   bool use_bias_ = false;
@@ -59,7 +187,18 @@ class ConvolutionLayer : public Layer {
   float padding_value = 0.f;
   uint32_t stride_h_ = 1;
   uint32_t stride_w_ = 1;
-  std::vector<arma::frowvec> im2col_kernel;
+  bool use_residual_ = false;
+  ActivationType activation_ = ActivationType::kActivationNone;
+  // one packed (kernel_c * kernel_h * kernel_w, kernel_n_group) matrix per
+  // group
+  std::vector<PackedMatrix> im2col_kernel;
+  // the im2col packer of ImplicitConvGemm specialized for the kernel size
+  // and the stride
+  Im2ColPacker im2col_packer_ = nullptr;
+  ConvAlgorithm algorithm_ = ConvAlgorithm::kConvAlgorithmAuto;
+  // the 36 transformed (kernel_c, kernel_n) matrices of the Winograd
+  // convolution, empty if it does not apply
+  std::vector<PackedMatrix> winograd_kernel_;
 
  protected:
   std::vector<sftensor> weights_;
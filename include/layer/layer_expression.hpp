@@ -4,6 +4,7 @@
 
 #include <memory>
 #include <string>
+#include <vector>
 
 #include "layer.hpp"
 #include "parse_expression.hpp"
@@ -21,6 +22,7 @@ class ExpressionLayer : public Layer {
   private:
   std::string statement_;
   std::unique_ptr<ExpressionParser> parser_;
+  std::vector<std::shared_ptr<TokenNode>> token_nodes_;  // reverse polish
 };
 
 }  // namespace free_infer
@@ -4,6 +4,7 @@
 
 #include <cstdint>
 #include "layer.hpp"
+#include "layer/gemm.hpp"
 namespace free_infer {
 class LinearLayer : public Layer {
  public:
@@ -19,6 +20,16 @@ class LinearLayer : public Layer {
   InferStatus Forward(const std::vector<sftensor>& inputs,
                       std::vector<sftensor>& outputs) override;
 
+  /**
+   * @brief Floats of the stacked output of a batch of several samples
+   */
+  size_t WorkspaceSize(
+      const std::vector<std::vector<int>>& input_shapes) const override;
+
+  InferStatus InferOutputShape(
+      const std::vector<std::vector<int>>& input_shapes,
+      std::vector<int>& output_shape) const override;
+
   static ParseParameterAttrStatus GetInstace(
       const std::shared_ptr<RuntimeOperator>& op,
       std::shared_ptr<Layer>& linear_layer);
@@ -26,6 +37,11 @@ class LinearLayer : public Layer {
  private:
   void InitWeightParam(const uint32_t in_features, const uint32_t out_features);
   void InitBiasParam(const uint32_t out_features);
+  /**
+   * @brief Pack the transposed weight into GEMM panels, done once when the
+   * weights are set instead of transposing them on every forward
+   */
+  void InitPackedWeight();
 
  private:
   bool use_bias_ = false;
@@ -33,6 +49,7 @@ class LinearLayer : public Layer {
   uint32_t out_features_;
   std::vector<sftensor> weights_;
   std::vector<sftensor> bias_;
+  PackedMatrix packed_weight_;
 };
 
 }  // namespace free_infer
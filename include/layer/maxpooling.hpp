@@ -17,6 +17,10 @@ class MaxPoolingLayer : public PoolingLayer {
   InferStatus Forward(const std::vector<sftensor>& inputs,
                       std::vector<sftensor>& outputs) override;
 
+  InferStatus InferOutputShape(
+      const std::vector<std::vector<int>>& input_shapes,
+      std::vector<int>& output_shape) const override;
+
   static ParseParameterAttrStatus GetInstace(
       const std::shared_ptr<RuntimeOperator>& op,
       std::shared_ptr<Layer>& maxpooling_layer);
@@ -0,0 +1,81 @@
+#ifndef __FREE_INFER_SIMD_KERNELS_HPP__
+#define __FREE_INFER_SIMD_KERNELS_HPP__
+
+#include <cstdint>
+
+#include "layer/conv_kernels.hpp"
+
+namespace free_infer {
+/**
+ * @brief The instruction sets the hot kernels are built for, in increasing
+ * order, SSE4.2 is the baseline every variant falls back to
+ */
+enum class CpuIsa {
+  kCpuIsaSse42 = 0,
+  kCpuIsaAvx2 = 1,
+  kCpuIsaAvx512 = 2,
+};
+
+/**
+ * @brief The hot kernels built for one instruction set. The library itself
+ * is built for the baseline CPU, only the kernels use the wider vectors, so
+ * one binary runs everywhere at the speed of the CPU it runs on
+ */
+struct SimdKernels {
+  CpuIsa isa = CpuIsa::kCpuIsaSse42;
+
+  /**
+   * @brief C[0:m, 0:n] (+)= A * B of one micro tile, a is a packed panel of
+   * kGemmMR rows and b a packed panel of kGemmNR columns, both k deep
+   * @param accumulate add to C instead of overwriting it
+   */
+  void (*gemm_micro_kernel)(uint32_t k, const float* a, const float* b,
+                            float* c, uint32_t ldc, uint32_t m, uint32_t n,
+                            bool accumulate) = nullptr;
+
+  /**
+   * @brief The im2col packers of SelectIm2ColPacker and GenericIm2ColPacker
+   */
+  Im2ColPacker (*select_im2col_packer)(uint32_t kernel_h, uint32_t kernel_w,
+                                       uint32_t stride_h,
+                                       uint32_t stride_w) = nullptr;
+  Im2ColPacker generic_im2col_packer = nullptr;
+
+  /**
+   * @brief Max pooling of one channel, the pooling window is the kernel of
+   * the geometry and the padding never wins
+   * @param output_w the cols of the output channel
+   */
+  void (*max_pool)(const ConvGeometry& geometry, uint32_t output_w,
+                   const float* input, float* output) = nullptr;
+
+  // elementwise kernels, the output may be one of the inputs
+  void (*relu)(const float* input, float* output, uint32_t size) = nullptr;
+  void (*sigmoid)(const float* input, float* output, uint32_t size) = nullptr;
+  void (*add)(const float* input1, const float* input2, float* output,
+              uint32_t size) = nullptr;
+  void (*multiply)(const float* input1, const float* input2, float* output,
+                   uint32_t size) = nullptr;
+};
+
+/**
+ * @brief The widest instruction set the CPU and the OS support, from CPUID
+ */
+CpuIsa DetectCpuIsa();
+
+const char* CpuIsaName(CpuIsa isa);
+
+/**
+ * @brief The kernels used by the layers, selected once on first use. They
+ * are the ones of DetectCpuIsa, unless the FREE_INFER_CPU_ISA environment
+ * variable (sse42, avx2 or avx512) caps them to a narrower instruction set
+ */
+const SimdKernels& GetSimdKernels();
+
+/**
+ * @brief The kernels of one instruction set, which the CPU must support
+ */
+const SimdKernels& SimdKernelsOf(CpuIsa isa);
+}  // namespace free_infer
+
+#endif  // __FREE_INFER_SIMD_KERNELS_HPP__
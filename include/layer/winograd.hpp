@@ -0,0 +1,51 @@
+#ifndef __FREE_INFER_WINOGRAD_HPP__
+#define __FREE_INFER_WINOGRAD_HPP__
+
+#include <armadillo>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+#include "layer/gemm.hpp"
+#include "tensor/tensor.hpp"
+
+namespace free_infer {
+/**
+ * @brief Transform 3x3 kernels for the F(4x4, 3x3) Winograd convolution,
+ * done once when the weights are set
+ * @param weights the kernels, each of (kernel_c, 3, 3)
+ * @return 36 packed (kernel_c, kernel_n) matrices, one per element of the
+ * 6x6 transformed tile
+ */
+std::vector<PackedMatrix> WinogradTransformKernel(
+    const std::vector<sftensor>& weights);
+
+/**
+ * @brief Floats of the workspace WinogradConv3x3 needs, the transformed input
+ * and output tiles
+ */
+size_t WinogradWorkspaceSize(uint32_t input_c, uint32_t output_c,
+                             uint32_t output_h, uint32_t output_w);
+
+/**
+ * @brief F(4x4, 3x3) Winograd convolution of one input with stride 1, the
+ * output is computed in 4x4 tiles with 36 GEMMs over the tiles and channels
+ * instead of 9 multiplies per output element
+ * @param input the input tensor
+ * @param kernel_transform the kernels transformed by WinogradTransformKernel
+ * @param padding_h the zero padding of the rows
+ * @param padding_w the zero padding of the cols
+ * @param output the output tensor, already sized
+ * @param workspace WinogradWorkspaceSize floats of scratch memory
+ * @param epilogue called with the index of each output channel once the
+ * channel is written
+ */
+void WinogradConv3x3(const sftensor& input,
+                     const std::vector<PackedMatrix>& kernel_transform,
+                     uint32_t padding_h, uint32_t padding_w,
+                     const sftensor& output, float* workspace,
+                     const std::function<void(uint32_t)>& epilogue);
+}  // namespace free_infer
+
+#endif  // __FREE_INFER_WINOGRAD_HPP__
@@ -0,0 +1,85 @@
+#ifndef __FREE_INFER_BATCH_SCHEDULER_HPP__
+#define __FREE_INFER_BATCH_SCHEDULER_HPP__
+
+#include <chrono>
+#include <cstdint>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "runtime/request_queue.hpp"
+#include "runtime/runtime_ir.hpp"
+#include "tensor/tensor.hpp"
+
+namespace free_infer {
+
+struct BatchSchedulerStats {
+  uint64_t request_count = 0;  // requests dispatched so far
+  uint64_t batch_count = 0;    // batched Forwards dispatched so far
+  // time from Submit until the request is dispatched in a batch
+  std::chrono::microseconds total_queue_latency{0};
+  std::chrono::microseconds max_queue_latency{0};
+};
+
+/**
+ * @brief Batching front end of a graph. Single sample requests are collected
+ * until the batch is full or the oldest one has waited for the max wait time,
+ * then they run as one batched ForwardAsync of the graph and the outputs are
+ * scattered back to the requests
+ */
+class BatchScheduler {
+ public:
+  /**
+   * @brief Start the scheduler on a built graph
+   * @param graph the graph running the batches, it must outlive the scheduler
+   * @param max_batch_size the largest batch to collect, at most the max batch
+   * size of the graph
+   * @param max_wait the longest time the oldest request of a batch waits for
+   * more requests
+   */
+  BatchScheduler(RuntimeGraph& graph, uint32_t max_batch_size,
+                 std::chrono::microseconds max_wait);
+  ~BatchScheduler();
+
+  BatchScheduler(const BatchScheduler&) = delete;
+  BatchScheduler& operator=(const BatchScheduler&) = delete;
+
+  /**
+   * @brief Queue one sample, samples of other shapes are not batched with it
+   * @param input the input sample, it must not be modified until the request
+   * finishes
+   * @return the future of the output of the sample
+   */
+  std::future<sftensor> Submit(sftensor input);
+
+  uint32_t max_batch_size() const;
+  std::chrono::microseconds max_wait() const;
+  BatchSchedulerStats stats() const;
+
+ private:
+  struct Request {
+    sftensor input;
+    std::shared_ptr<std::promise<sftensor>> promise;
+    std::chrono::steady_clock::time_point submit_time;
+  };
+
+  void RunDispatcher();
+
+  void Dispatch(std::vector<Request>& batch);
+
+ private:
+  RuntimeGraph& graph_;
+  const uint32_t max_batch_size_;
+  const std::chrono::microseconds max_wait_;
+  RequestQueue<Request> request_queue_;
+  std::thread dispatcher_;
+
+  mutable std::mutex stats_mutex_;
+  BatchSchedulerStats stats_;
+};
+
+}  // namespace free_infer
+
+#endif  // __FREE_INFER_BATCH_SCHEDULER_HPP__
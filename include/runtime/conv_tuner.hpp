@@ -0,0 +1,84 @@
+#ifndef __FREE_INFER_CONV_TUNER_HPP__
+#define __FREE_INFER_CONV_TUNER_HPP__
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "layer/layer_convolution.hpp"
+#include "tensor/tensor.hpp"
+
+namespace free_infer {
+
+/**
+ * @brief Picks the fastest algorithm of every convolution layer by timing the
+ * ones it supports on its actual inputs. The choices are kept in a tuning
+ * cache file keyed by the model, the layer and the CPU, so later startups
+ * reuse them without timing again
+ */
+class ConvTuner {
+ public:
+  /**
+   * @param cache_path the tuning cache file, empty to tune without a cache
+   * @param model the model the layers belong to, e.g. its param file
+   */
+  ConvTuner(std::string cache_path, std::string model);
+
+  /**
+   * @brief Read the choices of the cache file, a missing file is an empty
+   * cache
+   * @return false if the file exists but can not be parsed
+   */
+  bool Load();
+
+  /**
+   * @brief Write the choices found in the cache file and made since back to
+   * it, nothing is written if there is no new choice
+   */
+  bool Save() const;
+
+  /**
+   * @brief Set the algorithm of a convolution layer, from the cache or by
+   * timing every algorithm the layer supports on the inputs and outputs
+   * with the thread count of the calling thread
+   * @param layer_name the name of the layer in the model
+   * @param layer the convolution layer
+   * @param inputs the inputs of the layer, their values do not matter
+   * @param outputs the outputs of the layer, overwritten
+   * @return the chosen algorithm
+   */
+  ConvAlgorithm Tune(const std::string& layer_name, ConvolutionLayer& layer,
+                     const std::vector<sftensor>& inputs,
+                     std::vector<sftensor>& outputs);
+
+  uint32_t tuned_count() const;   // layers timed by Tune
+  uint32_t cached_count() const;  // layers Tune took from the cache
+
+  /**
+   * @brief The model name of the CPU, the key of the cache next to the model
+   * and the layer
+   */
+  static std::string CpuName();
+
+ private:
+  std::string Key(const std::string& layer_name,
+                  const std::vector<sftensor>& inputs) const;
+
+  static double TimeForward(ConvolutionLayer& layer,
+                            const std::vector<sftensor>& inputs,
+                            std::vector<sftensor>& outputs);
+
+ private:
+  std::string cache_path_;
+  std::string model_;
+  std::string cpu_name_;
+  std::map<std::string, ConvAlgorithm> choices_;
+  bool dirty_ = false;  // a choice is missing from the cache file
+  uint32_t tuned_count_ = 0;
+  uint32_t cached_count_ = 0;
+};
+
+}  // namespace free_infer
+
+#endif  // __FREE_INFER_CONV_TUNER_HPP__
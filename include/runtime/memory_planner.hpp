@@ -0,0 +1,63 @@
+#ifndef __FREE_INFER_MEMORY_PLANNER_HPP__
+#define __FREE_INFER_MEMORY_PLANNER_HPP__
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "runtime/runtime_ir.hpp"
+
+namespace free_infer {
+
+struct MemoryPlanReport {
+  size_t naive_bytes = 0;    // one buffer per operand, as without planning
+  size_t planned_bytes = 0;  // sum of the arena sizes
+  uint32_t operand_count = 0;
+  uint32_t arena_count = 0;
+};
+
+class MemoryPlanner {
+ public:
+  struct OperandLifetime {
+    std::shared_ptr<RuntimeOperand> operand;
+    uint32_t produce_index = 0;  // topo index of the producer
+    uint32_t last_use_index = 0;  // topo index of the last consumer
+    size_t elem_size = 0;        // floats for the whole batch
+    uint32_t arena_index = 0;
+  };
+
+  /**
+   * @brief Work out the lifetime of every operator output over the topo queue
+   * and assign the outputs to arenas, outputs whose lifetimes do not overlap
+   * share the same arena
+   * @param operators_topo the operators in the topo order of execution
+   * @param concurrent the operators may run concurrently, then an arena is
+   * only reused once all users of its last tenant are ancestors of the new
+   * producer instead of just being earlier in the topo order
+   */
+  void Plan(const std::vector<std::shared_ptr<RuntimeOperator>>& operators_topo,
+            bool concurrent = false);
+
+  /**
+   * @brief Allocate the arenas and fill the planned operands with tensors
+   * viewing the arena memory
+   */
+  void Allocate();
+
+  const MemoryPlanReport& report() const;
+  const std::vector<OperandLifetime>& lifetimes() const;
+
+ private:
+  static size_t OperandElemSize(const std::vector<int>& shapes);
+
+ private:
+  std::vector<OperandLifetime> lifetimes_;
+  std::vector<size_t> arena_sizes_;
+  std::vector<std::vector<float>> arenas_;
+  MemoryPlanReport report_;
+};
+
+}  // namespace free_infer
+
+#endif  // __FREE_INFER_MEMORY_PLANNER_HPP__
@@ -0,0 +1,96 @@
+#ifndef __FREE_INFER_REQUEST_QUEUE_HPP__
+#define __FREE_INFER_REQUEST_QUEUE_HPP__
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <queue>
+#include <utility>
+
+namespace free_infer {
+/**
+ * @brief Blocking multi-producer multi-consumer queue of requests, any
+ * number of threads may push and pop at the same time
+ */
+template <typename T>
+class RequestQueue {
+ public:
+  RequestQueue() = default;
+
+  RequestQueue(const RequestQueue&) = delete;
+  RequestQueue& operator=(const RequestQueue&) = delete;
+
+  /**
+   * @brief Add a request and wake up one waiting consumer
+   * @param request the request to add
+   * @return false if the queue is closed, the request is dropped then
+   */
+  bool Push(T request) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (closed_) {
+        return false;
+      }
+      requests_.push(std::move(request));
+    }
+    condition_.notify_one();
+    return true;
+  }
+
+  /**
+   * @brief Wait for a request and take it out of the queue
+   * @param request the request taken out
+   * @return false once the queue is closed and all requests are taken
+   */
+  bool Pop(T& request) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    condition_.wait(lock, [this] { return closed_ || !requests_.empty(); });
+    if (requests_.empty()) {
+      return false;
+    }
+    request = std::move(requests_.front());
+    requests_.pop();
+    return true;
+  }
+
+  /**
+   * @brief Wait for a request until the deadline and take it out of the queue
+   * @param request the request taken out
+   * @param deadline the latest time to wait for
+   * @return false on timeout, or once the queue is closed and all requests
+   * are taken
+   */
+  template <typename Clock, typename Duration>
+  bool PopUntil(T& request,
+                const std::chrono::time_point<Clock, Duration>& deadline) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    condition_.wait_until(lock, deadline,
+                          [this] { return closed_ || !requests_.empty(); });
+    if (requests_.empty()) {
+      return false;
+    }
+    request = std::move(requests_.front());
+    requests_.pop();
+    return true;
+  }
+
+  /**
+   * @brief Refuse new requests, the queued ones are still handed out
+   */
+  void Close() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      closed_ = true;
+    }
+    condition_.notify_all();
+  }
+
+ private:
+  bool closed_ = false;
+  std::mutex mutex_;
+  std::condition_variable condition_;
+  std::queue<T> requests_;
+};
+}  // namespace free_infer
+
+#endif  // __FREE_INFER_REQUEST_QUEUE_HPP__
@@ -3,14 +3,20 @@
 
 #include <glog/types.h>
 
+#include <array>
 #include <cstdint>
+#include <functional>
+#include <future>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
 #include <type_traits>
 #include <vector>
 
 #include "pnnx/ir.h"
+#include "request_queue.hpp"
 #include "status_code.hpp"
 #include "tensor/tensor.hpp"
 
@@ -23,6 +29,58 @@ class RuntimeParameter;
 
 class RuntimeAttribute;
 class Layer;  // No completing
+class MemoryPlanner;
+struct MemoryPlanReport;
+class ThreadPool;
+
+/**
+ * @brief One operator of the execution plan with its tensors resolved at
+ * build time, so running it needs no lookups
+ */
+struct ExecutionStep {
+  std::shared_ptr<RuntimeOperator> op;
+  Layer* layer = nullptr;  // nullptr for pnnx.Input and pnnx.Output
+  // the planned tensors of every input operand for the max batch, in the
+  // operand order of the operator, nullptr for the graph input
+  std::vector<const std::vector<sftensor>*> operand_datas;
+  const std::vector<sftensor>* output_datas = nullptr;
+  // the tensors bound for the batch size of the current Forward
+  std::vector<sftensor> inputs;
+  std::vector<sftensor> outputs;
+};
+
+/**
+ * @brief Channels, rows and cols of one sample of the graph input
+ */
+using InputShape = std::array<uint32_t, 3>;
+
+/**
+ * @brief The execution steps and the planned operand storage built for one
+ * input shape, cached by the graph so every shape is planned only once
+ */
+struct ExecutionPlan {
+  struct InputBinding {
+    uint32_t step_index = 0;
+    uint32_t offset = 0;  // position of the graph input in the step inputs
+  };
+
+  InputShape input_shape{};
+  std::unique_ptr<MemoryPlanner> memory_planner;  // owns the arenas
+  // the planned output tensors of every operator for the max batch, in the
+  // topo order, the steps point into it
+  std::vector<std::vector<sftensor>> operand_datas;
+  std::vector<ExecutionStep> steps;  // in the topo order
+  std::vector<InputBinding> input_bindings;
+  // outputs of the operator feeding the graph output, nullptr when it is fed
+  // by the graph input directly
+  const std::vector<sftensor>* graph_outputs = nullptr;
+  uint32_t bound_batch_size = 0;  // batch size the steps are bound for
+  // the workspace arena lent to the layers, one slot per operator that may
+  // run at the same time, each of workspace_slot_size floats
+  std::vector<float> workspace;
+  size_t workspace_slot_size = 0;
+  std::vector<uint32_t> free_workspace_slots;  // of the parallel executor
+};
 
 class RuntimeGraph {
  private:
@@ -33,7 +91,13 @@ class RuntimeGraph {
   };
 
  public:
+  enum class ExecutorMode {
+    kSerial = 0,    // operators run one by one in the topo order
+    kParallel = 1,  // ready operators are dispatched onto a worker pool
+  };
+
   RuntimeGraph(std::string param_path, std::string bin_path);
+  ~RuntimeGraph();
   void set_bin_path(const std::string& bin_path);
   void set_param_path(const std::string& param_path);
   const std::string& bin_path() const;
@@ -41,12 +105,100 @@ class RuntimeGraph {
   const std::vector<std::shared_ptr<RuntimeOperator>>& operators() const;
   const std::vector<std::shared_ptr<RuntimeOperator>>& get_topo_queues() const;
   const GraphState graph_state() const;
+  /**
+   * @brief The memory plan of the input shape the last Forward ran with, or
+   * of the param file shape right after Build
+   */
+  const MemoryPlanReport& memory_plan_report() const;
+
+  /**
+   * @brief Number of input shapes a plan has been built for
+   */
+  uint32_t cached_plan_count() const;
+
+  /**
+   * @brief Select how Forward runs the operators, must be set before Build
+   * @param mode serial or dependency driven parallel execution
+   * @param num_workers worker threads of the parallel executor, 0 means the
+   * number of hardware threads
+   */
+  void set_executor_mode(ExecutorMode mode, uint32_t num_workers = 0);
+  ExecutorMode executor_mode() const;
+
+  /**
+   * @brief Set the number of threads the layers split their loops over
+   * @param num_threads thread count of the intra-op ParallelFor, 0 means the
+   * number of hardware threads
+   */
+  void set_num_threads(uint32_t num_threads);
+  uint32_t num_threads() const;
+
+  /**
+   * @brief Set the largest batch Forward accepts, must be set before Build.
+   * The operand storage is planned for this batch and smaller batches run on
+   * a part of it, so one graph serves any batch size up to it
+   * @param max_batch_size the largest batch, 0 means the batch size in the
+   * param file, which then must not be dynamic
+   */
+  void set_max_batch_size(uint32_t max_batch_size);
+  uint32_t max_batch_size() const;
+
+  /**
+   * @brief Time the algorithms of every convolution on the first planned
+   * input shape and keep the fastest, must be set before Build
+   * @param enable whether to tune the convolutions
+   * @param cache_path the tuning cache file, the choices found in it are
+   * reused and the new ones are added to it, empty to always time
+   */
+  void set_conv_tuning(bool enable, const std::string& cache_path = "");
+  bool conv_tuning() const;
   bool Init();
   bool Build(const std::string& input_name, const std::string& output_name);
+
+  /**
+   * @brief Create an execution context of a built graph. The clone shares the
+   * layers and their weights with this graph and owns only its operands and
+   * plans, so clones can run Forward concurrently at the cost of their
+   * activation buffers alone
+   * @return a built graph with the settings of this one
+   */
+  std::unique_ptr<RuntimeGraph> Clone() const;
   void Topo(void);
   void dfs(std::shared_ptr<RuntimeOperator> op);
+
+  /**
+   * @brief Run the graph on a batch of inputs of the same shape. The shape
+   * may differ from the param file, each new input shape is planned on its
+   * first use and its plan is reused by every later Forward with that shape
+   */
   std::vector<sftensor> Forward(const std::vector<sftensor>& inputs);
 
+  /**
+   * @brief Set the number of execution contexts serving ForwardAsync, must be
+   * set before its first call. Every context is a clone of this graph with
+   * its own activation buffers
+   */
+  void set_num_contexts(uint32_t num_contexts);
+  uint32_t num_contexts() const;
+
+  using ForwardCallback = std::function<void(std::vector<sftensor>)>;
+
+  /**
+   * @brief Queue a Forward on the execution contexts and return at once. The
+   * outputs are copied out of the context, so they stay valid after later
+   * requests. The inputs must not be modified until the request finishes
+   * @param inputs a batch of inputs of the same shape
+   * @return the future of the outputs
+   */
+  std::future<std::vector<sftensor>> ForwardAsync(
+      std::vector<sftensor> inputs);
+
+  /**
+   * @brief Queue a Forward on the execution contexts and call back with the
+   * outputs on the context thread when it finishes
+   */
+  void ForwardAsync(std::vector<sftensor> inputs, ForwardCallback callback);
+
 
  private:
   static void InitGraphOperatorsInput(
@@ -66,16 +218,107 @@ class RuntimeGraph {
       const std::shared_ptr<RuntimeOperator>& runtime_operator);
 
   static void InitOperatorInput(
-      const std::vector<std::shared_ptr<RuntimeOperator>>& operators);
+      const std::vector<std::shared_ptr<RuntimeOperator>>& operators,
+      uint32_t max_batch_size);
 
   static void InitOperatorOutput(
       const std::vector<pnnx::Operator*>& pnnx_operators,
-      const std::vector<std::shared_ptr<RuntimeOperator>>& operators);
+      const std::vector<std::shared_ptr<RuntimeOperator>>& operators,
+      uint32_t max_batch_size);
   
   static std::shared_ptr<Layer> CreateLayer(const std::shared_ptr<RuntimeOperator>& op);
-  
-  static void ProbeNextLayer(const std::shared_ptr<RuntimeOperator>& current_op, 
-  const std::vector<sftensor>& layer_output_data);
+
+  /**
+   * @brief Let the producer take over the consumers of the operator and drop
+   * the operator from the graph, used once the operator is fused into it
+   */
+  void BypassOperator(const std::shared_ptr<RuntimeOperator>& producer,
+                      const std::shared_ptr<RuntimeOperator>& op);
+
+  /**
+   * @brief Fold every batch norm following a convolution into the weights and
+   * bias of the convolution and drop the batch norm operator, the
+   * convolution must be its only producer and the batch norm its only
+   * consumer
+   */
+  void FoldConvBatchNorm();
+
+  /**
+   * @brief Fuse every residual add of a convolution output into the epilogue
+   * of the convolution, which reads the other operand of the add as a second
+   * input, and drop the add operator, the add must be the only consumer of
+   * the convolution and both operands must have the same shape
+   */
+  void FuseConvResidual();
+
+  /**
+   * @brief Fold every activation following a convolution into the epilogue
+   * of the convolution and drop the activation operator, the convolution
+   * must be its only producer and the activation its only consumer
+   */
+  void FuseConvActivation();
+
+  /**
+   * @brief Derive the shape of every operand from the graph input shape by
+   * running the shape inference of the layers over the topo queue
+   */
+  void InferShapes(const InputShape& input_shape);
+
+  /**
+   * @brief Find the plan of the input shape in the cache, or infer the
+   * shapes, plan the memory and build the plan for it on first use
+   */
+  ExecutionPlan* PrepareExecutionPlan(const InputShape& input_shape);
+
+  /**
+   * @brief Pick the algorithm of every convolution of the plan with a
+   * ConvTuner, on random inputs of the planned shapes and the planned
+   * outputs for the max batch
+   */
+  void TuneConvolutions(ExecutionPlan& plan);
+
+  /**
+   * @brief Size the workspace slots of the plan to the largest workspace of
+   * its layers and allocate them, once per input shape so Forward does not
+   * allocate any workspace
+   */
+  void PlanWorkspace(ExecutionPlan& plan);
+
+  /**
+   * @brief Lower the topo queue into execution steps, binding every step to
+   * the planned output tensors of its producers
+   */
+  void BuildExecutionPlan(ExecutionPlan& plan);
+
+  /**
+   * @brief Bind the steps to the first batch_size tensors of every operand
+   */
+  void BindBatch(ExecutionPlan& plan, uint32_t batch_size);
+
+  void BindGraphInputs(ExecutionPlan& plan,
+                       const std::vector<sftensor>& inputs);
+
+  void RunStep(uint32_t step_index);
+
+  struct ExecutorState;  // per Forward state of the parallel executor
+
+  void InitExecutor();
+
+  uint32_t ExecutorWorkers() const;
+
+  void RunParallelTask(const std::shared_ptr<ExecutorState>& state,
+                       uint32_t op_index);
+
+  void ForwardParallel();
+
+  struct ForwardRequest {
+    std::vector<sftensor> inputs;
+    ForwardCallback callback;
+  };
+
+  void StartContexts();
+
+  void RunContext(RuntimeGraph* context);
 
  private:
   std::string input_name_;
@@ -86,6 +329,27 @@ class RuntimeGraph {
   std::map<std::string, std::shared_ptr<RuntimeOperator>> operators_maps_;
   std::vector<std::shared_ptr<RuntimeOperator>> operators_topo_;
 
+  std::map<InputShape, std::unique_ptr<ExecutionPlan>> plan_cache_;
+  ExecutionPlan* current_plan_ = nullptr;  // plan of the last input shape
+
+  ExecutorMode executor_mode_ = ExecutorMode::kSerial;
+  uint32_t executor_workers_ = 0;
+  uint32_t num_threads_ = 0;
+  uint32_t max_batch_size_ = 0;
+  bool conv_tuning_ = false;
+  bool conv_tuned_ = false;  // tuning runs on the first planned shape only
+  std::string tuning_cache_path_;
+  std::unique_ptr<ThreadPool> executor_pool_;
+  std::mutex workspace_mutex_;  // guards the free workspace slots
+  std::vector<uint32_t> dependency_counts_;  // in-degree of each topo operator
+  std::vector<std::vector<uint32_t>> successor_indices_;
+
+  uint32_t num_contexts_ = 1;
+  std::once_flag contexts_flag_;
+  std::unique_ptr<RequestQueue<ForwardRequest>> request_queue_;
+  std::vector<std::unique_ptr<RuntimeGraph>> contexts_;
+  std::vector<std::thread> context_workers_;
+
   GraphState graph_state_ = GraphState::NeedInit;
   std::unique_ptr<pnnx::Graph> graph_;  // graph in pnnx
 };
@@ -0,0 +1,86 @@
+#ifndef __FREE_INFER_THREAD_POOL_HPP__
+#define __FREE_INFER_THREAD_POOL_HPP__
+
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+namespace free_infer {
+class ThreadPool {
+ public:
+  /**
+   * @brief Create a pool with a fixed number of worker threads
+   * @param num_threads the number of worker threads
+   */
+  explicit ThreadPool(uint32_t num_threads);
+  ~ThreadPool();
+
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+  /**
+   * @brief Run the task on one of the worker threads
+   * @param task the task to run
+   */
+  void Enqueue(std::function<void()> task);
+
+  uint32_t num_threads() const;
+
+  /**
+   * @brief The process wide pool shared by the layers for intra-op
+   * parallelism, created on first use with one worker less than the hardware
+   * threads since the caller of ParallelFor works as well
+   */
+  static ThreadPool& Global();
+
+ private:
+  void WorkerLoop();
+
+ private:
+  bool stop_ = false;
+  std::mutex mutex_;
+  std::condition_variable condition_;
+  std::queue<std::function<void()>> tasks_;
+  std::vector<std::thread> workers_;
+};
+
+/**
+ * @brief Run func(i) for every i in [begin, end) on the global thread pool
+ * together with the calling thread. The range is split into equal contiguous
+ * chunks, one per thread, so the split only depends on the range and the
+ * thread count. Calls nested in another ParallelFor run serially.
+ * @param begin the first index
+ * @param end one past the last index
+ * @param func the loop body, different indices must not write the same memory
+ */
+void ParallelFor(uint32_t begin, uint32_t end,
+                 const std::function<void(uint32_t)>& func);
+
+/**
+ * @brief Thread count used by ParallelFor on the current thread, 0 means the
+ * number of hardware threads
+ */
+uint32_t GetParallelThreads();
+
+/**
+ * @brief Set the thread count used by ParallelFor on the current thread for
+ * the lifetime of the guard
+ */
+class ParallelThreadsGuard {
+ public:
+  explicit ParallelThreadsGuard(uint32_t num_threads);
+  ~ParallelThreadsGuard();
+
+  ParallelThreadsGuard(const ParallelThreadsGuard&) = delete;
+  ParallelThreadsGuard& operator=(const ParallelThreadsGuard&) = delete;
+
+ private:
+  uint32_t prev_num_threads_ = 0;
+};
+}  // namespace free_infer
+
+#endif  // __FREE_INFER_THREAD_POOL_HPP__
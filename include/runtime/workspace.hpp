@@ -0,0 +1,40 @@
+#ifndef __FREE_INFER_WORKSPACE_HPP__
+#define __FREE_INFER_WORKSPACE_HPP__
+
+#include <cstddef>
+
+namespace free_infer {
+/**
+ * @brief Scratch memory lent to the layers by the graph running them, so
+ * their Forward does not allocate it on every call
+ */
+struct Workspace {
+  float* data = nullptr;
+  size_t size = 0;  // floats
+  bool lent = false;  // set by WorkspaceGuard, false outside a graph
+};
+
+/**
+ * @brief The workspace lent to the layer Forward on the current thread, empty
+ * when the layer runs outside a graph
+ */
+Workspace GetWorkspace();
+
+/**
+ * @brief Lend the workspace to the layer Forward calls on the current thread
+ * for the lifetime of the guard
+ */
+class WorkspaceGuard {
+ public:
+  WorkspaceGuard(float* data, size_t size);
+  ~WorkspaceGuard();
+
+  WorkspaceGuard(const WorkspaceGuard&) = delete;
+  WorkspaceGuard& operator=(const WorkspaceGuard&) = delete;
+
+ private:
+  Workspace prev_workspace_;
+};
+}  // namespace free_infer
+
+#endif  // __FREE_INFER_WORKSPACE_HPP__
@@ -45,6 +45,17 @@ class Tensor<float> {
    */
   explicit Tensor(const std::vector<uint32_t>& shapes);
 
+  /**
+   * @brief Create a 3dim tensor on top of external memory, the tensor does not
+   * own the memory and the caller must keep it alive
+   * @param raw_ptr   the memory holding channels * rows * cols floats
+   * @param channels  channels of the 3dim tensor
+   * @param rows      rows of the 3dim tensor
+   * @param cols      cols of the 3dim tensor
+   */
+  explicit Tensor(float* raw_ptr, uint32_t channels, uint32_t rows,
+                  uint32_t cols);
+
   Tensor(const Tensor& tensor);
   Tensor(Tensor&& tensor) noexcept;
   Tensor<float>& operator=(Tensor&& tensor) noexcept;
@@ -7,6 +7,7 @@
 #include "layer/layer_factory.hpp"
 #include "runtime/runtime_ir.hpp"
 #include "runtime/status_code.hpp"
+#include "runtime/thread_pool.hpp"
 #include "tensor/tensor.hpp"
 
 namespace free_infer {
@@ -36,6 +37,12 @@ InferStatus AdaptiveAvgPoolingLayer::Forward(
           << i << "batch";
       return InferStatus::kInferFailedInputEmpty;
     }
+    if (input_data->shapes() != inputs.front()->shapes()) {
+      LOG(ERROR) << "The input tensors of the adaptive avgpooling layer have "
+                    "different shapes "
+                 << i << "batch";
+      return InferStatus::kInferFailedInputOutSizeMatchError;
+    }
     if (output_data != nullptr && !output_data->empty()) {
       if (output_data->rows() != output_h_ &&
           output_data->cols() != output_w_) {
@@ -51,13 +58,6 @@ InferStatus AdaptiveAvgPoolingLayer::Forward(
   for (uint32_t i = 0; i < batch; ++i) {
     const sftensor& input = inputs.at(i);
     const uint32_t input_c = input->channels();
-    const uint32_t input_h = input->rows();
-    const uint32_t input_w = input->cols();
-    const uint32_t stride_h = uint32_t(std::floor(input_h / output_h_));
-    const uint32_t stride_w = uint32_t(std::floor(input_w / output_w_));
-    const uint32_t pooling_h = input_h - (output_h_ - 1) * stride_h;
-    const uint32_t pooling_w = input_w - (output_w_ - 1) * stride_w;
-    const uint32_t pooling_size = pooling_h * pooling_w;
 
     sftensor output = outputs.at(i);
     if (output == nullptr || output->empty()) {
@@ -70,31 +70,63 @@ InferStatus AdaptiveAvgPoolingLayer::Forward(
         << "The output tensor array in the adaptive avgpooling layer "
            "has an incorrectly sized tensor "
         << i << "batch";
+  }
+
+  const uint32_t input_c = inputs.front()->channels();
+  ParallelFor(0, batch * input_c, [&](uint32_t index) {
+    const uint32_t i = index / input_c;
+    const uint32_t ic = index % input_c;
+    const sftensor& input = inputs.at(i);
+    const uint32_t input_h = input->rows();
+    const uint32_t input_w = input->cols();
+    const uint32_t stride_h = uint32_t(std::floor(input_h / output_h_));
+    const uint32_t stride_w = uint32_t(std::floor(input_w / output_w_));
+    const uint32_t pooling_h = input_h - (output_h_ - 1) * stride_h;
+    const uint32_t pooling_w = input_w - (output_w_ - 1) * stride_w;
+    const uint32_t pooling_size = pooling_h * pooling_w;
 
-    for (uint32_t ic = 0; ic < input_c; ++ic) {
-      const arma::fmat& input_ic = input->slice(ic);
-      arma::fmat& output_ic = output->slice(ic);
-      for (uint32_t w = 0; w < input_w; w += stride_w) {
-        int output_ic_w = int(w / stride_w);
-        for (uint32_t h = 0; h < input_h; h += stride_h) {
-          int output_ic_h = int(h / stride_h);
-          float* output_ic_ptr = output_ic.colptr(output_ic_w);
-          float avg_value = 0.f;
-          for(uint32_t pw = 0; pw < pooling_w; ++pw){
-            const float* input_ic_ptr = input_ic.colptr(w + pw);
-            for(uint32_t ph = 0; ph < pooling_h; ++ph){
-              float current_value = *(input_ic_ptr + h + ph);
-              avg_value += current_value;
-            }
+    const arma::fmat& input_ic = input->slice(ic);
+    arma::fmat& output_ic = outputs.at(i)->slice(ic);
+    for (uint32_t w = 0; w < input_w; w += stride_w) {
+      int output_ic_w = int(w / stride_w);
+      for (uint32_t h = 0; h < input_h; h += stride_h) {
+        int output_ic_h = int(h / stride_h);
+        float* output_ic_ptr = output_ic.colptr(output_ic_w);
+        float avg_value = 0.f;
+        for(uint32_t pw = 0; pw < pooling_w; ++pw){
+          const float* input_ic_ptr = input_ic.colptr(w + pw);
+          for(uint32_t ph = 0; ph < pooling_h; ++ph){
+            float current_value = *(input_ic_ptr + h + ph);
+            avg_value += current_value;
           }
-        *(output_ic_ptr + output_ic_h) = avg_value / float(pooling_size);
         }
+        *(output_ic_ptr + output_ic_h) = avg_value / float(pooling_size);
       }
     }
+  });
+
+  return InferStatus::kInferSuccess;
+}
+InferStatus AdaptiveAvgPoolingLayer::InferOutputShape(
+    const std::vector<std::vector<int>>& input_shapes,
+    std::vector<int>& output_shape) const {
+  if (input_shapes.size() != 1 || input_shapes.front().size() != 4) {
+    LOG(ERROR) << "The adaptive avgpooling layer needs one input of 4 dims";
+    return InferStatus::kInferFailedInputOutSizeMatchError;
   }
 
+  const std::vector<int>& input_shape = input_shapes.front();
+  if (input_shape.at(2) < int(output_h_) ||
+      input_shape.at(3) < int(output_w_)) {
+    LOG(ERROR) << "The input of the adaptive avgpooling layer is smaller than "
+                  "its output";
+    return InferStatus::kInferFailedOutputSizeError;
+  }
+  output_shape = {input_shape.at(0), input_shape.at(1), int(output_h_),
+                  int(output_w_)};
   return InferStatus::kInferSuccess;
 }
+
 ParseParameterAttrStatus AdaptiveAvgPoolingLayer::GetInstace(
     const std::shared_ptr<RuntimeOperator>& op,
     std::shared_ptr<Layer>& adaptive_avgpooling_layer) {
@@ -0,0 +1,197 @@
+#include "layer/batchnorm2d.hpp"
+
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "layer/layer_factory.hpp"
+#include "runtime/runtime_ir.hpp"
+#include "runtime/status_code.hpp"
+#include "runtime/thread_pool.hpp"
+#include "tensor/tensor.hpp"
+
+namespace free_infer {
+BatchNorm2dLayer::BatchNorm2dLayer(uint32_t num_features, float eps,
+                                   const std::vector<float>& running_mean,
+                                   const std::vector<float>& running_var,
+                                   const std::vector<float>& affine_weight,
+                                   const std::vector<float>& affine_bias)
+    : Layer("BatchNorm2d"), num_features_(num_features) {
+  CHECK(running_mean.size() == num_features &&
+        running_var.size() == num_features)
+      << "The running mean and var of the batchnorm layer need "
+      << num_features << " values";
+  CHECK(affine_weight.empty() || affine_weight.size() == num_features);
+  CHECK(affine_bias.empty() || affine_bias.size() == num_features);
+
+  scale_.resize(num_features);
+  shift_.resize(num_features);
+  for (uint32_t c = 0; c < num_features; ++c) {
+    const float gamma = affine_weight.empty() ? 1.f : affine_weight.at(c);
+    const float beta = affine_bias.empty() ? 0.f : affine_bias.at(c);
+    scale_.at(c) = gamma / std::sqrt(running_var.at(c) + eps);
+    shift_.at(c) = beta - running_mean.at(c) * scale_.at(c);
+  }
+}
+
+const std::vector<float>& BatchNorm2dLayer::scale() const {
+  return this->scale_;
+}
+
+const std::vector<float>& BatchNorm2dLayer::shift() const {
+  return this->shift_;
+}
+
+InferStatus BatchNorm2dLayer::Forward(const std::vector<sftensor>& inputs,
+                                      std::vector<sftensor>& outputs) {
+  if (inputs.empty()) {
+    LOG(ERROR) << "The input tensor array in the batchnorm layer is empty";
+    return InferStatus::kInferFailedInputEmpty;
+  }
+
+  if (inputs.size() != outputs.size()) {
+    LOG(ERROR) << "The input and output tensor array size of the batchnorm "
+                  "layer do not match";
+    return InferStatus::kInferFailedInputOutSizeMatchError;
+  }
+
+  const uint32_t batch_size = inputs.size();
+  for (uint32_t i = 0; i < batch_size; ++i) {
+    const sftensor& input = inputs.at(i);
+    if (input == nullptr || input->empty()) {
+      LOG(ERROR) << "The input tensor array in the batchnorm layer has an "
+                    "empty tensor "
+                 << i << " th";
+      return InferStatus::kInferFailedInputEmpty;
+    }
+    if (input->shapes() != inputs.front()->shapes()) {
+      LOG(ERROR) << "The input tensors of the batchnorm layer have different "
+                    "shapes "
+                 << i << " th";
+      return InferStatus::kInferFailedInputOutSizeMatchError;
+    }
+    if (input->channels() != num_features_) {
+      LOG(ERROR) << "The input channel " << input->channels()
+                 << " of the batchnorm layer does not match " << num_features_;
+      return InferStatus::kInferFailedChannelParameterError;
+    }
+
+    sftensor& output = outputs.at(i);
+    if (output == nullptr || output->empty()) {
+      output = std::make_shared<Tensor<float>>(input->shapes());
+    } else if (input->shapes() != output->shapes()) {
+      LOG(ERROR) << "The input and output tensor shapes of the batchnorm "
+                    "layer do not match "
+                 << i << " th";
+      return InferStatus::kInferFailedInputOutSizeMatchError;
+    }
+  }
+
+  ParallelFor(0, batch_size * num_features_, [&](uint32_t index) {
+    const uint32_t i = index / num_features_;
+    const uint32_t c = index % num_features_;
+    const sftensor& input = inputs.at(i);
+    const uint32_t planes = input->rows() * input->cols();
+    const float* input_ptr = input->matrix_raw_ptr(c);
+    float* output_ptr = outputs.at(i)->matrix_raw_ptr(c);
+    const float scale = scale_.at(c);
+    const float shift = shift_.at(c);
+    for (uint32_t j = 0; j < planes; ++j) {
+      output_ptr[j] = input_ptr[j] * scale + shift;
+    }
+  });
+  return InferStatus::kInferSuccess;
+}
+
+InferStatus BatchNorm2dLayer::InferOutputShape(
+    const std::vector<std::vector<int>>& input_shapes,
+    std::vector<int>& output_shape) const {
+  if (input_shapes.size() != 1 || input_shapes.front().size() != 4) {
+    LOG(ERROR) << "The batchnorm layer needs one input of 4 dims";
+    return InferStatus::kInferFailedInputOutSizeMatchError;
+  }
+  if (input_shapes.front().at(1) != int(num_features_)) {
+    LOG(ERROR) << "The input channel " << input_shapes.front().at(1)
+               << " of the batchnorm layer does not match " << num_features_;
+    return InferStatus::kInferFailedChannelParameterError;
+  }
+  output_shape = input_shapes.front();
+  return InferStatus::kInferSuccess;
+}
+
+ParseParameterAttrStatus BatchNorm2dLayer::GetInstace(
+    const std::shared_ptr<RuntimeOperator>& op,
+    std::shared_ptr<Layer>& batchnorm_layer) {
+  CHECK(op != nullptr) << "BatchNorm2d operator is nullptr";
+  const auto& params = op->params;
+  if (params.find("eps") == params.end()) {
+    LOG(ERROR) << "Can not find the eps parameter";
+    return ParseParameterAttrStatus::kParameterMissingEps;
+  }
+  auto eps = std::dynamic_pointer_cast<RuntimeParameterFloat>(params.at("eps"));
+  if (!eps) {
+    LOG(ERROR) << "Can not find the eps parameter";
+    return ParseParameterAttrStatus::kParameterMissingEps;
+  }
+
+  if (params.find("num_features") == params.end()) {
+    LOG(ERROR) << "Can not find the num_features parameter";
+    return ParseParameterAttrStatus::kParameterMissingNumFeatures;
+  }
+  auto num_features =
+      std::dynamic_pointer_cast<RuntimeParameterInt>(params.at("num_features"));
+  if (!num_features || num_features->value <= 0) {
+    LOG(ERROR) << "Can not find the num_features parameter";
+    return ParseParameterAttrStatus::kParameterMissingNumFeatures;
+  }
+
+  const auto& attrs = op->attrs;
+  if (attrs.find("running_mean") == attrs.end()) {
+    LOG(ERROR) << "Can not find the running mean attribute";
+    return ParseParameterAttrStatus::kAttrMissingRunningMean;
+  }
+  if (attrs.find("running_var") == attrs.end()) {
+    LOG(ERROR) << "Can not find the running var attribute";
+    return ParseParameterAttrStatus::kAttrMissingRunningVar;
+  }
+  const std::vector<float>& running_mean =
+      attrs.at("running_mean")->get<float>();
+  const std::vector<float>& running_var = attrs.at("running_var")->get<float>();
+  if (running_mean.size() != num_features->value) {
+    LOG(ERROR) << "The attribute of running mean shape is wrong";
+    return ParseParameterAttrStatus::kAttrMissingRunningMean;
+  }
+  if (running_var.size() != num_features->value) {
+    LOG(ERROR) << "The attribute of running var shape is wrong";
+    return ParseParameterAttrStatus::kAttrMissingRunningVar;
+  }
+
+  // the affine parameters are only exported with affine=True
+  std::vector<float> affine_weight;
+  std::vector<float> affine_bias;
+  if (attrs.find("weight") != attrs.end()) {
+    affine_weight = attrs.at("weight")->get<float>();
+    if (affine_weight.size() != num_features->value) {
+      LOG(ERROR) << "The attribute of weight shape is wrong";
+      return ParseParameterAttrStatus::kAttrMissingWeight;
+    }
+  }
+  if (attrs.find("bias") != attrs.end()) {
+    affine_bias = attrs.at("bias")->get<float>();
+    if (affine_bias.size() != num_features->value) {
+      LOG(ERROR) << "The attribute of bias shape is wrong";
+      return ParseParameterAttrStatus::kAttrMissingBias;
+    }
+  }
+
+  batchnorm_layer = std::make_shared<BatchNorm2dLayer>(
+      num_features->value, eps->value, running_mean, running_var,
+      affine_weight, affine_bias);
+  return ParseParameterAttrStatus::kParameterAttrParseSuccess;
+}
+
+LayerReigister BatchNorm2dGetInstace("nn.BatchNorm2d",
+                                     BatchNorm2dLayer::GetInstace);
+}  // namespace free_infer
@@ -0,0 +1,18 @@
+#include "layer/conv_kernels.hpp"
+
+#include <cstdint>
+
+#include "layer/simd_kernels.hpp"
+
+namespace free_infer {
+// the packers are built per instruction set, see simd_kernels_impl.hpp
+Im2ColPacker SelectIm2ColPacker(uint32_t kernel_h, uint32_t kernel_w,
+                                uint32_t stride_h, uint32_t stride_w) {
+  return GetSimdKernels().select_im2col_packer(kernel_h, kernel_w, stride_h,
+                                               stride_w);
+}
+
+Im2ColPacker GenericIm2ColPacker() {
+  return GetSimdKernels().generic_im2col_packer;
+}
+}  // namespace free_infer
@@ -3,14 +3,52 @@
 #include <sys/types.h>
 
 #include <cstdint>
+#include <functional>
+#include <numeric>
+#include <vector>
 
 #include "layer/layer.hpp"
 #include "layer/layer_factory.hpp"
 #include "runtime/status_code.hpp"
+#include "runtime/thread_pool.hpp"
 #include "tensor/tensor.hpp"
-#include "tensor/tensor_util.hpp"
 
 namespace free_infer {
+namespace {
+// copy the input into the output in row major order, the two tensors hold
+// the same elements in different shapes, channels are column major
+void FlattenRowMajor(const Tensor<float>& input, Tensor<float>& output) {
+  const uint32_t input_rows = input.rows();
+  const uint32_t input_cols = input.cols();
+  const uint32_t output_rows = output.rows();
+  const uint32_t output_cols = output.cols();
+  const float* input_ptr = input.data().memptr();
+  float* output_ptr = output.raw_ptr();
+
+  // the row and col of the next output element and the start of its channel
+  uint32_t output_row = 0;
+  uint32_t output_col = 0;
+  size_t output_channel = 0;
+  for (uint32_t c = 0; c < input.channels(); ++c) {
+    const float* input_channel =
+        input_ptr + size_t(c) * input_rows * input_cols;
+    for (uint32_t r = 0; r < input_rows; ++r) {
+      for (uint32_t col = 0; col < input_cols; ++col) {
+        output_ptr[output_channel + size_t(output_col) * output_rows +
+                   output_row] = input_channel[size_t(col) * input_rows + r];
+        if (++output_col == output_cols) {
+          output_col = 0;
+          if (++output_row == output_rows) {
+            output_row = 0;
+            output_channel += size_t(output_rows) * output_cols;
+          }
+        }
+      }
+    }
+  }
+}
+}  // namespace
+
 FlattenLayer::FlattenLayer(uint32_t start_dim, uint32_t end_dim)
     : Layer("Flatten"), start_dim_(start_dim), end_dim_(end_dim) {}
 
@@ -28,61 +66,100 @@ InferStatus FlattenLayer::Forward(const std::vector<sftensor>& inputs,
   }
 
   const uint32_t batch_size = inputs.size();
-
-  int start_dim = start_dim_;
-  int end_dim = end_dim_;
-  int total_dim = 4;
-
+  const sftensor& first_input = inputs.front();
+  CHECK(first_input != nullptr && !first_input->empty())
+      << "The input tensor array in the flatten layer has an empty tensor";
+
+  // a sample is a (channels, rows, cols) tensor, so the operand is 4-D. An
+  // operand of a lower rank in InferOutputShape only lacks leading unit
+  // dims, which count the same from the end and hold no elements
+  const std::vector<uint32_t> input_shape{
+      batch_size, first_input->channels(), first_input->rows(),
+      first_input->cols()};
+  const int total_dim = int(input_shape.size());
+  int start_dim = int(start_dim_);
+  int end_dim = int(end_dim_);
   if (start_dim < 0) {
     start_dim += total_dim;
   }
-
   if (end_dim < 0) {
     end_dim += total_dim;
   }
+  CHECK(start_dim >= 1 && end_dim >= start_dim && end_dim < total_dim)
+      << "Wrong flatten dim: "
+      << "start dim: " << start_dim << " end dim: " << end_dim;
+
+  // the shape of an output sample, without the batch
+  const uint32_t elements_size =
+      std::accumulate(input_shape.begin() + start_dim,
+                      input_shape.begin() + end_dim + 1, 1u, std::multiplies());
+  std::vector<uint32_t> output_shape(input_shape.begin() + 1,
+                                     input_shape.begin() + start_dim);
+  output_shape.push_back(elements_size);
+  output_shape.insert(output_shape.end(), input_shape.begin() + end_dim + 1,
+                      input_shape.end());
+  while (output_shape.size() < 3) {
+    output_shape.insert(output_shape.begin(), 1);
+  }
 
-  CHECK(end_dim >= start_dim);
-  CHECK(start_dim >= 1 && end_dim <= 3);
-
-  for (uint32_t i = 0; i < batch_size; ++i) {
+  ParallelFor(0, batch_size, [&](uint32_t i) {
     const sftensor& input = inputs.at(i);
-
-    const uint32_t input_c = input->channels();
     CHECK(input != nullptr && !input->empty())
         << "The input tensor array in the flatten layer has an empty  "
            "tensor "
         << i << " batch";
+    CHECK(input->shapes() == first_input->shapes())
+        << "The input tensor array in the flatten layer has tensors of "
+           "different shapes "
+        << i << " batch";
 
-    sftensor output = outputs.at(i);
-
-    auto shapes = input->shapes();
-    shapes.insert(shapes.begin(), batch_size);
-    uint32_t elements_size =
-        std::accumulate(shapes.begin() + start_dim,
-                        shapes.begin() + end_dim + 1, 1, std::multiplies());
-
-    output = TensorClone(input);
-
+    sftensor& output = outputs.at(i);
+    if (output == nullptr || output->empty()) {
+      output = std::make_shared<Tensor<float>>(
+          output_shape.at(0), output_shape.at(1), output_shape.at(2));
+    }
+    // a planned output is filled in place, the consumers are bound to it
     CHECK(input->size() == output->size())
         << "The output and input shapes of the flatten layer do "
            "not match "
         << i << " th";
-    outputs.at(i) = output;
-
-    if (start_dim == 1 && end_dim == 3) {
-      output->Reshape({elements_size}, true);
-    } else if (start_dim == 2 && end_dim == 3) {
-      uint32_t channels = input->channels();
-      output->Reshape({channels, elements_size}, true);
-    } else if (start_dim == 1 && end_dim == 2) {
-      uint32_t cols = input->cols();
-      output->Reshape({elements_size, cols}, true);
-    } else {
-      LOG(FATAL) << "Wrong flatten dim: "
-                 << "start dim: " << start_dim << " end dim: " << end_dim;
-    }
+    FlattenRowMajor(*input, *output);
+  });
+
+  return InferStatus::kInferSuccess;
+}
+
+InferStatus FlattenLayer::InferOutputShape(
+    const std::vector<std::vector<int>>& input_shapes,
+    std::vector<int>& output_shape) const {
+  if (input_shapes.size() != 1) {
+    LOG(ERROR) << "The flatten layer needs one input";
+    return InferStatus::kInferFailedInputOutSizeMatchError;
+  }
+
+  const std::vector<int>& input_shape = input_shapes.front();
+  const int total_dim = int(input_shape.size());
+  int start_dim = int(start_dim_);
+  int end_dim = int(end_dim_);
+  if (start_dim < 0) {
+    start_dim += total_dim;
+  }
+  if (end_dim < 0) {
+    end_dim += total_dim;
+  }
+  if (start_dim < 1 || end_dim < start_dim || end_dim >= total_dim) {
+    LOG(ERROR) << "Wrong flatten dim: "
+               << "start dim: " << start_dim << " end dim: " << end_dim;
+    return InferStatus::kInferFailedDimensionParameterError;
   }
 
+  const int elements_size =
+      std::accumulate(input_shape.begin() + start_dim,
+                      input_shape.begin() + end_dim + 1, 1, std::multiplies());
+  output_shape.assign(input_shape.begin(), input_shape.begin() + start_dim);
+  output_shape.push_back(elements_size);
+  output_shape.insert(output_shape.end(), input_shape.begin() + end_dim + 1,
+                      input_shape.end());
   return InferStatus::kInferSuccess;
 }
 
@@ -0,0 +1,149 @@
+#include "layer/gemm.hpp"
+
+#include <glog/logging.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include "layer/simd_kernels.hpp"
+#include "runtime/thread_pool.hpp"
+
+namespace free_infer {
+namespace {
+uint32_t RoundUp(uint32_t value, uint32_t multiple) {
+  return (value + multiple - 1) / multiple * multiple;
+}
+
+// the floats of a packed panel, rounded up to keep the panels aligned
+uint32_t PanelStride(uint32_t block_rows) {
+  return RoundUp(block_rows * kGemmNR,
+                 uint32_t(kGemmAlignment / sizeof(float)));
+}
+
+// pack the m x k block of A into panels of kGemmMR rows, each panel stores
+// its columns of kGemmMR values one after another, the rows past m are zeros
+void PackA(const float* a, uint32_t lda, uint32_t m, uint32_t k,
+           float* a_packed) {
+  for (uint32_t i = 0; i < m; i += kGemmMR) {
+    const uint32_t panel_rows = std::min(kGemmMR, m - i);
+    for (uint32_t p = 0; p < k; ++p) {
+      const float* a_col = a + p * lda + i;
+      uint32_t r = 0;
+      for (; r < panel_rows; ++r) {
+        a_packed[r] = a_col[r];
+      }
+      for (; r < kGemmMR; ++r) {
+        a_packed[r] = 0.f;
+      }
+      a_packed += kGemmMR;
+    }
+  }
+}
+}  // namespace
+
+void PackedMatrix::Pack(const float* data, uint32_t rows, uint32_t cols,
+                        uint32_t row_stride, uint32_t col_stride) {
+  CHECK(data != nullptr && rows > 0 && cols > 0);
+  rows_ = rows;
+  cols_ = cols;
+  panel_count_ = (cols + kGemmNR - 1) / kGemmNR;
+  const uint32_t block_count = (rows + kGemmKC - 1) / kGemmKC;
+  data_.assign(size_t(block_count) * panel_count_ * PanelStride(kGemmKC), 0.f);
+
+  for (uint32_t block = 0; block < block_count; ++block) {
+    const uint32_t row_begin = block * kGemmKC;
+    const uint32_t block_rows = std::min(kGemmKC, rows - row_begin);
+    for (uint32_t panel_i = 0; panel_i < panel_count_; ++panel_i) {
+      float* panel_ptr = data_.data() + PanelOffset(block, panel_i);
+      const uint32_t col_begin = panel_i * kGemmNR;
+      const uint32_t panel_cols = std::min(kGemmNR, cols - col_begin);
+      for (uint32_t r = 0; r < block_rows; ++r) {
+        const float* row_ptr = data + size_t(row_begin + r) * row_stride;
+        for (uint32_t j = 0; j < panel_cols; ++j) {
+          panel_ptr[r * kGemmNR + j] =
+              row_ptr[size_t(col_begin + j) * col_stride];
+        }
+      }
+    }
+  }
+}
+
+uint32_t PackedMatrix::rows() const { return this->rows_; }
+
+uint32_t PackedMatrix::cols() const { return this->cols_; }
+
+bool PackedMatrix::empty() const { return this->data_.empty(); }
+
+const float* PackedMatrix::panel(uint32_t block, uint32_t panel) const {
+  return data_.data() + PanelOffset(block, panel);
+}
+
+size_t PackedMatrix::PanelOffset(uint32_t block, uint32_t panel) const {
+  const uint32_t block_rows = std::min(kGemmKC, rows_ - block * kGemmKC);
+  const size_t block_offset =
+      size_t(block) * panel_count_ * PanelStride(kGemmKC);
+  return block_offset + size_t(panel) * PanelStride(block_rows);
+}
+
+void Gemm(const float* a, uint32_t lda, const PackedMatrix& b, uint32_t m,
+          float* c, uint32_t ldc, const GemmEpilogue& epilogue) {
+  GemmImplicit(
+      [&](uint32_t row_begin, uint32_t rows, uint32_t col_begin, uint32_t cols,
+          float* a_packed) {
+        PackA(a + size_t(col_begin) * lda + row_begin, lda, rows, cols,
+              a_packed);
+      },
+      b, m, c, ldc, epilogue);
+}
+
+void GemmImplicit(const GemmPackA& pack_a, const PackedMatrix& b, uint32_t m,
+                  float* c, uint32_t ldc, const GemmEpilogue& epilogue) {
+  CHECK(!b.empty()) << "The B matrix of the GEMM is not packed";
+  const uint32_t k = b.rows();
+  const uint32_t n = b.cols();
+  const uint32_t m_blocks = (m + kGemmMC - 1) / kGemmMC;
+  // one task per block of C, the A block is packed once per task and reused
+  // across its panels of B, the columns of C are only split when there are
+  // too few row blocks to keep the threads busy, so each block of A is
+  // packed once
+  const uint32_t block_cols =
+      m_blocks >= GetParallelThreads() ? RoundUp(n, kGemmNR) : kGemmNC;
+  const uint32_t n_blocks = (n + block_cols - 1) / block_cols;
+  const auto micro_kernel = GetSimdKernels().gemm_micro_kernel;
+
+  const auto gemm_task = [&](uint32_t task) {
+    const uint32_t m_begin = (task / n_blocks) * kGemmMC;
+    const uint32_t n_begin = (task % n_blocks) * block_cols;
+    const uint32_t block_m = std::min(kGemmMC, m - m_begin);
+    const uint32_t block_n = std::min(block_cols, n - n_begin);
+
+    thread_local AlignedFloats a_packed;
+    a_packed.resize(size_t(kGemmMC) * kGemmKC);
+    for (uint32_t k_begin = 0; k_begin < k; k_begin += kGemmKC) {
+      const uint32_t block_k = std::min(kGemmKC, k - k_begin);
+      pack_a(m_begin, block_m, k_begin, block_k, a_packed.data());
+      const bool last_block = k_begin + block_k == k;
+      for (uint32_t j = 0; j < block_n; j += kGemmNR) {
+        const uint32_t col = n_begin + j;
+        const uint32_t panel_n = std::min(kGemmNR, n - col);
+        const float* b_panel = b.panel(k_begin / kGemmKC, col / kGemmNR);
+        float* c_panel = c + size_t(col) * ldc + m_begin;
+        for (uint32_t i = 0; i < block_m; i += kGemmMR) {
+          micro_kernel(block_k, a_packed.data() + size_t(i) * block_k,
+                       b_panel, c_panel + i, ldc,
+                       std::min(kGemmMR, block_m - i), panel_n, k_begin > 0);
+        }
+        // the columns of the panel are final and still in L1
+        if (last_block && epilogue) {
+          epilogue(m_begin, block_m, col, panel_n, c_panel, ldc);
+        }
+      }
+    }
+  };
+  // a closure of one reference is held in place by std::function, the GEMM
+  // does not allocate it on every call
+  ParallelFor(0, m_blocks * n_blocks,
+              [&gemm_task](uint32_t task) { gemm_task(task); });
+}
+}  // namespace free_infer
@@ -39,6 +39,30 @@ InferStatus Layer::Forward() {
   return status;
 }
 
+InferStatus Layer::InferOutputShape(
+    const std::vector<std::vector<int>>& input_shapes,
+    std::vector<int>& output_shape) const {
+  if (input_shapes.empty()) {
+    LOG(ERROR) << "The input shapes of the " << layer_name_
+               << " layer are empty";
+    return InferStatus::kInferFailedInputEmpty;
+  }
+  for (const auto& input_shape : input_shapes) {
+    if (input_shape != input_shapes.front()) {
+      LOG(ERROR) << "The input shapes of the " << layer_name_
+                 << " layer do not match";
+      return InferStatus::kInferFailedInputOutSizeMatchError;
+    }
+  }
+  output_shape = input_shapes.front();
+  return InferStatus::kInferSuccess;
+}
+
+size_t Layer::WorkspaceSize(
+    const std::vector<std::vector<int>>& input_shapes) const {
+  return 0;
+}
+
 void Layer::set_runtime_operator(
     const std::shared_ptr<RuntimeOperator>& runtime_operator) {
   CHECK(runtime_operator != nullptr);
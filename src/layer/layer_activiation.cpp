@@ -1,7 +1,37 @@
 #include "layer/layer_activiation.hpp"
 
+#include <cstdint>
+#include <string>
+
+#include "layer/simd_kernels.hpp"
 #include "runtime/status_code.hpp"
 
 namespace free_infer {
+void ApplyActivation(ActivationType activation, float* data, uint32_t size) {
+  switch (activation) {
+    case ActivationType::kActivationNone: {
+      break;
+    }
+    case ActivationType::kActivationRelu: {
+      GetSimdKernels().relu(data, data, size);
+      break;
+    }
+    case ActivationType::kActivationSigmoid: {
+      GetSimdKernels().sigmoid(data, data, size);
+      break;
+    }
+    default: {
+      LOG(FATAL) << "Unknown activation type: " << int(activation);
+    }
+  }
+}
 
-}  // namespace free_infer
\ No newline at end of file
+ActivationType ActivationOfOperator(const std::string& op_type) {
+  if (op_type == "nn.ReLU") {
+    return ActivationType::kActivationRelu;
+  } else if (op_type == "nn.Sigmoid" || op_type == "F.sigmoid") {
+    return ActivationType::kActivationSigmoid;
+  }
+  return ActivationType::kActivationNone;
+}
+}  // namespace free_infer
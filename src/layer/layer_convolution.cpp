@@ -4,6 +4,7 @@
 #include <math.h>
 #include <sys/types.h>
 
+#include <algorithm>
 #include <cmath>
 #include <cstdint>
 #include <cstring>
@@ -13,12 +14,78 @@
 #include <vector>
 
 #include "layer/layer.hpp"
+#include "layer/layer_activiation.hpp"
 #include "layer/layer_factory.hpp"
+#include "layer/winograd.hpp"
 #include "runtime/runtime_ir.hpp"
 #include "runtime/status_code.hpp"
+#include "runtime/thread_pool.hpp"
+#include "runtime/workspace.hpp"
 #include "tensor/tensor.hpp"
 
 namespace free_infer {
+namespace {
+// below it the transforms of the Winograd convolution outweigh the GEMMs
+constexpr uint32_t kWinogradMinChannels = 8;
+
+// output[h] += weight * input[h * stride] for h in [0, size), a compile time
+// stride lets the loop be vectorized
+template <uint32_t stride>
+void AccumulateTap(float* output_ptr, const float* input_ptr, float weight,
+                   uint32_t size) {
+  for (uint32_t h = 0; h < size; ++h) {
+    output_ptr[h] += weight * input_ptr[h * stride];
+  }
+}
+
+void AccumulateTap(float* output_ptr, const float* input_ptr, float weight,
+                   uint32_t size, uint32_t stride) {
+  if (stride == 1) {
+    AccumulateTap<1>(output_ptr, input_ptr, weight, size);
+  } else if (stride == 2) {
+    AccumulateTap<2>(output_ptr, input_ptr, weight, size);
+  } else {
+    for (uint32_t h = 0; h < size; ++h) {
+      output_ptr[h] += weight * input_ptr[h * stride];
+    }
+  }
+}
+
+// output[h] = input[h * stride] for h in [0, size)
+void GatherRows(float* output_ptr, const float* input_ptr, uint32_t size,
+                uint32_t stride) {
+  if (stride == 1) {
+    std::memcpy(output_ptr, input_ptr, size * sizeof(float));
+  } else {
+    for (uint32_t h = 0; h < size; ++h) {
+      output_ptr[h] = input_ptr[h * stride];
+    }
+  }
+}
+
+// the output positions [begin, end) along one dimension whose input position
+// under the kernel tap is inside the input, the others read the padding
+struct TapRange {
+  uint32_t begin = 0;
+  uint32_t end = 0;
+};
+
+TapRange InputTapRange(uint32_t tap, uint32_t input_size, uint32_t output_size,
+                       uint32_t stride, uint32_t padding) {
+  if (input_size + padding <= tap) {
+    return {};
+  }
+  const uint32_t begin =
+      tap >= padding ? 0 : (padding - tap + stride - 1) / stride;
+  const uint32_t end =
+      std::min(output_size, (input_size + padding - tap - 1) / stride + 1);
+  if (begin >= end) {
+    return {};
+  }
+  return {begin, end};
+}
+}  // namespace
+
 ConvolutionLayer::ConvolutionLayer(uint32_t output_channel, uint32_t in_channel,
                                    uint32_t kernel_h, uint32_t kernerl_w,
                                    uint32_t padding_h, uint32_t padding_w,
@@ -36,6 +103,7 @@ ConvolutionLayer::ConvolutionLayer(uint32_t output_channel, uint32_t in_channel,
   if (use_bias_) {
     this->InitBiasParam(output_channel, 1, 1, 1);
   }
+  this->InitKernels();
 }
 
 void ConvolutionLayer::InitWeightParam(const uint32_t kernel_n,
@@ -76,6 +144,7 @@ void ConvolutionLayer::set_weights(const std::vector<sftensor>& weights) {
     CHECK(this->weights_.at(i)->channels() == weights.at(i)->channels());
   }
   this->weights_ = weights;
+  this->InitKernels();
 }
 
 void ConvolutionLayer::set_weights(const std::vector<float>& weights) {
@@ -97,6 +166,7 @@ void ConvolutionLayer::set_weights(const std::vector<float>& weights) {
                                                 weights.begin() + end_offset};
     this->weights_.at(idx)->Fill(sub_values);
   }
+  this->InitKernels();
 }
 
 void ConvolutionLayer::set_bias(const std::vector<sftensor>& bias) {
@@ -134,6 +204,91 @@ void ConvolutionLayer::set_bias(const std::vector<float>& bias) {
   }
 }
 
+void ConvolutionLayer::set_activation(ActivationType activation) {
+  this->activation_ = activation;
+}
+
+ActivationType ConvolutionLayer::activation() const {
+  return this->activation_;
+}
+
+void ConvolutionLayer::set_residual(bool use_residual) {
+  this->use_residual_ = use_residual;
+}
+
+bool ConvolutionLayer::use_residual() const { return this->use_residual_; }
+
+void ConvolutionLayer::set_algorithm(ConvAlgorithm algorithm) {
+  CHECK(algorithm != ConvAlgorithm::kConvAlgorithmWinograd ||
+        winograd_supported())
+      << "The Winograd convolution needs a 3x3 stride 1 layer without groups";
+  CHECK(algorithm != ConvAlgorithm::kConvAlgorithmDepthwise ||
+        depthwise_supported())
+      << "The depthwise convolution needs one input channel per group";
+  this->algorithm_ = algorithm;
+}
+
+ConvAlgorithm ConvolutionLayer::algorithm() const { return this->algorithm_; }
+
+bool ConvolutionLayer::winograd_supported() const {
+  return !this->winograd_kernel_.empty();
+}
+
+bool ConvolutionLayer::depthwise_supported() const {
+  return groups_ > 1 && weights_.front()->channels() == 1;
+}
+
+ConvAlgorithm ConvolutionLayer::SelectAlgorithm() const {
+  if (algorithm_ != ConvAlgorithm::kConvAlgorithmAuto) {
+    return algorithm_;
+  }
+  if (depthwise_supported()) {
+    return ConvAlgorithm::kConvAlgorithmDepthwise;
+  }
+  if (winograd_supported() &&
+      weights_.front()->channels() >= kWinogradMinChannels &&
+      weights_.size() >= kWinogradMinChannels) {
+    return ConvAlgorithm::kConvAlgorithmWinograd;
+  }
+  // the shapes with a specialized packer gather the im2col blocks while
+  // packing faster than Im2Col materializes the matrix, and for 1x1 layers
+  // faster than the pointwise path reads the input in place, which runs
+  // when Im2Col is set or tuned
+  if (im2col_packer_ != nullptr && im2col_packer_ != GenericIm2ColPacker()) {
+    return ConvAlgorithm::kConvAlgorithmImplicitGemm;
+  }
+  return ConvAlgorithm::kConvAlgorithmIm2Col;
+}
+
+void ConvolutionLayer::FoldScaleShift(const std::vector<float>& scale,
+                                      const std::vector<float>& shift) {
+  const uint32_t kernel_n = this->weights_.size();
+  CHECK(scale.size() == kernel_n && shift.size() == kernel_n)
+      << "The scale and shift need one value per kernel";
+  CHECK(activation_ == ActivationType::kActivationNone && !use_residual_)
+      << "The scale and shift can not be folded behind the epilogue";
+  if (!use_bias_ || bias_.empty()) {
+    use_bias_ = true;
+    this->InitBiasParam(kernel_n, 1, 1, 1);
+  }
+
+  for (uint32_t k = 0; k < kernel_n; ++k) {
+    // copy before scaling, the tensors may be shared with the caller of
+    // set_weights
+    sftensor kernel = std::make_shared<Tensor<float>>(*weights_.at(k));
+    const float kernel_scale = scale.at(k);
+    kernel->Transform([kernel_scale](float value) {
+      return value * kernel_scale;
+    });
+    weights_.at(k) = kernel;
+
+    sftensor bias = std::make_shared<Tensor<float>>(*bias_.at(k));
+    bias->index(0) = bias->index(0) * scale.at(k) + shift.at(k);
+    bias_.at(k) = bias;
+  }
+  this->InitKernels();
+}
+
 InferStatus ConvolutionLayer::Forward(const std::vector<sftensor>& inputs,
                                       std::vector<sftensor>& outputs) {
   if (inputs.empty()) {
@@ -141,7 +296,8 @@ InferStatus ConvolutionLayer::Forward(const std::vector<sftensor>& inputs,
     return InferStatus::kInferFailedInputEmpty;
   }
 
-  if (inputs.size() != outputs.size()) {
+  const uint32_t input_operand_count = use_residual_ ? 2 : 1;
+  if (inputs.size() != outputs.size() * input_operand_count) {
     LOG(ERROR) << "The input and output tensor array size of the convolution "
                   "layer do not match";
     return InferStatus::kInferFailedInputOutSizeMatchError;
@@ -180,21 +336,12 @@ InferStatus ConvolutionLayer::Forward(const std::vector<sftensor>& inputs,
   }
 
   const uint32_t kernel_n_group = kernel_n / groups_;
-  const uint32_t batch_size = inputs.size();
+  const uint32_t batch_size = outputs.size();
 
-  if (im2col_kernel.empty()) {
-    this->InitIm2ColKernel();
-  }
-
-  if (!im2col_kernel.empty()) {
-    if (groups_ == 1) {
-      CHECK(im2col_kernel.size() == kernel_n_group)
-          << "The number of kernel matrix and kernel_count_group do not match";
-    } else {
-      CHECK(im2col_kernel.size() == kernel_n)
-          << "The number of kernel matrix and kernel_count do not match";
-    }
-  }
+  // the kernels are unrolled whenever the weights are set, Forward only reads
+  // the layer so graphs sharing it may run at the same time
+  CHECK(im2col_kernel.size() == groups_)
+      << "The number of kernel matrix and groups do not match";
 
   for (uint32_t i = 0; i < batch_size; ++i) {
     const sftensor& input = inputs[i];
@@ -231,33 +378,179 @@ InferStatus ConvolutionLayer::Forward(const std::vector<sftensor>& inputs,
     CHECK(input_c_group == kernel_c) << "The number of channel for the kernel "
                                         "matrix and input tensor do not match";
 
-    for (uint32_t g = 0; g < groups_; ++g) {
-      const auto& im2col_input =
-          Im2Col(input, kernel_h, kernel_w, input->rows(), input->cols(),
-                 input_c_group, g, im2col_w, im2col_h);
+    sftensor output = outputs[i];
+    if (output == nullptr || output->empty()) {
+      output = std::make_shared<Tensor<float>>(kernel_n, output_h, output_w);
+      outputs[i] = output;
+    }
 
-      sftensor output = outputs[i];
-      if (output == nullptr || output->empty()) {
-        output = std::make_shared<Tensor<float>>(kernel_n, output_h, output_w);
-        outputs[i] = output;
-      }
+    CHECK(output->rows() == output_h && output->cols() == output_w &&
+          output->channels() == kernel_n)
+        << "The output tensor array in the convolution layer has an "
+           "incorrectly sized tensor "
+        << i << "batch";
 
-      CHECK(output->rows() == output_h && output->cols() == output_w &&
-            output->channels() == kernel_n)
-          << "The output tensor array in the convolution layer has an "
+    if (use_residual_) {
+      const sftensor& residual = inputs[batch_size + i];
+      CHECK(residual != nullptr && residual->shapes() == output->shapes())
+          << "The residual tensor array in the convolution layer has an "
              "incorrectly sized tensor "
-          << i << "batch";
+          << i << " batch";
+    }
+  }
 
-      for (uint32_t k = 0; k < kernel_n_group; ++k) {
-        arma::frowvec kernel = im2col_kernel[k + kernel_n_group * g];
-        ConvGemm(im2col_input, output, g, k, kernel_n_group, kernel, output_w,
-                 output_h);
-      }
+  // one task per batch and group, Im2Col and the GEMM of the task are split
+  // further when there are fewer tasks than threads, the GEMM by its cache
+  // blocks
+  const uint32_t conv_tasks = batch_size * groups_;
+  const uint32_t task_slots = TaskSlots(conv_tasks);
+
+  const ConvAlgorithm algorithm = SelectAlgorithm();
+  size_t task_workspace_size = 0;
+  for (uint32_t i = 0; i < batch_size; ++i) {
+    const sftensor& input = inputs[i];
+    task_workspace_size = std::max(
+        task_workspace_size,
+        TaskWorkspaceSize(algorithm, input->channels(), input->rows(),
+                          input->cols()));
+  }
+  // the workspace lent by the graph, a layer run on its own allocates one
+  // for the whole call
+  const Workspace workspace = GetWorkspace();
+  float* workspace_ptr = workspace.data;
+  std::vector<float> local_workspace;
+  if (workspace.size < task_slots * task_workspace_size) {
+    // a lent workspace is sized by WorkspaceSize, falling short of it means
+    // the two disagree and every call allocates
+    if (workspace.lent) {
+      LOG_FIRST_N(WARNING, 1)
+          << "The workspace lent to the convolution layer " << layer_name()
+          << " holds " << workspace.size << " floats, it needs "
+          << task_slots * task_workspace_size << ", the layer allocates one";
     }
+    local_workspace.resize(task_slots * task_workspace_size);
+    workspace_ptr = local_workspace.data();
   }
+
+  const bool use_winograd = algorithm == ConvAlgorithm::kConvAlgorithmWinograd;
+  const bool use_depthwise =
+      algorithm == ConvAlgorithm::kConvAlgorithmDepthwise;
+  const bool use_implicit_gemm =
+      algorithm == ConvAlgorithm::kConvAlgorithmImplicitGemm;
+  const bool pointwise =
+      kernel_h == 1 && kernel_w == 1 && padding_h_ == 0 && padding_w_ == 0;
+  auto conv_task = [&](uint32_t index, float* task_workspace) {
+    const uint32_t i = index / groups_;
+    const uint32_t g = index % groups_;
+    const sftensor& input = inputs[i];
+    const sftensor& output = outputs[i];
+    const sftensor& residual =
+        use_residual_ ? inputs[batch_size + i] : inputs[i];
+    const uint32_t output_h = output->rows();
+    const uint32_t output_w = output->cols();
+    if (use_winograd) {
+      WinogradConv3x3(input, winograd_kernel_, padding_h_, padding_w_, output,
+                      task_workspace, [&](uint32_t k) {
+                        ConvEpilogue(output->matrix_raw_ptr(k), k,
+                                     use_residual_
+                                         ? residual->matrix_raw_ptr(k)
+                                         : nullptr,
+                                     output_h * output_w);
+                      });
+      return;
+    }
+    if (use_depthwise) {
+      DepthwiseConv(input, output, g, kernel_n_group,
+                    use_residual_ ? residual : nullptr);
+      return;
+    }
+    if (use_implicit_gemm) {
+      ImplicitConvGemm(input, output, g, kernel_n_group,
+                       use_residual_ ? residual : nullptr);
+      return;
+    }
+
+    const uint32_t input_c_group = input->channels() / groups_;
+    const arma::fmat& im2col_input =
+        pointwise ? PointwiseInput(input, input_c_group, g, output_h, output_w,
+                                   task_workspace)
+                  : Im2Col(input, kernel_h, kernel_w, input->rows(),
+                           input->cols(), input_c_group, g, im2col_w,
+                           output_h * output_w, task_workspace);
+
+    ConvGemm(im2col_input, output, g, kernel_n_group,
+             use_residual_ ? residual : nullptr, output_w, output_h);
+  };
+
+  // the tasks are cut into one contiguous range per slot, the tasks of a
+  // range run one after another on the part of the workspace of the slot
+  ParallelFor(0, task_slots, [&](uint32_t slot) {
+    float* task_workspace = workspace_ptr + slot * task_workspace_size;
+    const uint32_t task_begin = uint64_t(conv_tasks) * slot / task_slots;
+    const uint32_t task_end = uint64_t(conv_tasks) * (slot + 1) / task_slots;
+    for (uint32_t index = task_begin; index < task_end; ++index) {
+      conv_task(index, task_workspace);
+    }
+  });
   return InferStatus::kInferSuccess;
 }
 
+InferStatus ConvolutionLayer::InferOutputShape(
+    const std::vector<std::vector<int>>& input_shapes,
+    std::vector<int>& output_shape) const {
+  const uint32_t input_operand_count = use_residual_ ? 2 : 1;
+  if (input_shapes.size() != input_operand_count ||
+      input_shapes.front().size() != 4) {
+    LOG(ERROR) << "The convolution layer needs " << input_operand_count
+               << " inputs of 4 dims";
+    return InferStatus::kInferFailedInputOutSizeMatchError;
+  }
+  if (weights_.empty()) {
+    LOG(ERROR) << "The number of kernel matrix in the convolution layer should "
+                  "be greater than zero";
+    return InferStatus::kInferFailedWeightParameterError;
+  }
+
+  const std::vector<int>& input_shape = input_shapes.front();
+  const int kernel_c = int(weights_.front()->channels());
+  const int kernel_h = int(weights_.front()->rows());
+  const int kernel_w = int(weights_.front()->cols());
+  if (input_shape.at(1) != kernel_c * int(groups_)) {
+    LOG(ERROR) << "The input channel " << input_shape.at(1)
+               << " of the convolution layer does not match the kernel";
+    return InferStatus::kInferFailedChannelParameterError;
+  }
+
+  const int output_h =
+      (input_shape.at(2) + 2 * int(padding_h_) - kernel_h) / int(stride_h_) + 1;
+  const int output_w =
+      (input_shape.at(3) + 2 * int(padding_w_) - kernel_w) / int(stride_w_) + 1;
+  if (output_h <= 0 || output_w <= 0) {
+    LOG(ERROR) << "The input of the convolution layer is smaller than the "
+                  "kernel";
+    return InferStatus::kInferFailedOutputSizeError;
+  }
+  output_shape = {input_shape.at(0), int(weights_.size()), output_h, output_w};
+  if (use_residual_ && input_shapes.back() != output_shape) {
+    LOG(ERROR) << "The residual input of the convolution layer does not "
+                  "match its output";
+    return InferStatus::kInferFailedOutputSizeError;
+  }
+  return InferStatus::kInferSuccess;
+}
+
+size_t ConvolutionLayer::WorkspaceSize(
+    const std::vector<std::vector<int>>& input_shapes) const {
+  if (input_shapes.empty() || input_shapes.front().size() != 4) {
+    return 0;
+  }
+  const std::vector<int>& input_shape = input_shapes.front();
+  const uint32_t conv_tasks = uint32_t(input_shape.at(0)) * groups_;
+  return TaskSlots(conv_tasks) *
+         TaskWorkspaceSize(SelectAlgorithm(), input_shape.at(1),
+                           input_shape.at(2), input_shape.at(3));
+}
+
 ParseParameterAttrStatus ConvolutionLayer::GetInstace(
     const std::shared_ptr<RuntimeOperator>& op,
     std::shared_ptr<Layer>& conv_layer) {
@@ -434,14 +727,60 @@ ParseParameterAttrStatus ConvolutionLayer::GetInstace(
 
   const std::vector<float>& weight_values = weight->get<float>();
   conv_layer_derived->set_weights(weight_values);
-
-  // auto conv_layer_derived =
-  //     std::dynamic_pointer_cast<ConvolutionLayer>(conv_layer);
-  CHECK(conv_layer_derived != nullptr);
-  conv_layer_derived->InitIm2ColKernel();
   return ParseParameterAttrStatus::kParameterAttrParseSuccess;
 }
 
+void ConvolutionLayer::InitKernels() {
+  this->InitIm2ColKernel();
+  this->InitWinogradKernel();
+  this->im2col_packer_ =
+      SelectIm2ColPacker(this->weights_.front()->rows(),
+                         this->weights_.front()->cols(), stride_h_, stride_w_);
+}
+
+void ConvolutionLayer::InitWinogradKernel() {
+  this->winograd_kernel_.clear();
+  const sftensor& kernel = this->weights_.front();
+  if (kernel->rows() != 3 || kernel->cols() != 3 || stride_h_ != 1 ||
+      stride_w_ != 1 || groups_ != 1) {
+    return;
+  }
+  this->winograd_kernel_ = WinogradTransformKernel(this->weights_);
+}
+
+size_t ConvolutionLayer::TaskWorkspaceSize(ConvAlgorithm algorithm,
+                                           uint32_t input_c, uint32_t input_h,
+                                           uint32_t input_w) const {
+  const uint32_t kernel_h = this->weights_.front()->rows();
+  const uint32_t kernel_w = this->weights_.front()->cols();
+  const uint32_t output_h =
+      (input_h + 2 * padding_h_ - kernel_h) / stride_h_ + 1;
+  const uint32_t output_w =
+      (input_w + 2 * padding_w_ - kernel_w) / stride_w_ + 1;
+  const size_t output_size = size_t(output_h) * output_w;
+  const uint32_t input_c_group = input_c / groups_;
+  switch (algorithm) {
+    case ConvAlgorithm::kConvAlgorithmWinograd:
+      return WinogradWorkspaceSize(input_c, weights_.size(), output_h,
+                                   output_w);
+    case ConvAlgorithm::kConvAlgorithmDepthwise:
+    case ConvAlgorithm::kConvAlgorithmImplicitGemm:
+      return 0;
+    default:
+      break;
+  }
+  if (kernel_h == 1 && kernel_w == 1 && padding_h_ == 0 && padding_w_ == 0) {
+    // the input itself is the GEMM operand without a stride
+    return stride_h_ == 1 && stride_w_ == 1 ? 0 : output_size * input_c_group;
+  }
+  return output_size * input_c_group * kernel_h * kernel_w;
+}
+
+uint32_t ConvolutionLayer::TaskSlots(uint32_t conv_tasks) const {
+  const uint32_t num_threads = GetParallelThreads();
+  return conv_tasks >= num_threads ? num_threads : 1;
+}
+
 void ConvolutionLayer::InitIm2ColKernel() {
   const uint32_t kernel_n = this->weights_.size();
   const uint32_t kernel_c = this->weights_[0]->channels();
@@ -458,22 +797,23 @@ void ConvolutionLayer::InitIm2ColKernel() {
   }
 
   const uint32_t kernel_n_group = kernel_n / groups_;
-  std::vector<arma::frowvec> im2col_kernel;
+  std::vector<PackedMatrix> im2col_kernel(groups_);
   for (uint32_t g = 0; g < groups_; ++g) {
-    // (img2col_w * kernel_c, 1) == (1, kernel_w * kernel_h * kernel_c, 1)
-    arma::frowvec im2col_kernel_c(im2col_w * kernel_c);
+    // (kernel_c * kernel_h * kernel_w, kernel_n_group), one column per kernel
+    arma::fmat im2col_kernel_g(im2col_w * kernel_c, kernel_n_group);
     for (uint32_t n = 0; n < kernel_n_group; ++n) {
       // (kernel_c, kernel_w, kernel_h)
       const sftensor& kernel = this->weights_[n + g * kernel_n_group];
       for (uint32_t c = 0; c < kernel->channels(); ++c) {
         // copy kernel weights to im2col_kernel
-        std::memcpy(im2col_kernel_c.memptr() + im2col_w * c,
+        std::memcpy(im2col_kernel_g.colptr(n) + im2col_w * c,
                     kernel->matrix_raw_ptr(c), im2col_w * sizeof(float));
       }
-      im2col_kernel.emplace_back(im2col_kernel_c);
     }
+    im2col_kernel.at(g).Pack(im2col_kernel_g.memptr(), im2col_w * kernel_c,
+                             kernel_n_group, 1, im2col_w * kernel_c);
   }
-  CHECK(im2col_kernel.size() == kernel_n);
+  CHECK(im2col_kernel.size() == groups_);
   this->im2col_kernel = std::move(im2col_kernel);
 }
 
@@ -481,67 +821,235 @@ arma::fmat ConvolutionLayer::Im2Col(sftensor input, uint32_t kernel_h,
                                     uint32_t kernel_w, uint32_t input_h,
                                     uint32_t input_w, uint32_t input_c_group,
                                     uint32_t group_i, uint32_t im2col_w,
-                                    uint32_t im2col_h) {
-  // (input_c_group * im2col_w, im2col_h)
-  arma::fmat im2col_input(input_c_group * im2col_w, im2col_h);
-  const uint32_t input_padded_h = input_h + 2 * padding_h_;
-  const uint32_t input_padded_w = input_w + 2 * padding_w_;
-  for (uint32_t ic = 0; ic < input_c_group; ++ic) {
+                                    uint32_t im2col_h, float* workspace) {
+  // (im2col_h, input_c_group * im2col_w)
+  arma::fmat im2col_input(workspace, im2col_h, input_c_group * im2col_w,
+                          false, true);
+  const uint32_t output_h =
+      (input_h + 2 * padding_h_ - kernel_h) / stride_h_ + 1;
+  const uint32_t output_w =
+      (input_w + 2 * padding_w_ - kernel_w) / stride_w_ + 1;
+  CHECK(output_h * output_w == im2col_h);
+
+  ParallelFor(0, input_c_group, [&](uint32_t ic) {
     // input channel fmat
-    float* input_channel_ptr =
+    const float* input_channel_ptr =
         input->matrix_raw_ptr(ic + group_i * input_c_group);
-    uint32_t current_col = 0;
-    uint32_t channel_i = ic * im2col_w;
-    for (uint32_t w = 0; w < input_padded_w - kernel_w + 1; w += stride_w_) {
-      for (uint32_t h = 0; h < input_padded_h - kernel_h + 1; h += stride_h_) {
-        float* im2col_input_ptr = im2col_input.colptr(current_col) + channel_i;
-        current_col += 1;
-        for (uint32_t kw = 0; kw < kernel_w; ++kw) {
-          const uint32_t region_w = input_h * (w + kw - padding_w_);
-          for (uint32_t kh = 0; kh < kernel_w; ++kh) {
-            if ((kh + h >= padding_h_ && kw + w >= padding_w_) &&
-                (kh + h < input_h + padding_h_ &&
-                 kw + w < input_w + padding_w_)) {
-              float* region_ptr =
-                  input_channel_ptr + region_w + (h + kh - padding_h_);
-              *im2col_input_ptr = *region_ptr;
-            } else {
-              *im2col_input_ptr = padding_value;
-            }
-            im2col_input_ptr++;
-          }
+    for (uint32_t kw = 0; kw < kernel_w; ++kw) {
+      const TapRange cols =
+          InputTapRange(kw, input_w, output_w, stride_w_, padding_w_);
+      for (uint32_t kh = 0; kh < kernel_h; ++kh) {
+        const TapRange rows =
+            InputTapRange(kh, input_h, output_h, stride_h_, padding_h_);
+        // the column of the kernel element, in the order of the kernel
+        // matrix
+        float* im2col_input_ptr =
+            im2col_input.colptr(ic * im2col_w + kw * kernel_h + kh);
+        if (cols.begin == cols.end || rows.begin == rows.end) {
+          std::fill(im2col_input_ptr, im2col_input_ptr + im2col_h,
+                    padding_value);
+          continue;
+        }
+
+        // only the border reads the padding, the interior of every output
+        // col is one copy of an input col
+        std::fill(im2col_input_ptr, im2col_input_ptr + cols.begin * output_h,
+                  padding_value);
+        const uint32_t input_row = rows.begin * stride_h_ + kh - padding_h_;
+        for (uint32_t w = cols.begin; w < cols.end; ++w) {
+          float* output_col_ptr = im2col_input_ptr + w * output_h;
+          const float* input_col_ptr =
+              input_channel_ptr + (w * stride_w_ + kw - padding_w_) * input_h +
+              input_row;
+          std::fill(output_col_ptr, output_col_ptr + rows.begin,
+                    padding_value);
+          GatherRows(output_col_ptr + rows.begin, input_col_ptr,
+                     rows.end - rows.begin, stride_h_);
+          std::fill(output_col_ptr + rows.end, output_col_ptr + output_h,
+                    padding_value);
         }
+        std::fill(im2col_input_ptr + cols.end * output_h,
+                  im2col_input_ptr + im2col_h, padding_value);
       }
     }
+  });
+  return im2col_input;
+}
+
+arma::fmat ConvolutionLayer::PointwiseInput(sftensor input,
+                                            uint32_t input_c_group,
+                                            uint32_t group_i, uint32_t output_h,
+                                            uint32_t output_w,
+                                            float* workspace) {
+  const uint32_t input_h = input->rows();
+  if (stride_h_ == 1 && stride_w_ == 1) {
+    CHECK(input_h == output_h && input->cols() == output_w);
+    // (output_h * output_w, input_c_group), the channels are contiguous
+    return arma::fmat(input->matrix_raw_ptr(group_i * input_c_group),
+                      output_h * output_w, input_c_group, false, true);
   }
+
+  arma::fmat im2col_input(workspace, output_h * output_w, input_c_group, false,
+                          true);
+  ParallelFor(0, input_c_group, [&](uint32_t ic) {
+    const float* input_channel_ptr =
+        input->matrix_raw_ptr(ic + group_i * input_c_group);
+    float* im2col_input_ptr = im2col_input.colptr(ic);
+    for (uint32_t w = 0; w < output_w; ++w) {
+      const float* input_col_ptr = input_channel_ptr + w * stride_w_ * input_h;
+      for (uint32_t h = 0; h < output_h; ++h) {
+        *im2col_input_ptr++ = input_col_ptr[h * stride_h_];
+      }
+    }
+  });
   return im2col_input;
 }
 
 void ConvolutionLayer::ConvGemm(const arma::fmat& im2col_input, sftensor output,
-                                uint32_t group, uint32_t kernel_i,
-                                uint32_t kernel_n_group,
-                                const arma::frowvec& kernel, uint32_t output_w,
+                                uint32_t group, uint32_t kernel_n_group,
+                                const sftensor& residual, uint32_t output_w,
                                 uint32_t output_h) {
-  arma::fmat output_result(
-      output->matrix_raw_ptr(kernel_i + group * kernel_n_group), output_h,
-      output_w, false, true);
-
-  CHECK(output_result.size() == output_h * output_w)
+  const uint32_t channel_begin = group * kernel_n_group;
+  const uint32_t output_size = output_h * output_w;
+  const PackedMatrix& im2col_kernel_g = this->im2col_kernel.at(group);
+  CHECK(im2col_input.n_rows == output_size &&
+        im2col_input.n_cols == im2col_kernel_g.rows())
       << "Output_h x output_w for the convolution layer "
          "should be output tensor size";
 
+  // the output channels of the group are contiguous in the output tensor,
+  // an (output_size, kernel_n_group) column major matrix
+  Gemm(im2col_input.memptr(), im2col_input.n_rows, im2col_kernel_g,
+       output_size, output->matrix_raw_ptr(channel_begin), output_size,
+       ConvGemmEpilogue(channel_begin, residual));
+}
+
+void ConvolutionLayer::ImplicitConvGemm(const sftensor& input,
+                                        const sftensor& output, uint32_t group,
+                                        uint32_t kernel_n_group,
+                                        const sftensor& residual) {
+  const uint32_t input_h = input->rows();
+  const uint32_t input_w = input->cols();
+  const uint32_t output_h = output->rows();
+  const uint32_t output_size = output_h * output->cols();
+  const uint32_t kernel_h = this->weights_.front()->rows();
+  const uint32_t kernel_w = this->weights_.front()->cols();
+  const uint32_t input_c_group = input->channels() / groups_;
+  const uint32_t channel_begin = group * kernel_n_group;
+  const PackedMatrix& im2col_kernel_g = this->im2col_kernel.at(group);
+  CHECK(im2col_kernel_g.rows() == input_c_group * kernel_h * kernel_w)
+      << "The input channels of the convolution layer do not match its "
+         "kernels";
+
+  ConvGeometry geometry;
+  geometry.input_h = input_h;
+  geometry.input_w = input_w;
+  geometry.output_h = output_h;
+  geometry.kernel_h = kernel_h;
+  geometry.kernel_w = kernel_w;
+  geometry.stride_h = stride_h_;
+  geometry.stride_w = stride_w_;
+  geometry.padding_h = padding_h_;
+  geometry.padding_w = padding_w_;
+  geometry.padding_value = padding_value;
+
+  CHECK(this->im2col_packer_ != nullptr);
+  const Im2ColPacker im2col_packer = this->im2col_packer_;
+  const float* input_group_ptr = input->matrix_raw_ptr(group * input_c_group);
+  auto pack_a = [&](uint32_t row_begin, uint32_t rows, uint32_t col_begin,
+                    uint32_t cols, float* a_packed) {
+    im2col_packer(geometry, input_group_ptr, row_begin, rows, col_begin, cols,
+                  a_packed);
+  };
+  GemmImplicit(pack_a, im2col_kernel_g, output_size,
+               output->matrix_raw_ptr(channel_begin), output_size,
+               ConvGemmEpilogue(channel_begin, residual));
+}
+
+void ConvolutionLayer::DepthwiseConv(const sftensor& input,
+                                     const sftensor& output, uint32_t group,
+                                     uint32_t kernel_n_group,
+                                     const sftensor& residual) {
+  const uint32_t input_h = input->rows();
+  const uint32_t input_w = input->cols();
+  const uint32_t output_h = output->rows();
+  const uint32_t output_w = output->cols();
+  const float* input_channel_ptr = input->matrix_raw_ptr(group);
+  for (uint32_t n = 0; n < kernel_n_group; ++n) {
+    const uint32_t channel = n + group * kernel_n_group;
+    const sftensor& kernel = this->weights_.at(channel);
+    const uint32_t kernel_h = kernel->rows();
+    const uint32_t kernel_w = kernel->cols();
+    float* output_channel_ptr = output->matrix_raw_ptr(channel);
+    std::fill(output_channel_ptr, output_channel_ptr + output_h * output_w,
+              0.f);
+
+    for (uint32_t kh = 0; kh < kernel_h; ++kh) {
+      // the output rows whose input row of the tap is inside the input
+      const TapRange rows =
+          InputTapRange(kh, input_h, output_h, stride_h_, padding_h_);
+      if (rows.begin == rows.end) {
+        continue;
+      }
+      const uint32_t input_row = rows.begin * stride_h_ + kh - padding_h_;
+
+      for (uint32_t kw = 0; kw < kernel_w; ++kw) {
+        const float weight = kernel->at(0, kh, kw);
+        const TapRange cols =
+            InputTapRange(kw, input_w, output_w, stride_w_, padding_w_);
+        for (uint32_t w = cols.begin; w < cols.end; ++w) {
+          AccumulateTap(output_channel_ptr + w * output_h + rows.begin,
+                        input_channel_ptr +
+                            (w * stride_w_ + kw - padding_w_) * input_h +
+                            input_row,
+                        weight, rows.end - rows.begin, stride_h_);
+        }
+      }
+    }
+    ConvEpilogue(output_channel_ptr, channel,
+                 residual != nullptr ? residual->matrix_raw_ptr(channel)
+                                     : nullptr,
+                 output_h * output_w);
+  }
+}
+
+void ConvolutionLayer::ConvEpilogue(float* output_ptr, uint32_t channel,
+                                    const float* residual_ptr,
+                                    uint32_t size) {
+  float bias_value = 0.f;
   if (!this->bias_.empty() && this->use_bias_) {
-    sftensor bias;
-    bias = this->bias_[kernel_i];
+    const sftensor& bias = this->bias_.at(channel);
     if (bias != nullptr && !bias->empty()) {
-      float bias_value = bias->index(0);
-      output_result = kernel * im2col_input + bias_value;
+      bias_value = bias->index(0);
     } else {
       LOG(FATAL) << "Bias tensor is empty or nullptr";
     }
-  } else {
-    output_result = kernel * im2col_input;
   }
+  if (residual_ptr != nullptr) {
+    for (uint32_t j = 0; j < size; ++j) {
+      output_ptr[j] += bias_value + residual_ptr[j];
+    }
+  } else if (bias_value != 0.f) {
+    for (uint32_t j = 0; j < size; ++j) {
+      output_ptr[j] += bias_value;
+    }
+  }
+  ApplyActivation(activation_, output_ptr, size);
+}
+
+GemmEpilogue ConvolutionLayer::ConvGemmEpilogue(uint32_t channel_begin,
+                                                const sftensor& residual) {
+  return [this, channel_begin, &residual](uint32_t row_begin, uint32_t rows,
+                                          uint32_t col_begin, uint32_t cols,
+                                          float* c, uint32_t ldc) {
+    for (uint32_t j = 0; j < cols; ++j) {
+      const uint32_t channel = channel_begin + col_begin + j;
+      const float* residual_ptr =
+          residual != nullptr ? residual->matrix_raw_ptr(channel) + row_begin
+                              : nullptr;
+      ConvEpilogue(c + size_t(j) * ldc, channel, residual_ptr, rows);
+    }
+  };
 }
 
 LayerReigister kConvGetInstace("nn.Conv2d", ConvolutionLayer::GetInstace);
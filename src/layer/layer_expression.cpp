@@ -10,7 +10,9 @@
 #include "layer/layer.hpp"
 #include "layer/layer_factory.hpp"
 #include "layer/parse_expression.hpp"
+#include "layer/simd_kernels.hpp"
 #include "runtime/runtime_ir.hpp"
+#include "runtime/thread_pool.hpp"
 #include "tensor/tensor.hpp"
 #include "tensor/tensor_util.hpp"
 
@@ -18,6 +20,10 @@ namespace free_infer {
 ExpressionLayer::ExpressionLayer(std::string statement)
     : Layer("Expression"), statement_(std::move(statement)) {
   parser_ = std::make_unique<ExpressionParser>(statement_);
+  // the statement never changes, so parse it once instead of every Forward
+  token_nodes_ = parser_->Generate();
+  CHECK(!token_nodes_.empty())
+      << "The expression parser failed to parse " << statement_;
 }
 
 InferStatus ExpressionLayer::Forward(const std::vector<sftensor>& inputs,
@@ -32,13 +38,6 @@ InferStatus ExpressionLayer::Forward(const std::vector<sftensor>& inputs,
     return InferStatus::kInferFailedOutputEmpty;
   }
 
-  CHECK(this->parser_ != nullptr)
-      << "The parser in the expression layer is null!";
-  this->parser_->Tokenizer();
-  const auto& expressions = this->parser_->tokens();
-  CHECK(!expressions.empty())
-      << "The expression parser failed to parse " << statement_;
-
   for (uint32_t i = 0; i < inputs.size(); ++i) {
     const sftensor& input_data = inputs.at(i);
     if (input_data == nullptr || input_data->empty()) {
@@ -57,12 +56,9 @@ InferStatus ExpressionLayer::Forward(const std::vector<sftensor>& inputs,
                   << i << "th";
       return InferStatus::kInferFailedOutputEmpty;
     }
-    outputs.at(i)->Fill(0.f);
   }
   std::stack<std::vector<sftensor>> op_stack;
-  const std::vector<std::shared_ptr<TokenNode>>& token_nodes =
-      this->parser_->Generate();
-  for (const auto& token_node : token_nodes) {
+  for (const auto& token_node : token_nodes_) {
     if (token_node->num_index >= 0) {
       uint32_t start_pos = token_node->num_index * batch_size;
       std::vector<sftensor> input_token_nodes;
@@ -86,9 +82,9 @@ InferStatus ExpressionLayer::Forward(const std::vector<sftensor>& inputs,
 
       std::vector<sftensor> output_token_nodes(batch_size);
 
-      for (uint32_t i = 0; i < batch_size; ++i) {
+      ParallelFor(0, batch_size, [&](uint32_t i) {
         output_token_nodes.at(i) = TensorElementSin(input_node.at(i));
-      }
+      });
       op_stack.push(output_token_nodes);
 
     } else {
@@ -115,8 +111,20 @@ InferStatus ExpressionLayer::Forward(const std::vector<sftensor>& inputs,
       op_stack.pop();
 
       std::vector<sftensor> output_token_nodes(batch_size);
-      for (uint32_t i = 0; i < batch_size; ++i) {
-        if (op_type == int(TokenType::TokenAdd)) {
+      const SimdKernels& kernels = GetSimdKernels();
+      ParallelFor(0, batch_size, [&](uint32_t i) {
+        const sftensor& input1 = input_node1.at(i);
+        const sftensor& input2 = input_node2.at(i);
+        if (input1->shapes() == input2->shapes()) {
+          // the common case without a broadcast
+          sftensor output = std::make_shared<Tensor<float>>(input1->shapes());
+          const auto kernel = op_type == int(TokenType::TokenAdd)
+                                  ? kernels.add
+                                  : kernels.multiply;
+          kernel(input1->raw_ptr(), input2->raw_ptr(), output->raw_ptr(),
+                 input1->size());
+          output_token_nodes.at(i) = output;
+        } else if (op_type == int(TokenType::TokenAdd)) {
           output_token_nodes.at(i) =
               TensorElementAdd(input_node1.at(i), input_node2.at(i));
         } else if (op_type == int(TokenType::TokenMul)) {
@@ -125,7 +133,7 @@ InferStatus ExpressionLayer::Forward(const std::vector<sftensor>& inputs,
         } else {
           LOG(FATAL) << "Unknown operator type: " << op_type;
         }
-      }
+      });
       op_stack.push(output_token_nodes);
     }
   }
@@ -138,7 +146,9 @@ InferStatus ExpressionLayer::Forward(const std::vector<sftensor>& inputs,
   for (int i = 0; i < batch_size; ++i) {
     CHECK(outputs.at(i) != nullptr && !outputs.at(i)->empty());
     CHECK(outputs.at(i)->shapes() == output_node.at(i)->shapes());
-    outputs.at(i) = output_node.at(i);
+    // copy into the output tensor instead of replacing it, the consumers are
+    // bound to it by the execution plan
+    outputs.at(i)->data() = output_node.at(i)->data();
   }
   return InferStatus::kInferSuccess;
 }
@@ -2,13 +2,16 @@
 
 #include <sys/types.h>
 
+#include <algorithm>
 #include <cstdint>
 #include <memory>
 #include <vector>
 
+#include "layer/gemm.hpp"
 #include "layer/layer.hpp"
 #include "layer/layer_factory.hpp"
 #include "runtime/status_code.hpp"
+#include "runtime/workspace.hpp"
 #include "tensor/tensor.hpp"
 namespace free_infer {
 LinearLayer::LinearLayer(uint32_t in_features, uint32_t out_features,
@@ -19,6 +22,7 @@ LinearLayer::LinearLayer(uint32_t in_features, uint32_t out_features,
       use_bias_(use_bias) {
   this->InitWeightParam(in_features, out_features);
   this->InitBiasParam(out_features);
+  this->InitPackedWeight();
 }
 
 const std::vector<sftensor>& LinearLayer::weights() const {
@@ -36,6 +40,7 @@ void LinearLayer::set_weights(const std::vector<sftensor>& weights) {
     CHECK(this->weights_.at(i)->channels() == weights.at(i)->channels());
   }
   this->weights_ = weights;
+  this->InitPackedWeight();
 }
 
 void LinearLayer::set_weights(const std::vector<float>& weights) {
@@ -57,6 +62,7 @@ void LinearLayer::set_weights(const std::vector<float>& weights) {
                                                 weights.begin() + end_offset};
     this->weights_.at(idx)->Fill(sub_values);
   }
+  this->InitPackedWeight();
 }
 
 void LinearLayer::set_bias(const std::vector<sftensor>& bias) {
@@ -119,43 +125,153 @@ InferStatus LinearLayer::Forward(const std::vector<sftensor>& inputs,
   }
 
   const uint32_t batch_size = inputs.size();
-  const sftensor& weight_data = weights_.front();
-  const arma::fmat weight(weight_data->raw_ptr(), out_features_, in_features_,
-                          false, true);
-  const arma::fmat& weight_t = weight.t();
-
+  const uint32_t input_h =
+      inputs.front() != nullptr ? inputs.front()->rows() : 0;
   for (uint32_t i = 0; i < batch_size; ++i) {
     const sftensor& input = inputs.at(i);
-    sftensor output = outputs.at(i);
-
     CHECK(input != nullptr && !input->empty())
         << "The input tensor array in the linear layer has an empty  "
            "tensor "
         << i << " batch";
+    CHECK(input->channels() == 1 && input->rows() == input_h &&
+          input->cols() == in_features_)
+        << "The input tensor array in the linear layer has an incorrectly "
+           "sized tensor "
+        << i << " batch";
 
-    const uint32_t input_c = input->channels();
-    const uint32_t input_h = input->rows();
-    const uint32_t input_w = input->cols();
-
-    if (output == nullptr && output->empty()) {
+    sftensor& output = outputs.at(i);
+    if (output == nullptr || output->empty()) {
       output = std::make_shared<Tensor<float>>(1, input_h, out_features_);
-      outputs[i] = output;
     }
+    CHECK(output->rows() == input_h && output->cols() == out_features_)
+        << "The output tensor array in the linear layer has an incorrectly "
+           "sized tensor "
+        << i << " batch";
+  }
 
-    CHECK(input_c == 1 && input_w == in_features_);
-
-    arma::fmat input_vec((float*)input->raw_ptr(), input_h, in_features_, false,
-                         true);
-    arma::fmat& result = output->slice(0);
-    result = input_vec * weight_t;
-    if (use_bias_) {
-      const auto& bias_data = bias_.front()->data();
-      const auto& bias = bias_data.slice(0);
-      for (uint32_t r = 0; r < result.n_rows; ++r) {
-        result.row(r) += bias;
+  const float* bias_ptr = use_bias_ ? bias_.front()->raw_ptr() : nullptr;
+  if (batch_size == 1) {
+    // (input_h, in_features) * (in_features, out_features), both column
+    // major, the bias of every output feature is added to each block of the
+    // output as soon as it is final
+    GemmEpilogue epilogue;
+    if (bias_ptr != nullptr) {
+      epilogue = [bias_ptr](uint32_t row_begin, uint32_t rows,
+                            uint32_t col_begin, uint32_t cols, float* c,
+                            uint32_t ldc) {
+        for (uint32_t j = 0; j < cols; ++j) {
+          float* output_col = c + size_t(j) * ldc;
+          const float bias = bias_ptr[col_begin + j];
+          for (uint32_t r = 0; r < rows; ++r) {
+            output_col[r] += bias;
+          }
+        }
+      };
+    }
+    Gemm(inputs.front()->raw_ptr(), input_h, packed_weight_, input_h,
+         outputs.front()->raw_ptr(), input_h, epilogue);
+    return InferStatus::kInferSuccess;
+  }
+
+  // the batch is one (batch_size * input_h, in_features) operand, so the
+  // packed weight is streamed once for the whole batch instead of once per
+  // sample. Its row g is row g % input_h of sample g / input_h, the blocks
+  // are gathered from the inputs while packing and never stacked in memory
+  const uint32_t m = batch_size * input_h;
+  // the closures capture little enough to be held in place by GemmPackA and
+  // GemmEpilogue, the forward allocates nothing with a lent workspace
+  auto pack_a = [&inputs, input_h](uint32_t row_begin, uint32_t rows,
+                                   uint32_t col_begin, uint32_t cols,
+                                   float* a_packed) {
+    const float* row_ptrs[kGemmMR];
+    for (uint32_t i = 0; i < rows; i += kGemmMR) {
+      const uint32_t panel_rows = std::min(kGemmMR, rows - i);
+      for (uint32_t r = 0; r < panel_rows; ++r) {
+        const uint32_t row = row_begin + i + r;
+        row_ptrs[r] = inputs[row / input_h]->raw_ptr() + row % input_h +
+                      size_t(col_begin) * input_h;
+      }
+      for (uint32_t q = 0; q < cols; ++q) {
+        const size_t offset = size_t(q) * input_h;
+        uint32_t r = 0;
+        for (; r < panel_rows; ++r) {
+          a_packed[r] = row_ptrs[r][offset];
+        }
+        for (; r < kGemmMR; ++r) {
+          a_packed[r] = 0.f;
+        }
+        a_packed += kGemmMR;
       }
     }
+  };
+
+  // the stacked output is scratch, each final block is written to the
+  // outputs of its samples with the bias added on the way
+  auto scatter = [&outputs, bias_ptr](uint32_t row_begin, uint32_t rows,
+                                      uint32_t col_begin, uint32_t cols,
+                                      float* c, uint32_t ldc) {
+    const uint32_t input_h = outputs.front()->rows();
+    for (uint32_t r = 0; r < rows;) {
+      const uint32_t row = row_begin + r;
+      const uint32_t sample_row = row % input_h;
+      const uint32_t run = std::min(rows - r, input_h - sample_row);
+      float* output_ptr = outputs[row / input_h]->raw_ptr() + sample_row;
+      for (uint32_t j = 0; j < cols; ++j) {
+        const float bias = bias_ptr != nullptr ? bias_ptr[col_begin + j] : 0.f;
+        const float* c_col = c + size_t(j) * ldc + r;
+        float* output_col = output_ptr + size_t(col_begin + j) * input_h;
+        for (uint32_t k = 0; k < run; ++k) {
+          output_col[k] = c_col[k] + bias;
+        }
+      }
+      r += run;
+    }
+  };
+
+  // the workspace lent by the graph, a layer run on its own allocates one
+  // for the whole call
+  const Workspace workspace = GetWorkspace();
+  float* stacked_output = workspace.data;
+  std::vector<float> local_workspace;
+  if (workspace.size < size_t(m) * out_features_) {
+    local_workspace.resize(size_t(m) * out_features_);
+    stacked_output = local_workspace.data();
   }
+  GemmImplicit(pack_a, packed_weight_, m, stacked_output, m, scatter);
+  return InferStatus::kInferSuccess;
+}
+
+size_t LinearLayer::WorkspaceSize(
+    const std::vector<std::vector<int>>& input_shapes) const {
+  // only a batch of several samples is stacked
+  if (input_shapes.empty() || input_shapes.front().size() < 2 ||
+      input_shapes.front().front() <= 1) {
+    return 0;
+  }
+  size_t rows = 1;
+  const std::vector<int>& input_shape = input_shapes.front();
+  for (uint32_t i = 0; i + 1 < input_shape.size(); ++i) {
+    rows *= size_t(input_shape.at(i));
+  }
+  return rows * out_features_;
+}
+
+InferStatus LinearLayer::InferOutputShape(
+    const std::vector<std::vector<int>>& input_shapes,
+    std::vector<int>& output_shape) const {
+  if (input_shapes.size() != 1 || input_shapes.front().size() < 2) {
+    LOG(ERROR) << "The linear layer needs one input of at least 2 dims";
+    return InferStatus::kInferFailedInputOutSizeMatchError;
+  }
+
+  const std::vector<int>& input_shape = input_shapes.front();
+  if (input_shape.back() != int(in_features_)) {
+    LOG(ERROR) << "The input features " << input_shape.back()
+               << " of the linear layer do not match " << in_features_;
+    return InferStatus::kInferFailedShapeParameterError;
+  }
+  output_shape = input_shape;
+  output_shape.back() = int(out_features_);
   return InferStatus::kInferSuccess;
 }
 
@@ -249,6 +365,16 @@ void LinearLayer::InitWeightParam(const uint32_t in_features,
       std::make_shared<Tensor<float>>(1, out_features, in_features);
 }
 
+void LinearLayer::InitPackedWeight() {
+  // the weight is (out_features, in_features), packed transposed so the
+  // GEMM reads it as (in_features, out_features)
+  const sftensor& weight = this->weights_.front();
+  CHECK(weight != nullptr && weight->rows() == out_features_ &&
+        weight->cols() == in_features_);
+  this->packed_weight_.Pack(weight->raw_ptr(), in_features_, out_features_,
+                            out_features_, 1);
+}
+
 void LinearLayer::InitBiasParam(const uint32_t out_features) {
   this->bias_ = std::vector<sftensor>(1);
   this->bias_.at(0) = std::make_shared<Tensor<float>>(1, 1, out_features);
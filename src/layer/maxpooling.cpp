@@ -3,10 +3,11 @@
 #include <sys/types.h>
 
 #include <cstdint>
-#include <limits>
 
 #include "layer/layer_factory.hpp"
+#include "layer/simd_kernels.hpp"
 #include "runtime/status_code.hpp"
+#include "runtime/thread_pool.hpp"
 #include "tensor/tensor.hpp"
 namespace free_infer {
 InferStatus MaxPoolingLayer::Forward(const std::vector<sftensor>& inputs,
@@ -39,6 +40,11 @@ InferStatus MaxPoolingLayer::Forward(const std::vector<sftensor>& inputs,
                     "empty tensor "
                  << i << "batch";
       return InferStatus::kInferFailedInputEmpty;
+    } else if (input_data->shapes() != inputs.front()->shapes()) {
+      LOG(ERROR) << "The input tensors of the max pooling layer have "
+                    "different shapes "
+                 << i << "batch";
+      return InferStatus::kInferFailedInputOutSizeMatchError;
     } else {
       uint32_t input_h = input_data->rows();
       uint32_t input_w = input_data->cols();
@@ -71,8 +77,6 @@ InferStatus MaxPoolingLayer::Forward(const std::vector<sftensor>& inputs,
     const uint32_t input_h = input->rows();
     const uint32_t input_w = input->cols();
     const uint32_t input_c = input->channels();
-    const uint32_t input_padded_h = input_h + 2 * padding_h_;
-    const uint32_t input_padded_w = input_w + 2 * padding_w_;
 
     const uint32_t output_h = uint32_t(std::floor(
         (int(input_h) - int(pooling_h) + 2 * padding_h_) / stride_h_ + 1));
@@ -90,37 +94,57 @@ InferStatus MaxPoolingLayer::Forward(const std::vector<sftensor>& inputs,
         << "The output tensor array in the max pooling layer "
            "has an incorrectly sized tensor "
         << i << "batch";
+  }
 
-    for (uint32_t ic = 0; ic < input_c; ++ic) {
-      const arma::fmat& input_ic = input->slice(ic);
-      arma::fmat& output_ic = output->slice(ic);
-      for (uint32_t w = 0; w < input_padded_w - pooling_w + 1; w += stride_w_) {
-        int output_w = int(w / stride_w_);
-        for (uint32_t h = 0; h < input_padded_h - pooling_h + 1;
-             h += stride_h_) {
-          int output_ic_h = int(h / stride_h_);
-          float* output_ic_ptr = output_ic.colptr(output_w);
-          // max_value = -inf
-          float max_value = std::numeric_limits<float>::lowest();
-          for (uint32_t pw = 0; pw < pooling_w; ++pw) {
-            const float* input_ic_ptr = input_ic.colptr(w + pw - padding_w_);
-            for (uint32_t ph = 0; ph < pooling_h; ++ph) {
-              float current_value = 0.f;
-              if ((w + pw >= padding_w_ && h + ph >= padding_h_) &&
-                  (w + pw < input_w + padding_w_ &
-                   h + ph < input_h + padding_h_)) {
-                current_value = *(input_ic_ptr + h + ph - padding_h_);
-              } else {
-                current_value = std::numeric_limits<float>::lowest();
-              }
-              max_value = max_value > current_value ? max_value : current_value;
-            }
-          }
-          *(output_ic_ptr + output_ic_h) = max_value;
-        }
-      }
-    }
+  const uint32_t input_c = inputs.front()->channels();
+  const SimdKernels& kernels = GetSimdKernels();
+  ParallelFor(0, batch * input_c, [&](uint32_t index) {
+    const uint32_t i = index / input_c;
+    const uint32_t ic = index % input_c;
+    const sftensor& input = inputs.at(i);
+    const sftensor& output = outputs.at(i);
+
+    // the pooling window is the kernel of the geometry
+    ConvGeometry geometry;
+    geometry.input_h = input->rows();
+    geometry.input_w = input->cols();
+    geometry.output_h = output->rows();
+    geometry.kernel_h = pooling_h;
+    geometry.kernel_w = pooling_w;
+    geometry.stride_h = stride_h_;
+    geometry.stride_w = stride_w_;
+    geometry.padding_h = padding_h_;
+    geometry.padding_w = padding_w_;
+    kernels.max_pool(geometry, output->cols(), input->matrix_raw_ptr(ic),
+                     output->matrix_raw_ptr(ic));
+  });
+  return InferStatus::kInferSuccess;
+}
+
+InferStatus MaxPoolingLayer::InferOutputShape(
+    const std::vector<std::vector<int>>& input_shapes,
+    std::vector<int>& output_shape) const {
+  if (input_shapes.size() != 1 || input_shapes.front().size() != 4) {
+    LOG(ERROR) << "The max pooling layer needs one input of 4 dims";
+    return InferStatus::kInferFailedInputOutSizeMatchError;
+  }
+  if (!stride_h_ || !stride_w_) {
+    LOG(ERROR) << "The stride parameter is set incorrectly. It must always be "
+                  "greater than 0";
+    return InferStatus::kInferFailedStrideParameterError;
+  }
+
+  const std::vector<int>& input_shape = input_shapes.front();
+  const int output_h = (input_shape.at(2) - int(pooling_size_h_) +
+                        2 * int(padding_h_)) / int(stride_h_) + 1;
+  const int output_w = (input_shape.at(3) - int(pooling_size_w_) +
+                        2 * int(padding_w_)) / int(stride_w_) + 1;
+  if (output_h <= 0 || output_w <= 0) {
+    LOG(ERROR) << "The input of the max pooling layer is smaller than the "
+                  "pooling window";
+    return InferStatus::kInferFailedOutputSizeError;
   }
+  output_shape = {input_shape.at(0), input_shape.at(1), output_h, output_w};
   return InferStatus::kInferSuccess;
 }
 
@@ -5,7 +5,9 @@
 #include <memory>
 
 #include "layer/layer_factory.hpp"
+#include "layer/simd_kernels.hpp"
 #include "runtime/status_code.hpp"
+#include "runtime/thread_pool.hpp"
 #include "tensor/tensor.hpp"
 
 namespace free_infer {
@@ -29,6 +31,12 @@ InferStatus ReluLayer::Forward(const std::vector<sftensor>& inputs, std::vector<
       LOG(ERROR) << "The input tensor array in the relu layer has an empty tensor " << i << " th";
       return InferStatus::kInferFailedInputEmpty;
     }
+    if (input->shapes() != inputs.front()->shapes()) {
+      LOG(ERROR) << "The input tensors of the relu layer have different "
+                    "shapes "
+                 << i << " th";
+      return InferStatus::kInferFailedInputOutSizeMatchError;
+    }
     if (output != nullptr && !output->empty()) {
       if (input->shapes() != output->shapes()) {
         LOG(ERROR) << "The input and output tensor shapes of the relu "
@@ -42,12 +50,19 @@ InferStatus ReluLayer::Forward(const std::vector<sftensor>& inputs, std::vector<
         output = std::make_shared<Tensor<float>>(input->shapes());
         outputs.at(i) = output;
     }
-
-    for (uint32_t j = 0; j < input->size(); ++j) {
-      float value = input->index(j);
-      output->index(j) = value > 0.f ? value : 0.f;
-    }
   }
+
+  const uint32_t input_c = inputs.front()->channels();
+  const SimdKernels& kernels = GetSimdKernels();
+  ParallelFor(0, batch_size * input_c, [&](uint32_t index) {
+    const uint32_t i = index / input_c;
+    const uint32_t c = index % input_c;
+    const sftensor& input = inputs.at(i);
+    const uint32_t planes = input->rows() * input->cols();
+    const float* input_ptr = input->matrix_raw_ptr(c);
+    float* output_ptr = outputs.at(i)->matrix_raw_ptr(c);
+    kernels.relu(input_ptr, output_ptr, planes);
+  });
   return InferStatus::kInferSuccess;
 }
 ParseParameterAttrStatus ReluLayer::GetInstace(const std::shared_ptr<RuntimeOperator>& op,
@@ -1,9 +1,10 @@
 #include "layer/sigmoid.hpp"
 
-#include <cmath>
 #include <memory>
 
+#include "layer/simd_kernels.hpp"
 #include "runtime/status_code.hpp"
+#include "runtime/thread_pool.hpp"
 
 namespace free_infer {
 InferStatus SigmoidLayer::Forward(const std::vector<sftensor>& inputs, std::vector<sftensor>& outputs) {
@@ -25,6 +26,12 @@ InferStatus SigmoidLayer::Forward(const std::vector<sftensor>& inputs, std::vect
       LOG(ERROR) << "The input tensor array in the sigmoid layer has an empty tensor " << i << " th";
       return InferStatus::kInferFailedInputEmpty;
     }
+    if (input->shapes() != inputs.front()->shapes()) {
+      LOG(ERROR) << "The input tensors of the sigmoid layer have different "
+                    "shapes "
+                 << i << " th";
+      return InferStatus::kInferFailedInputOutSizeMatchError;
+    }
     if (output != nullptr && !output->empty()) {
       if (input->shapes() != output->shapes()) {
         LOG(ERROR) << "The input and output tensor shapes of the sigmoid "
@@ -38,12 +45,19 @@ InferStatus SigmoidLayer::Forward(const std::vector<sftensor>& inputs, std::vect
       output = std::make_shared<Tensor<float>>(input->shapes());
       outputs.at(i) = output;
     }
-
-    for (uint32_t j = 0; j < input->size(); ++j) {
-      float value = input->index(j);
-      output->index(j) = 1.f / (1.f + std::exp(-value));
-    }
   }
+
+  const uint32_t input_c = inputs.front()->channels();
+  const SimdKernels& kernels = GetSimdKernels();
+  ParallelFor(0, batch_size * input_c, [&](uint32_t index) {
+    const uint32_t i = index / input_c;
+    const uint32_t c = index % input_c;
+    const sftensor& input = inputs.at(i);
+    const uint32_t planes = input->rows() * input->cols();
+    const float* input_ptr = input->matrix_raw_ptr(c);
+    float* output_ptr = outputs.at(i)->matrix_raw_ptr(c);
+    kernels.sigmoid(input_ptr, output_ptr, planes);
+  });
   return InferStatus::kInferSuccess;
 }
 
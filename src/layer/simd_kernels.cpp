@@ -0,0 +1,97 @@
+#include "layer/simd_kernels.hpp"
+
+#include <glog/logging.h>
+
+#include <cstdlib>
+#include <string>
+
+namespace free_infer {
+// one variant per translation unit, see simd_kernels_impl.hpp
+namespace sse42 {
+const SimdKernels& Kernels();
+}
+namespace avx2 {
+const SimdKernels& Kernels();
+}
+namespace avx512 {
+const SimdKernels& Kernels();
+}
+
+namespace {
+const char* kCpuIsaEnv = "FREE_INFER_CPU_ISA";
+
+// the instruction set the environment caps the kernels to, the widest one if
+// it is not set
+CpuIsa CpuIsaOfEnv() {
+  const char* env = std::getenv(kCpuIsaEnv);
+  if (env == nullptr || *env == '\0') {
+    return CpuIsa::kCpuIsaAvx512;
+  }
+  const std::string name(env);
+  for (const CpuIsa isa : {CpuIsa::kCpuIsaSse42, CpuIsa::kCpuIsaAvx2,
+                           CpuIsa::kCpuIsaAvx512}) {
+    if (name == CpuIsaName(isa)) {
+      return isa;
+    }
+  }
+  LOG(WARNING) << "Unknown instruction set " << name << " in " << kCpuIsaEnv
+               << ", it is ignored";
+  return CpuIsa::kCpuIsaAvx512;
+}
+}  // namespace
+
+CpuIsa DetectCpuIsa() {
+#if defined(__x86_64__) || defined(__i386__)
+  // the checks of the compiler runtime include the OS saving the wider
+  // registers
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("fma")) {
+    return CpuIsa::kCpuIsaAvx512;
+  }
+  if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+    return CpuIsa::kCpuIsaAvx2;
+  }
+  LOG_IF(FATAL, !__builtin_cpu_supports("sse4.2"))
+      << "The CPU does not support SSE4.2, the baseline of the kernels";
+#endif
+  return CpuIsa::kCpuIsaSse42;
+}
+
+const char* CpuIsaName(CpuIsa isa) {
+  switch (isa) {
+    case CpuIsa::kCpuIsaSse42:
+      return "sse42";
+    case CpuIsa::kCpuIsaAvx2:
+      return "avx2";
+    case CpuIsa::kCpuIsaAvx512:
+      return "avx512";
+    default:
+      return "unknown";
+  }
+}
+
+const SimdKernels& GetSimdKernels() {
+  static const SimdKernels& kernels = []() -> const SimdKernels& {
+    const CpuIsa detected_isa = DetectCpuIsa();
+    const CpuIsa env_isa = CpuIsaOfEnv();
+    const CpuIsa isa = env_isa < detected_isa ? env_isa : detected_isa;
+    LOG(INFO) << "Using the " << CpuIsaName(isa)
+              << " kernels, the CPU supports " << CpuIsaName(detected_isa);
+    return SimdKernelsOf(isa);
+  }();
+  return kernels;
+}
+
+const SimdKernels& SimdKernelsOf(CpuIsa isa) {
+  CHECK(isa <= DetectCpuIsa())
+      << "The CPU does not support the " << CpuIsaName(isa) << " kernels";
+  switch (isa) {
+    case CpuIsa::kCpuIsaAvx512:
+      return avx512::Kernels();
+    case CpuIsa::kCpuIsaAvx2:
+      return avx2::Kernels();
+    default:
+      return sse42::Kernels();
+  }
+}
+}  // namespace free_infer
@@ -0,0 +1,5 @@
+// the kernels built with -mavx2 -mfma, see CMakeLists.txt
+#define FREE_INFER_SIMD_ISA avx2
+#define FREE_INFER_SIMD_CPU_ISA CpuIsa::kCpuIsaAvx2
+#define FREE_INFER_SIMD_VECTOR_WIDTH 8
+#include "simd_kernels_impl.hpp"
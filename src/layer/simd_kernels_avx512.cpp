@@ -0,0 +1,5 @@
+// the kernels built with -mavx512f -mfma, see CMakeLists.txt
+#define FREE_INFER_SIMD_ISA avx512
+#define FREE_INFER_SIMD_CPU_ISA CpuIsa::kCpuIsaAvx512
+#define FREE_INFER_SIMD_VECTOR_WIDTH 16
+#include "simd_kernels_impl.hpp"
@@ -0,0 +1,523 @@
+// The body of the kernels of SimdKernels, included by one translation unit
+// per instruction set which is built with the flags of the instruction set
+// and defines
+//   FREE_INFER_SIMD_ISA           the namespace of the variant
+//   FREE_INFER_SIMD_CPU_ISA       its CpuIsa
+//   FREE_INFER_SIMD_VECTOR_WIDTH  the floats of its vectors
+//
+// Everything here lives in the namespace of the variant. No inline function
+// or template of another header may be called, the linker keeps one copy of
+// them for all the variants, which could be the one built for a wider
+// instruction set than the CPU has.
+#ifndef __FREE_INFER_SIMD_KERNELS_IMPL_HPP__
+#define __FREE_INFER_SIMD_KERNELS_IMPL_HPP__
+
+#include <float.h>
+#include <math.h>
+#include <string.h>
+
+#include <cstddef>
+#include <cstdint>
+
+#if defined(__SSE4_2__) || defined(__AVX2__) || defined(__AVX512F__)
+#include <immintrin.h>
+#endif
+
+#include "layer/conv_kernels.hpp"
+#include "layer/gemm.hpp"
+#include "layer/simd_kernels.hpp"
+
+namespace free_infer {
+namespace FREE_INFER_SIMD_ISA {
+namespace {
+constexpr uint32_t kVectorWidth = FREE_INFER_SIMD_VECTOR_WIDTH;
+// the rows of C one pass of the micro kernel keeps in registers, two vectors
+// by kGemmNR columns, the narrower variants cover a kGemmMR panel in several
+// passes
+constexpr uint32_t kTileRows = 2 * kVectorWidth;
+static_assert(kGemmMR % kTileRows == 0,
+              "The panels of A must be whole micro kernel passes");
+
+inline uint32_t Min(uint32_t a, uint32_t b) { return a < b ? a : b; }
+
+void StoreTile(const float* tile, float* c, uint32_t ldc, uint32_t m,
+               uint32_t n, bool accumulate) {
+  for (uint32_t j = 0; j < n; ++j) {
+    const float* tile_col = tile + j * kTileRows;
+    float* c_col = c + j * ldc;
+    if (accumulate) {
+      for (uint32_t i = 0; i < m; ++i) {
+        c_col[i] += tile_col[i];
+      }
+    } else {
+      for (uint32_t i = 0; i < m; ++i) {
+        c_col[i] = tile_col[i];
+      }
+    }
+  }
+}
+
+#if defined(__AVX512F__) || (defined(__AVX2__) && defined(__FMA__)) || \
+    defined(__SSE4_2__)
+#if defined(__AVX512F__)
+using Vector = __m512;
+inline Vector VectorZero() { return _mm512_setzero_ps(); }
+inline Vector VectorLoad(const float* ptr) { return _mm512_loadu_ps(ptr); }
+inline void VectorStore(float* ptr, Vector v) { _mm512_storeu_ps(ptr, v); }
+inline Vector VectorBroadcast(const float* ptr) {
+  return _mm512_set1_ps(*ptr);
+}
+inline Vector VectorSet(float value) { return _mm512_set1_ps(value); }
+inline Vector VectorAdd(Vector a, Vector b) { return _mm512_add_ps(a, b); }
+inline Vector VectorSub(Vector a, Vector b) { return _mm512_sub_ps(a, b); }
+inline Vector VectorMul(Vector a, Vector b) { return _mm512_mul_ps(a, b); }
+inline Vector VectorDiv(Vector a, Vector b) { return _mm512_div_ps(a, b); }
+inline Vector VectorMax(Vector a, Vector b) { return _mm512_max_ps(a, b); }
+inline Vector VectorMin(Vector a, Vector b) { return _mm512_min_ps(a, b); }
+inline Vector VectorFma(Vector a, Vector b, Vector c) {
+  return _mm512_fmadd_ps(a, b, c);
+}
+inline Vector VectorRound(Vector a) {
+  return _mm512_roundscale_ps(a, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+}
+// 2^n of integral n in the range of the float exponents
+inline Vector VectorPow2(Vector n) {
+  const __m512i exponent =
+      _mm512_add_epi32(_mm512_cvtps_epi32(n), _mm512_set1_epi32(127));
+  return _mm512_castsi512_ps(_mm512_slli_epi32(exponent, 23));
+}
+#elif defined(__AVX2__) && defined(__FMA__)
+using Vector = __m256;
+inline Vector VectorZero() { return _mm256_setzero_ps(); }
+inline Vector VectorLoad(const float* ptr) { return _mm256_loadu_ps(ptr); }
+inline void VectorStore(float* ptr, Vector v) { _mm256_storeu_ps(ptr, v); }
+inline Vector VectorBroadcast(const float* ptr) {
+  return _mm256_broadcast_ss(ptr);
+}
+inline Vector VectorSet(float value) { return _mm256_set1_ps(value); }
+inline Vector VectorAdd(Vector a, Vector b) { return _mm256_add_ps(a, b); }
+inline Vector VectorSub(Vector a, Vector b) { return _mm256_sub_ps(a, b); }
+inline Vector VectorMul(Vector a, Vector b) { return _mm256_mul_ps(a, b); }
+inline Vector VectorDiv(Vector a, Vector b) { return _mm256_div_ps(a, b); }
+inline Vector VectorMax(Vector a, Vector b) { return _mm256_max_ps(a, b); }
+inline Vector VectorMin(Vector a, Vector b) { return _mm256_min_ps(a, b); }
+inline Vector VectorFma(Vector a, Vector b, Vector c) {
+  return _mm256_fmadd_ps(a, b, c);
+}
+inline Vector VectorRound(Vector a) {
+  return _mm256_round_ps(a, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+}
+inline Vector VectorPow2(Vector n) {
+  const __m256i exponent =
+      _mm256_add_epi32(_mm256_cvtps_epi32(n), _mm256_set1_epi32(127));
+  return _mm256_castsi256_ps(_mm256_slli_epi32(exponent, 23));
+}
+#else
+using Vector = __m128;
+inline Vector VectorZero() { return _mm_setzero_ps(); }
+inline Vector VectorLoad(const float* ptr) { return _mm_loadu_ps(ptr); }
+inline void VectorStore(float* ptr, Vector v) { _mm_storeu_ps(ptr, v); }
+inline Vector VectorBroadcast(const float* ptr) { return _mm_load1_ps(ptr); }
+inline Vector VectorSet(float value) { return _mm_set1_ps(value); }
+inline Vector VectorAdd(Vector a, Vector b) { return _mm_add_ps(a, b); }
+inline Vector VectorSub(Vector a, Vector b) { return _mm_sub_ps(a, b); }
+inline Vector VectorMul(Vector a, Vector b) { return _mm_mul_ps(a, b); }
+inline Vector VectorDiv(Vector a, Vector b) { return _mm_div_ps(a, b); }
+inline Vector VectorMax(Vector a, Vector b) { return _mm_max_ps(a, b); }
+inline Vector VectorMin(Vector a, Vector b) { return _mm_min_ps(a, b); }
+// no FMA before AVX2
+inline Vector VectorFma(Vector a, Vector b, Vector c) {
+  return _mm_add_ps(_mm_mul_ps(a, b), c);
+}
+inline Vector VectorRound(Vector a) {
+  return _mm_round_ps(a, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+}
+inline Vector VectorPow2(Vector n) {
+  const __m128i exponent =
+      _mm_add_epi32(_mm_cvtps_epi32(n), _mm_set1_epi32(127));
+  return _mm_castsi128_ps(_mm_slli_epi32(exponent, 23));
+}
+#endif
+static_assert(sizeof(Vector) == kVectorWidth * sizeof(float),
+              "The vector width does not match the instruction set");
+
+// one pass over kTileRows rows of the panel of A and the kGemmNR columns of
+// the panel of B, the 2 x kGemmNR accumulators, the two vectors of A and the
+// broadcast of B fit in the vector registers of every instruction set
+void MicroTile(uint32_t k, const float* a, const float* b, float* c,
+               uint32_t ldc, bool accumulate) {
+  Vector acc[kGemmNR][2];
+#pragma GCC unroll 6
+  for (uint32_t j = 0; j < kGemmNR; ++j) {
+    acc[j][0] = VectorZero();
+    acc[j][1] = VectorZero();
+  }
+  for (uint32_t p = 0; p < k; ++p) {
+    const Vector a0 = VectorLoad(a + p * kGemmMR);
+    const Vector a1 = VectorLoad(a + p * kGemmMR + kVectorWidth);
+    const float* b_p = b + p * kGemmNR;
+#pragma GCC unroll 6
+    for (uint32_t j = 0; j < kGemmNR; ++j) {
+      const Vector b_value = VectorBroadcast(b_p + j);
+      acc[j][0] = VectorFma(a0, b_value, acc[j][0]);
+      acc[j][1] = VectorFma(a1, b_value, acc[j][1]);
+    }
+  }
+#pragma GCC unroll 6
+  for (uint32_t j = 0; j < kGemmNR; ++j) {
+    float* c_col = c + j * ldc;
+    if (accumulate) {
+      acc[j][0] = VectorAdd(acc[j][0], VectorLoad(c_col));
+      acc[j][1] = VectorAdd(acc[j][1], VectorLoad(c_col + kVectorWidth));
+    }
+    VectorStore(c_col, acc[j][0]);
+    VectorStore(c_col + kVectorWidth, acc[j][1]);
+  }
+}
+#else
+// the compiler keeps the accumulators of the compile time bounds in vector
+// registers
+void MicroTile(uint32_t k, const float* a, const float* b, float* c,
+               uint32_t ldc, bool accumulate) {
+  float acc[kGemmNR][kTileRows] = {};
+  for (uint32_t p = 0; p < k; ++p) {
+    const float* a_p = a + p * kGemmMR;
+    const float* b_p = b + p * kGemmNR;
+    for (uint32_t j = 0; j < kGemmNR; ++j) {
+      const float b_value = b_p[j];
+      for (uint32_t i = 0; i < kTileRows; ++i) {
+        acc[j][i] += a_p[i] * b_value;
+      }
+    }
+  }
+  StoreTile(&acc[0][0], c, ldc, kTileRows, kGemmNR, accumulate);
+}
+#endif
+
+void GemmMicroKernel(uint32_t k, const float* a, const float* b, float* c,
+                     uint32_t ldc, uint32_t m, uint32_t n, bool accumulate) {
+  for (uint32_t h = 0; h < m; h += kTileRows) {
+    const uint32_t tile_m = Min(kTileRows, m - h);
+    if (tile_m == kTileRows && n == kGemmNR) {
+      MicroTile(k, a + h, b, c + h, ldc, accumulate);
+    } else {
+      // the rows of the panel of A past m and the columns of the panel of B
+      // past n are zeros, the full tile is computed aside and its part in C
+      // stored
+      float tile[kGemmNR * kTileRows];
+      MicroTile(k, a + h, b, tile, kTileRows, false);
+      StoreTile(tile, c + h, ldc, tile_m, n, accumulate);
+    }
+  }
+}
+
+// the kernel element of an im2col column, input channel ic and tap (kh, kw)
+struct KernelElement {
+  KernelElement(uint32_t col, uint32_t kernel_h, uint32_t kernel_w)
+      : ic(col / (kernel_h * kernel_w)),
+        kw(col % (kernel_h * kernel_w) / kernel_h),
+        kh(col % kernel_h) {}
+
+  void Next(uint32_t kernel_h, uint32_t kernel_w) {
+    if (++kh == kernel_h) {
+      kh = 0;
+      if (++kw == kernel_w) {
+        kw = 0;
+        ++ic;
+      }
+    }
+  }
+
+  uint32_t ic;
+  uint32_t kw;
+  uint32_t kh;
+};
+
+// KH, KW and S are compile time constants in the specializations, so the
+// index arithmetic folds and the strided loads of the interior are
+// vectorized, 0 takes them from the geometry
+template <uint32_t KH, uint32_t KW, uint32_t S>
+void PackIm2Col(const ConvGeometry& geometry, const float* input_ptr,
+                uint32_t row_begin, uint32_t rows, uint32_t col_begin,
+                uint32_t cols, float* a_packed) {
+  const uint32_t kernel_h = KH != 0 ? KH : geometry.kernel_h;
+  const uint32_t kernel_w = KW != 0 ? KW : geometry.kernel_w;
+  const uint32_t stride_h = S != 0 ? S : geometry.stride_h;
+  const uint32_t stride_w = S != 0 ? S : geometry.stride_w;
+  const uint32_t input_h = geometry.input_h;
+  const uint32_t input_w = geometry.input_w;
+  const uint32_t output_h = geometry.output_h;
+  const size_t input_size = size_t(input_h) * input_w;
+
+  int32_t row_origin[kGemmMR];
+  int32_t col_origin[kGemmMR];
+  int32_t offsets[kGemmMR];
+  for (uint32_t i = 0; i < rows; i += kGemmMR) {
+    const uint32_t panel_rows = Min(kGemmMR, rows - i);
+    // the input position of the first kernel element of every output
+    // position of the panel, the panel is interior if all of its kernel
+    // elements are inside the input, and contiguous if its output positions
+    // are on one output col
+    bool interior = panel_rows == kGemmMR;
+    bool contiguous = interior;
+    for (uint32_t r = 0; r < panel_rows; ++r) {
+      const uint32_t p = row_begin + i + r;
+      row_origin[r] =
+          int32_t((p % output_h) * stride_h) - int32_t(geometry.padding_h);
+      col_origin[r] =
+          int32_t((p / output_h) * stride_w) - int32_t(geometry.padding_w);
+      offsets[r] = col_origin[r] * int32_t(input_h) + row_origin[r];
+      interior = interior && row_origin[r] >= 0 && col_origin[r] >= 0 &&
+                 row_origin[r] + int32_t(kernel_h) <= int32_t(input_h) &&
+                 col_origin[r] + int32_t(kernel_w) <= int32_t(input_w);
+      contiguous =
+          contiguous && offsets[r] == offsets[0] + int32_t(r * stride_h);
+    }
+
+    // the branch is taken once per panel, the loop of each kind of panel
+    // runs over the kernel elements of the block
+    KernelElement element(col_begin, kernel_h, kernel_w);
+    if (interior && contiguous) {
+      for (uint32_t q = 0; q < cols; ++q) {
+        const float* tap_ptr = input_ptr + element.ic * input_size +
+                               offsets[0] + element.kw * input_h + element.kh;
+        if constexpr (S == 1) {
+          memcpy(a_packed, tap_ptr, kGemmMR * sizeof(float));
+        } else {
+          for (uint32_t r = 0; r < kGemmMR; ++r) {
+            a_packed[r] = tap_ptr[r * stride_h];
+          }
+        }
+        a_packed += kGemmMR;
+        element.Next(kernel_h, kernel_w);
+      }
+    } else if (interior) {
+      for (uint32_t q = 0; q < cols; ++q) {
+        const float* tap_ptr = input_ptr + element.ic * input_size +
+                               element.kw * input_h + element.kh;
+        for (uint32_t r = 0; r < kGemmMR; ++r) {
+          a_packed[r] = tap_ptr[offsets[r]];
+        }
+        a_packed += kGemmMR;
+        element.Next(kernel_h, kernel_w);
+      }
+    } else {
+      for (uint32_t q = 0; q < cols; ++q) {
+        const float* channel_ptr = input_ptr + element.ic * input_size;
+        uint32_t r = 0;
+        for (; r < panel_rows; ++r) {
+          const int32_t row = row_origin[r] + int32_t(element.kh);
+          const int32_t col = col_origin[r] + int32_t(element.kw);
+          if (uint32_t(row) < input_h && uint32_t(col) < input_w) {
+            a_packed[r] = channel_ptr[col * input_h + row];
+          } else {
+            a_packed[r] = geometry.padding_value;
+          }
+        }
+        for (; r < kGemmMR; ++r) {
+          a_packed[r] = 0.f;
+        }
+        a_packed += kGemmMR;
+        element.Next(kernel_h, kernel_w);
+      }
+    }
+  }
+}
+
+Im2ColPacker SelectIm2ColPacker(uint32_t kernel_h, uint32_t kernel_w,
+                                uint32_t stride_h, uint32_t stride_w) {
+  if (stride_h == stride_w) {
+    const uint32_t stride = stride_h;
+    if (kernel_h == 1 && kernel_w == 1 && stride == 1) {
+      return &PackIm2Col<1, 1, 1>;
+    }
+    if (kernel_h == 1 && kernel_w == 1 && stride == 2) {
+      return &PackIm2Col<1, 1, 2>;
+    }
+    if (kernel_h == 3 && kernel_w == 3 && stride == 1) {
+      return &PackIm2Col<3, 3, 1>;
+    }
+    if (kernel_h == 3 && kernel_w == 3 && stride == 2) {
+      return &PackIm2Col<3, 3, 2>;
+    }
+    if (kernel_h == 7 && kernel_w == 7 && stride == 2) {
+      return &PackIm2Col<7, 7, 2>;
+    }
+  }
+  return &PackIm2Col<0, 0, 0>;
+}
+
+// the output rows [begin, end) whose window row tap lies inside the input,
+// output row oh reads input row oh * stride + tap - padding
+void TapRows(uint32_t tap, uint32_t input_size, uint32_t output_size,
+             uint32_t stride, uint32_t padding, uint32_t& begin,
+             uint32_t& end) {
+  begin = tap < padding ? (padding - tap + stride - 1) / stride : 0;
+  end = input_size + padding > tap
+            ? Min(output_size, (input_size + padding - tap + stride - 1) /
+                                   stride)
+            : 0;
+  begin = Min(begin, end);
+}
+
+// the windows are accumulated tap by tap along the output cols, so the
+// inner loop runs over contiguous rows of the input and the output
+void MaxPool(const ConvGeometry& geometry, uint32_t output_w,
+             const float* input, float* output) {
+  const uint32_t input_h = geometry.input_h;
+  const uint32_t input_w = geometry.input_w;
+  const uint32_t output_h = geometry.output_h;
+  const uint32_t stride_h = geometry.stride_h;
+  for (uint32_t ow = 0; ow < output_w; ++ow) {
+    float* output_col = output + size_t(ow) * output_h;
+    for (uint32_t oh = 0; oh < output_h; ++oh) {
+      output_col[oh] = -FLT_MAX;
+    }
+    for (uint32_t pw = 0; pw < geometry.kernel_w; ++pw) {
+      const int32_t col = int32_t(ow * geometry.stride_w + pw) -
+                          int32_t(geometry.padding_w);
+      if (col < 0 || col >= int32_t(input_w)) {
+        continue;
+      }
+      const float* input_col = input + size_t(col) * input_h;
+      for (uint32_t ph = 0; ph < geometry.kernel_h; ++ph) {
+        uint32_t begin = 0;
+        uint32_t end = 0;
+        TapRows(ph, input_h, output_h, stride_h, geometry.padding_h, begin,
+                end);
+        if (begin == end) {
+          continue;
+        }
+        // the input row of output row begin
+        const float* tap_ptr =
+            input_col + (begin * stride_h + ph - geometry.padding_h);
+        float* output_ptr = output_col + begin;
+        const uint32_t count = end - begin;
+        if (stride_h == 1) {
+          for (uint32_t j = 0; j < count; ++j) {
+            const float value = tap_ptr[j];
+            output_ptr[j] = output_ptr[j] > value ? output_ptr[j] : value;
+          }
+        } else {
+          for (uint32_t j = 0; j < count; ++j) {
+            const float value = tap_ptr[j * stride_h];
+            output_ptr[j] = output_ptr[j] > value ? output_ptr[j] : value;
+          }
+        }
+      }
+    }
+  }
+}
+
+#if defined(__AVX512F__) || (defined(__AVX2__) && defined(__FMA__)) || \
+    defined(__SSE4_2__)
+// e^x as 2^n * e^r with n = round(x / ln 2) and the polynomial of Cephes
+// expf for |r| <= ln 2 / 2, a relative error of about 1e-7, x is clamped so
+// 2^n stays a normal float
+inline Vector VectorExp(Vector x) {
+  x = VectorMin(VectorMax(x, VectorSet(-87.3f)), VectorSet(88.3f));
+  const Vector n = VectorRound(VectorMul(x, VectorSet(1.44269504f)));
+  // ln 2 in two parts, the first is exact in a few bits so n * it is exact
+  x = VectorFma(n, VectorSet(-0.693359375f), x);
+  x = VectorFma(n, VectorSet(2.12194440e-4f), x);
+  Vector y = VectorSet(1.9875691500e-4f);
+  y = VectorFma(y, x, VectorSet(1.3981999507e-3f));
+  y = VectorFma(y, x, VectorSet(8.3334519073e-3f));
+  y = VectorFma(y, x, VectorSet(4.1665795894e-2f));
+  y = VectorFma(y, x, VectorSet(1.6666665459e-1f));
+  y = VectorFma(y, x, VectorSet(5.0000001201e-1f));
+  y = VectorFma(y, VectorMul(x, x), VectorAdd(x, VectorSet(1.f)));
+  return VectorMul(y, VectorPow2(n));
+}
+
+// op on whole vectors, the tail goes through a vector of its own so every
+// element gets the same result wherever it is
+template <typename Op>
+void MapVectors(const float* input1, const float* input2, float* output,
+                uint32_t size, Op op) {
+  uint32_t j = 0;
+  for (; j + kVectorWidth <= size; j += kVectorWidth) {
+    VectorStore(output + j, op(VectorLoad(input1 + j), VectorLoad(input2 + j)));
+  }
+  if (j < size) {
+    float tail1[kVectorWidth] = {};
+    float tail2[kVectorWidth] = {};
+    memcpy(tail1, input1 + j, (size - j) * sizeof(float));
+    memcpy(tail2, input2 + j, (size - j) * sizeof(float));
+    VectorStore(tail1, op(VectorLoad(tail1), VectorLoad(tail2)));
+    memcpy(output + j, tail1, (size - j) * sizeof(float));
+  }
+}
+
+void Relu(const float* input, float* output, uint32_t size) {
+  const Vector zero = VectorZero();
+  MapVectors(input, input, output, size,
+             [zero](Vector x, Vector) { return VectorMax(x, zero); });
+}
+
+void Sigmoid(const float* input, float* output, uint32_t size) {
+  const Vector zero = VectorZero();
+  const Vector one = VectorSet(1.f);
+  MapVectors(input, input, output, size, [zero, one](Vector x, Vector) {
+    return VectorDiv(one, VectorAdd(one, VectorExp(VectorSub(zero, x))));
+  });
+}
+
+void Add(const float* input1, const float* input2, float* output,
+         uint32_t size) {
+  MapVectors(input1, input2, output, size, VectorAdd);
+}
+
+void Multiply(const float* input1, const float* input2, float* output,
+              uint32_t size) {
+  MapVectors(input1, input2, output, size, VectorMul);
+}
+#else
+void Relu(const float* input, float* output, uint32_t size) {
+  for (uint32_t j = 0; j < size; ++j) {
+    output[j] = input[j] > 0.f ? input[j] : 0.f;
+  }
+}
+
+void Sigmoid(const float* input, float* output, uint32_t size) {
+  for (uint32_t j = 0; j < size; ++j) {
+    output[j] = 1.f / (1.f + expf(-input[j]));
+  }
+}
+
+void Add(const float* input1, const float* input2, float* output,
+         uint32_t size) {
+  for (uint32_t j = 0; j < size; ++j) {
+    output[j] = input1[j] + input2[j];
+  }
+}
+
+void Multiply(const float* input1, const float* input2, float* output,
+              uint32_t size) {
+  for (uint32_t j = 0; j < size; ++j) {
+    output[j] = input1[j] * input2[j];
+  }
+}
+#endif
+}  // namespace
+
+const SimdKernels& Kernels() {
+  static const SimdKernels kernels = []() {
+    SimdKernels kernels;
+    kernels.isa = FREE_INFER_SIMD_CPU_ISA;
+    kernels.gemm_micro_kernel = &GemmMicroKernel;
+    kernels.select_im2col_packer = &SelectIm2ColPacker;
+    kernels.generic_im2col_packer = &PackIm2Col<0, 0, 0>;
+    kernels.max_pool = &MaxPool;
+    kernels.relu = &Relu;
+    kernels.sigmoid = &Sigmoid;
+    kernels.add = &Add;
+    kernels.multiply = &Multiply;
+    return kernels;
+  }();
+  return kernels;
+}
+}  // namespace FREE_INFER_SIMD_ISA
+}  // namespace free_infer
+
+#endif  // __FREE_INFER_SIMD_KERNELS_IMPL_HPP__
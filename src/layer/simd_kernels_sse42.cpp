@@ -0,0 +1,5 @@
+// the kernels built with -msse4.2, see CMakeLists.txt
+#define FREE_INFER_SIMD_ISA sse42
+#define FREE_INFER_SIMD_CPU_ISA CpuIsa::kCpuIsaSse42
+#define FREE_INFER_SIMD_VECTOR_WIDTH 4
+#include "simd_kernels_impl.hpp"
@@ -8,6 +8,7 @@
 
 #include "layer/layer_factory.hpp"
 #include "runtime/status_code.hpp"
+#include "runtime/thread_pool.hpp"
 #include "tensor/tensor.hpp"
 
 namespace free_infer {
@@ -49,7 +50,13 @@ InferStatus SoftmaxLayer::Forward(const std::vector<sftensor>& inputs,
       output = std::make_shared<Tensor<float>>(input->shapes());
       outputs.at(i) = output;
     }
-    
+  }
+
+  // the sum runs over the whole tensor, so only the batch is split to keep
+  // the summation order fixed
+  ParallelFor(0, batch_size, [&](uint32_t i) {
+    const sftensor& input = inputs.at(i);
+    const sftensor& output = outputs.at(i);
     auto input_exp = arma::exp(input->data());
 
     float input_exp_sum = arma::accu(input_exp);
@@ -58,7 +65,7 @@ InferStatus SoftmaxLayer::Forward(const std::vector<sftensor>& inputs,
       float value = input->index(j);
       output->index(j) = exp(value) / input_exp_sum;
     }
-  }
+  });
   return InferStatus::kInferSuccess;
 }
 ParseParameterAttrStatus SoftmaxLayer::GetInstace(
@@ -0,0 +1,243 @@
+#include "layer/winograd.hpp"
+
+#include <glog/logging.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+#include "runtime/thread_pool.hpp"
+#include "tensor/tensor.hpp"
+
+namespace free_infer {
+namespace {
+// F(4x4, 3x3): Y = AT * [(G * g * GT) .* (BT * d * B)] * A
+constexpr uint32_t kTileSize = 6;
+constexpr uint32_t kOutputTileSize = 4;
+constexpr uint32_t kTileElems = kTileSize * kTileSize;
+
+constexpr float kG[6][3] = {
+    {1.f / 4, 0.f, 0.f},
+    {-1.f / 6, -1.f / 6, -1.f / 6},
+    {-1.f / 6, 1.f / 6, -1.f / 6},
+    {1.f / 24, 1.f / 12, 1.f / 6},
+    {1.f / 24, -1.f / 12, 1.f / 6},
+    {0.f, 0.f, 1.f},
+};
+
+constexpr float kBT[6][6] = {
+    {4.f, 0.f, -5.f, 0.f, 1.f, 0.f},  {0.f, -4.f, -4.f, 1.f, 1.f, 0.f},
+    {0.f, 4.f, -4.f, -1.f, 1.f, 0.f}, {0.f, -2.f, -1.f, 2.f, 1.f, 0.f},
+    {0.f, 2.f, -1.f, -2.f, 1.f, 0.f}, {0.f, 4.f, 0.f, -5.f, 0.f, 1.f},
+};
+
+constexpr float kAT[4][6] = {
+    {1.f, 1.f, 1.f, 1.f, 1.f, 0.f},
+    {0.f, 1.f, -1.f, 2.f, -2.f, 0.f},
+    {0.f, 1.f, 1.f, 4.f, 4.f, 0.f},
+    {0.f, 1.f, -1.f, 8.f, -8.f, 1.f},
+};
+
+// u = G * g * GT, g is the 3x3 kernel
+void TransformKernelTile(const float g[3][3], float u[kTileElems]) {
+  float temp[6][3];
+  for (uint32_t i = 0; i < 6; ++i) {
+    for (uint32_t j = 0; j < 3; ++j) {
+      temp[i][j] = kG[i][0] * g[0][j] + kG[i][1] * g[1][j] + kG[i][2] * g[2][j];
+    }
+  }
+  for (uint32_t i = 0; i < 6; ++i) {
+    for (uint32_t j = 0; j < 6; ++j) {
+      u[i * kTileSize + j] = temp[i][0] * kG[j][0] + temp[i][1] * kG[j][1] +
+                             temp[i][2] * kG[j][2];
+    }
+  }
+}
+
+// v = BT * d * B, d is the 6x6 input tile
+void TransformInputTile(const float d[6][6], float v[kTileElems]) {
+  float temp[6][6];
+  for (uint32_t i = 0; i < 6; ++i) {
+    for (uint32_t j = 0; j < 6; ++j) {
+      float sum = 0.f;
+      for (uint32_t k = 0; k < 6; ++k) {
+        sum += kBT[i][k] * d[k][j];
+      }
+      temp[i][j] = sum;
+    }
+  }
+  for (uint32_t i = 0; i < 6; ++i) {
+    for (uint32_t j = 0; j < 6; ++j) {
+      float sum = 0.f;
+      for (uint32_t k = 0; k < 6; ++k) {
+        sum += temp[i][k] * kBT[j][k];
+      }
+      v[i * kTileSize + j] = sum;
+    }
+  }
+}
+
+// y = AT * m * A, m is the 6x6 product tile
+void TransformOutputTile(const float m[kTileElems], float y[4][4]) {
+  float temp[4][6];
+  for (uint32_t i = 0; i < 4; ++i) {
+    for (uint32_t j = 0; j < 6; ++j) {
+      float sum = 0.f;
+      for (uint32_t k = 0; k < 6; ++k) {
+        sum += kAT[i][k] * m[k * kTileSize + j];
+      }
+      temp[i][j] = sum;
+    }
+  }
+  for (uint32_t i = 0; i < 4; ++i) {
+    for (uint32_t j = 0; j < 4; ++j) {
+      float sum = 0.f;
+      for (uint32_t k = 0; k < 6; ++k) {
+        sum += temp[i][k] * kAT[j][k];
+      }
+      y[i][j] = sum;
+    }
+  }
+}
+}  // namespace
+
+std::vector<PackedMatrix> WinogradTransformKernel(
+    const std::vector<sftensor>& weights) {
+  CHECK(!weights.empty());
+  const uint32_t kernel_n = weights.size();
+  const uint32_t kernel_c = weights.front()->channels();
+  std::vector<arma::fmat> kernel_tiles(kTileElems,
+                                       arma::fmat(kernel_c, kernel_n));
+  for (uint32_t k = 0; k < kernel_n; ++k) {
+    const sftensor& kernel = weights.at(k);
+    CHECK(kernel->channels() == kernel_c && kernel->rows() == 3 &&
+          kernel->cols() == 3)
+        << "The Winograd convolution only supports 3x3 kernels";
+    for (uint32_t c = 0; c < kernel_c; ++c) {
+      float g[3][3];
+      for (uint32_t i = 0; i < 3; ++i) {
+        for (uint32_t j = 0; j < 3; ++j) {
+          g[i][j] = kernel->at(c, i, j);
+        }
+      }
+      float u[kTileElems];
+      TransformKernelTile(g, u);
+      for (uint32_t xi = 0; xi < kTileElems; ++xi) {
+        kernel_tiles.at(xi).at(c, k) = u[xi];
+      }
+    }
+  }
+
+  std::vector<PackedMatrix> kernel_transform(kTileElems);
+  for (uint32_t xi = 0; xi < kTileElems; ++xi) {
+    kernel_transform.at(xi).Pack(kernel_tiles.at(xi).memptr(), kernel_c,
+                                 kernel_n, 1, kernel_c);
+  }
+  return kernel_transform;
+}
+
+size_t WinogradWorkspaceSize(uint32_t input_c, uint32_t output_c,
+                             uint32_t output_h, uint32_t output_w) {
+  const size_t tile_count =
+      size_t((output_h + kOutputTileSize - 1) / kOutputTileSize) *
+      ((output_w + kOutputTileSize - 1) / kOutputTileSize);
+  return tile_count * (input_c + output_c) * kTileElems;
+}
+
+void WinogradConv3x3(const sftensor& input,
+                     const std::vector<PackedMatrix>& kernel_transform,
+                     uint32_t padding_h, uint32_t padding_w,
+                     const sftensor& output, float* workspace,
+                     const std::function<void(uint32_t)>& epilogue) {
+  CHECK(kernel_transform.size() == kTileElems);
+  CHECK(workspace != nullptr) << "The Winograd convolution needs a workspace";
+  const uint32_t input_c = input->channels();
+  const uint32_t input_h = input->rows();
+  const uint32_t input_w = input->cols();
+  const uint32_t output_c = output->channels();
+  const uint32_t output_h = output->rows();
+  const uint32_t output_w = output->cols();
+  CHECK(kernel_transform.front().rows() == input_c &&
+        kernel_transform.front().cols() == output_c)
+      << "The transformed kernels do not match the input and output channels";
+  CHECK(output_h == input_h + 2 * padding_h - 2 &&
+        output_w == input_w + 2 * padding_w - 2)
+      << "The output of the Winograd convolution is incorrectly sized";
+
+  const uint32_t tiles_h = (output_h + kOutputTileSize - 1) / kOutputTileSize;
+  const uint32_t tiles_w = (output_w + kOutputTileSize - 1) / kOutputTileSize;
+  const uint32_t tile_count = tiles_h * tiles_w;
+
+  // column xi holds the (tile_count, input_c) column major matrix of the
+  // transformed tile element xi
+  arma::fmat input_transform(workspace, tile_count * input_c, kTileElems,
+                             false, true);
+  ParallelFor(0, input_c, [&](uint32_t c) {
+    const float* input_channel_ptr = input->matrix_raw_ptr(c);
+    for (uint32_t tw = 0; tw < tiles_w; ++tw) {
+      for (uint32_t th = 0; th < tiles_h; ++th) {
+        float d[6][6];
+        for (uint32_t j = 0; j < kTileSize; ++j) {
+          const int32_t col =
+              int32_t(tw * kOutputTileSize + j) - int32_t(padding_w);
+          for (uint32_t i = 0; i < kTileSize; ++i) {
+            const int32_t row =
+                int32_t(th * kOutputTileSize + i) - int32_t(padding_h);
+            if (row >= 0 && col >= 0 && row < int32_t(input_h) &&
+                col < int32_t(input_w)) {
+              d[i][j] = input_channel_ptr[col * input_h + row];
+            } else {
+              d[i][j] = 0.f;
+            }
+          }
+        }
+        float v[kTileElems];
+        TransformInputTile(d, v);
+        const uint32_t tile_index = c * tile_count + tw * tiles_h + th;
+        for (uint32_t xi = 0; xi < kTileElems; ++xi) {
+          input_transform.colptr(xi)[tile_index] = v[xi];
+        }
+      }
+    }
+  });
+
+  // column xi holds the (tile_count, output_c) product of the tile element
+  arma::fmat output_transform(workspace + input_transform.n_elem,
+                              tile_count * output_c, kTileElems, false, true);
+  ParallelFor(0, kTileElems, [&](uint32_t xi) {
+    Gemm(input_transform.colptr(xi), tile_count, kernel_transform.at(xi),
+         tile_count, output_transform.colptr(xi), tile_count);
+  });
+
+  ParallelFor(0, output_c, [&](uint32_t k) {
+    float* output_channel_ptr = output->matrix_raw_ptr(k);
+    for (uint32_t tw = 0; tw < tiles_w; ++tw) {
+      for (uint32_t th = 0; th < tiles_h; ++th) {
+        const uint32_t tile_index = k * tile_count + tw * tiles_h + th;
+        float m[kTileElems];
+        for (uint32_t xi = 0; xi < kTileElems; ++xi) {
+          m[xi] = output_transform.colptr(xi)[tile_index];
+        }
+        float y[4][4];
+        TransformOutputTile(m, y);
+        // the tiles on the border are cut to the output
+        for (uint32_t j = 0; j < kOutputTileSize; ++j) {
+          const uint32_t col = tw * kOutputTileSize + j;
+          if (col >= output_w) {
+            break;
+          }
+          for (uint32_t i = 0; i < kOutputTileSize; ++i) {
+            const uint32_t row = th * kOutputTileSize + i;
+            if (row >= output_h) {
+              break;
+            }
+            output_channel_ptr[col * output_h + row] = y[i][j];
+          }
+        }
+      }
+    }
+    epilogue(k);
+  });
+}
+}  // namespace free_infer
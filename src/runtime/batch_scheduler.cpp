@@ -0,0 +1,124 @@
+#include "runtime/batch_scheduler.hpp"
+
+#include <glog/logging.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include "runtime/runtime_ir.hpp"
+#include "tensor/tensor.hpp"
+
+namespace free_infer {
+namespace {
+bool SameShape(const sftensor& lhs, const sftensor& rhs) {
+  return lhs->channels() == rhs->channels() && lhs->rows() == rhs->rows() &&
+         lhs->cols() == rhs->cols();
+}
+}  // namespace
+
+BatchScheduler::BatchScheduler(RuntimeGraph& graph, uint32_t max_batch_size,
+                               std::chrono::microseconds max_wait)
+    : graph_(graph), max_batch_size_(max_batch_size), max_wait_(max_wait) {
+  CHECK(max_batch_size_ > 0 && max_batch_size_ <= graph_.max_batch_size())
+      << "The max batch size of the scheduler " << max_batch_size_
+      << " is out of the range [1, " << graph_.max_batch_size() << "]";
+  dispatcher_ = std::thread(&BatchScheduler::RunDispatcher, this);
+}
+
+BatchScheduler::~BatchScheduler() {
+  // the dispatcher hands out the queued requests before it leaves
+  request_queue_.Close();
+  dispatcher_.join();
+}
+
+std::future<sftensor> BatchScheduler::Submit(sftensor input) {
+  CHECK(input != nullptr && !input->empty())
+      << "The input tensor of the request is empty";
+  Request request;
+  request.input = std::move(input);
+  request.promise = std::make_shared<std::promise<sftensor>>();
+  request.submit_time = std::chrono::steady_clock::now();
+  std::future<sftensor> future = request.promise->get_future();
+  const bool queued = request_queue_.Push(std::move(request));
+  CHECK(queued) << "The batch scheduler is stopped";
+  return future;
+}
+
+void BatchScheduler::RunDispatcher() {
+  Request pending;
+  bool has_pending = false;
+  while (has_pending || request_queue_.Pop(pending)) {
+    std::vector<Request> batch;
+    batch.push_back(std::move(pending));
+    has_pending = false;
+
+    const auto deadline = batch.front().submit_time + max_wait_;
+    Request next;
+    while (batch.size() < max_batch_size_ &&
+           request_queue_.PopUntil(next, deadline)) {
+      if (!SameShape(next.input, batch.front().input)) {
+        // it starts the next batch
+        pending = std::move(next);
+        has_pending = true;
+        break;
+      }
+      batch.push_back(std::move(next));
+    }
+    Dispatch(batch);
+  }
+}
+
+void BatchScheduler::Dispatch(std::vector<Request>& batch) {
+  const auto dispatch_time = std::chrono::steady_clock::now();
+  std::vector<sftensor> inputs;
+  std::vector<std::shared_ptr<std::promise<sftensor>>> promises;
+  inputs.reserve(batch.size());
+  promises.reserve(batch.size());
+  {
+    std::lock_guard<std::mutex> lock(stats_mutex_);
+    for (Request& request : batch) {
+      const auto queue_latency =
+          std::chrono::duration_cast<std::chrono::microseconds>(
+              dispatch_time - request.submit_time);
+      stats_.total_queue_latency += queue_latency;
+      stats_.max_queue_latency =
+          std::max(stats_.max_queue_latency, queue_latency);
+      inputs.push_back(std::move(request.input));
+      promises.push_back(std::move(request.promise));
+    }
+    stats_.request_count += batch.size();
+    stats_.batch_count += 1;
+  }
+
+  // the callback may run after the scheduler is gone, so it only touches the
+  // promises it owns
+  graph_.ForwardAsync(
+      std::move(inputs),
+      [promises = std::move(promises)](std::vector<sftensor> outputs) {
+        CHECK(outputs.size() == promises.size());
+        for (uint32_t i = 0; i < promises.size(); ++i) {
+          promises.at(i)->set_value(outputs.at(i));
+        }
+      });
+}
+
+uint32_t BatchScheduler::max_batch_size() const {
+  return this->max_batch_size_;
+}
+
+std::chrono::microseconds BatchScheduler::max_wait() const {
+  return this->max_wait_;
+}
+
+BatchSchedulerStats BatchScheduler::stats() const {
+  std::lock_guard<std::mutex> lock(stats_mutex_);
+  return stats_;
+}
+
+}  // namespace free_infer
@@ -0,0 +1,190 @@
+#include "runtime/conv_tuner.hpp"
+
+#include <glog/logging.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <limits>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "layer/simd_kernels.hpp"
+#include "runtime/thread_pool.hpp"
+#include "runtime/workspace.hpp"
+
+namespace free_infer {
+namespace {
+// the fastest of a few runs after a warm up, the minimum is the least noisy
+constexpr uint32_t kTuningRuns = 3;
+
+bool ValidAlgorithm(const ConvolutionLayer& layer, ConvAlgorithm algorithm) {
+  switch (algorithm) {
+    case ConvAlgorithm::kConvAlgorithmIm2Col:
+    case ConvAlgorithm::kConvAlgorithmImplicitGemm:
+      return true;
+    case ConvAlgorithm::kConvAlgorithmWinograd:
+      return layer.winograd_supported();
+    case ConvAlgorithm::kConvAlgorithmDepthwise:
+      return layer.depthwise_supported();
+    default:
+      return false;
+  }
+}
+}  // namespace
+
+ConvTuner::ConvTuner(std::string cache_path, std::string model)
+    : cache_path_(std::move(cache_path)),
+      model_(std::move(model)),
+      cpu_name_(CpuName()) {}
+
+bool ConvTuner::Load() {
+  if (cache_path_.empty()) {
+    return true;
+  }
+  std::ifstream cache_file(cache_path_);
+  if (!cache_file.is_open()) {
+    return true;
+  }
+  // one choice per line, the tab separated key then the algorithm
+  std::string line;
+  while (std::getline(cache_file, line)) {
+    if (line.empty()) {
+      continue;
+    }
+    const size_t separator = line.rfind('\t');
+    int32_t algorithm = 0;
+    if (separator == std::string::npos ||
+        !(std::istringstream(line.substr(separator + 1)) >> algorithm)) {
+      LOG(ERROR) << "Can not parse the tuning cache file " << cache_path_;
+      choices_.clear();
+      return false;
+    }
+    choices_[line.substr(0, separator)] = ConvAlgorithm(algorithm);
+  }
+  return true;
+}
+
+bool ConvTuner::Save() const {
+  if (cache_path_.empty() || !dirty_) {
+    return true;
+  }
+  std::ofstream cache_file(cache_path_, std::ios::trunc);
+  if (!cache_file.is_open()) {
+    LOG(ERROR) << "Can not write the tuning cache file " << cache_path_;
+    return false;
+  }
+  for (const auto& [key, algorithm] : choices_) {
+    cache_file << key << '\t' << int32_t(algorithm) << '\n';
+  }
+  return bool(cache_file);
+}
+
+ConvAlgorithm ConvTuner::Tune(const std::string& layer_name,
+                              ConvolutionLayer& layer,
+                              const std::vector<sftensor>& inputs,
+                              std::vector<sftensor>& outputs) {
+  const std::string key = Key(layer_name, inputs);
+  const auto choice_iter = choices_.find(key);
+  if (choice_iter != choices_.end() &&
+      ValidAlgorithm(layer, choice_iter->second)) {
+    layer.set_algorithm(choice_iter->second);
+    cached_count_ += 1;
+    return choice_iter->second;
+  }
+
+  std::vector<ConvAlgorithm> candidates{
+      ConvAlgorithm::kConvAlgorithmIm2Col,
+      ConvAlgorithm::kConvAlgorithmImplicitGemm};
+  if (layer.winograd_supported()) {
+    candidates.push_back(ConvAlgorithm::kConvAlgorithmWinograd);
+  }
+  if (layer.depthwise_supported()) {
+    candidates.push_back(ConvAlgorithm::kConvAlgorithmDepthwise);
+  }
+
+  ConvAlgorithm best_algorithm = candidates.front();
+  double best_time = std::numeric_limits<double>::max();
+  for (const ConvAlgorithm algorithm : candidates) {
+    layer.set_algorithm(algorithm);
+    const double time = TimeForward(layer, inputs, outputs);
+    if (time < best_time) {
+      best_time = time;
+      best_algorithm = algorithm;
+    }
+  }
+  layer.set_algorithm(best_algorithm);
+  LOG(INFO) << "Tuned " << layer_name << " to algorithm "
+            << int32_t(best_algorithm) << " in " << best_time << " ms";
+
+  choices_[key] = best_algorithm;
+  dirty_ = true;
+  tuned_count_ += 1;
+  return best_algorithm;
+}
+
+uint32_t ConvTuner::tuned_count() const { return this->tuned_count_; }
+
+uint32_t ConvTuner::cached_count() const { return this->cached_count_; }
+
+std::string ConvTuner::CpuName() {
+  std::ifstream cpuinfo("/proc/cpuinfo");
+  std::string line;
+  while (std::getline(cpuinfo, line)) {
+    if (line.rfind("model name", 0) == 0) {
+      const size_t colon = line.find(':');
+      if (colon != std::string::npos && colon + 2 <= line.size()) {
+        return line.substr(colon + 2);
+      }
+    }
+  }
+  return "unknown";
+}
+
+std::string ConvTuner::Key(const std::string& layer_name,
+                           const std::vector<sftensor>& inputs) const {
+  CHECK(!inputs.empty() && inputs.front() != nullptr);
+  // the choice only holds for the shape, the kernels and the thread count it
+  // was timed with
+  const sftensor& input = inputs.front();
+  std::ostringstream key;
+  key << model_ << '\t' << layer_name << '\t' << cpu_name_ << '\t'
+      << CpuIsaName(GetSimdKernels().isa) << '\t' << GetParallelThreads()
+      << " threads\t" << inputs.size() << "x" << input->channels() << "x"
+      << input->rows() << "x" << input->cols();
+  return key.str();
+}
+
+double ConvTuner::TimeForward(ConvolutionLayer& layer,
+                              const std::vector<sftensor>& inputs,
+                              std::vector<sftensor>& outputs) {
+  // the workspace of the algorithm is lent as the graph lends it to Forward,
+  // so the runs time the same path without allocating it
+  CHECK(!inputs.empty() && inputs.front() != nullptr);
+  const sftensor& input = inputs.front();
+  std::vector<float> workspace(layer.WorkspaceSize(
+      {{int(outputs.size()), int(input->channels()), int(input->rows()),
+        int(input->cols())}}));
+  WorkspaceGuard workspace_guard(workspace.data(), workspace.size());
+
+  double best_time = std::numeric_limits<double>::max();
+  for (uint32_t i = 0; i <= kTuningRuns; ++i) {
+    const auto start = std::chrono::steady_clock::now();
+    const InferStatus status = layer.Forward(inputs, outputs);
+    const auto end = std::chrono::steady_clock::now();
+    CHECK(status == InferStatus::kInferSuccess)
+        << "The convolution layer failed while tuning, error code: "
+        << int(status);
+    // the first run warms up the caches and the packing buffers
+    if (i > 0) {
+      best_time = std::min(
+          best_time,
+          std::chrono::duration<double, std::milli>(end - start).count());
+    }
+  }
+  return best_time;
+}
+}  // namespace free_infer
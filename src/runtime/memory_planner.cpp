@@ -0,0 +1,184 @@
+#include "runtime/memory_planner.hpp"
+
+#include <glog/logging.h>
+
+#include <cstdint>
+#include <limits>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "runtime/runtime_ir.hpp"
+#include "tensor/tensor.hpp"
+
+namespace free_infer {
+
+size_t MemoryPlanner::OperandElemSize(const std::vector<int>& shapes) {
+  CHECK(!shapes.empty()) << "Operand shape error";
+  size_t elem_size = 1;
+  for (const int dim : shapes) {
+    CHECK(dim > 0) << "The operand shapes are not inferred yet!";
+    elem_size *= dim;
+  }
+  return elem_size;
+}
+
+void MemoryPlanner::Plan(
+    const std::vector<std::shared_ptr<RuntimeOperator>>& operators_topo,
+    bool concurrent) {
+  CHECK(!operators_topo.empty()) << "Operators for memory plan is empty!";
+  lifetimes_.clear();
+  arena_sizes_.clear();
+  arenas_.clear();
+  report_ = MemoryPlanReport();
+
+  std::map<std::string, uint32_t> topo_index;
+  for (uint32_t i = 0; i < operators_topo.size(); ++i) {
+    topo_index.insert({operators_topo.at(i)->name, i});
+  }
+
+  // ancestors[i][j] is true when operator j always finishes before i starts
+  std::vector<std::vector<bool>> ancestors;
+  if (concurrent) {
+    const uint32_t op_size = operators_topo.size();
+    ancestors.assign(op_size, std::vector<bool>(op_size, false));
+    for (uint32_t i = 0; i < op_size; ++i) {
+      for (const auto& [_, next_op] : operators_topo.at(i)->output_operators_maps) {
+        const uint32_t next_index = topo_index.at(next_op->name);
+        auto& next_ancestors = ancestors.at(next_index);
+        next_ancestors.at(i) = true;
+        for (uint32_t j = 0; j < op_size; ++j) {
+          if (ancestors.at(i).at(j)) {
+            next_ancestors.at(j) = true;
+          }
+        }
+      }
+    }
+  }
+
+  const uint32_t graph_end = std::numeric_limits<uint32_t>::max();
+  std::vector<std::vector<uint32_t>> operand_users;
+  for (uint32_t i = 0; i < operators_topo.size(); ++i) {
+    const auto& op = operators_topo.at(i);
+    // the graph input is fed by the caller and never written by the graph,
+    // the output operator only hands over the tensors of its producer
+    if (op->type == "pnnx.Input" || op->type == "pnnx.Output" ||
+        op->output_operands == nullptr) {
+      continue;
+    }
+
+    OperandLifetime lifetime;
+    lifetime.operand = op->output_operands;
+    lifetime.produce_index = i;
+    lifetime.last_use_index = i;
+    lifetime.elem_size = OperandElemSize(op->output_operands->shapes);
+    std::vector<uint32_t> users{i};
+    for (const auto& [_, next_op] : op->output_operators_maps) {
+      if (next_op->type == "pnnx.Output") {
+        // the graph output is handed to the caller after forward
+        lifetime.last_use_index = graph_end;
+        break;
+      }
+      CHECK(topo_index.find(next_op->name) != topo_index.end());
+      const uint32_t next_index = topo_index.at(next_op->name);
+      CHECK(next_index > i) << "Wrong topo order of " << next_op->name;
+      lifetime.last_use_index = std::max(lifetime.last_use_index, next_index);
+      users.push_back(next_index);
+    }
+    lifetimes_.push_back(lifetime);
+    operand_users.push_back(std::move(users));
+  }
+
+  // greedy assignment in the production order: reuse the smallest free arena
+  // which is large enough, otherwise grow the largest free one
+  std::vector<uint32_t> arena_free_after;
+  std::vector<uint32_t> arena_tenant;
+  for (uint32_t l = 0; l < lifetimes_.size(); ++l) {
+    auto& lifetime = lifetimes_.at(l);
+    int32_t best_fit = -1;
+    int32_t largest_free = -1;
+    for (uint32_t a = 0; a < arena_sizes_.size(); ++a) {
+      if (arena_free_after.at(a) >= lifetime.produce_index) {
+        continue;
+      }
+      if (concurrent) {
+        const auto& producer_ancestors = ancestors.at(lifetime.produce_index);
+        bool ordered = true;
+        for (const uint32_t user : operand_users.at(arena_tenant.at(a))) {
+          if (!producer_ancestors.at(user)) {
+            ordered = false;
+            break;
+          }
+        }
+        if (!ordered) {
+          continue;
+        }
+      }
+      const size_t arena_size = arena_sizes_.at(a);
+      if (arena_size >= lifetime.elem_size &&
+          (best_fit < 0 || arena_size < arena_sizes_.at(best_fit))) {
+        best_fit = int32_t(a);
+      }
+      if (largest_free < 0 || arena_size > arena_sizes_.at(largest_free)) {
+        largest_free = int32_t(a);
+      }
+    }
+
+    int32_t arena_index = best_fit >= 0 ? best_fit : largest_free;
+    if (arena_index < 0) {
+      arena_index = int32_t(arena_sizes_.size());
+      arena_sizes_.push_back(0);
+      arena_free_after.push_back(0);
+      arena_tenant.push_back(0);
+    }
+    arena_sizes_.at(arena_index) =
+        std::max(arena_sizes_.at(arena_index), lifetime.elem_size);
+    arena_free_after.at(arena_index) = lifetime.last_use_index;
+    arena_tenant.at(arena_index) = l;
+    lifetime.arena_index = uint32_t(arena_index);
+
+    report_.naive_bytes += lifetime.elem_size * sizeof(float);
+  }
+
+  for (const size_t arena_size : arena_sizes_) {
+    report_.planned_bytes += arena_size * sizeof(float);
+  }
+  report_.operand_count = lifetimes_.size();
+  report_.arena_count = arena_sizes_.size();
+}
+
+void MemoryPlanner::Allocate() {
+  arenas_.resize(arena_sizes_.size());
+  for (uint32_t a = 0; a < arena_sizes_.size(); ++a) {
+    arenas_.at(a).assign(arena_sizes_.at(a), 0.f);
+  }
+
+  for (const auto& lifetime : lifetimes_) {
+    const auto& operand = lifetime.operand;
+    const std::vector<int>& shapes = operand->shapes;
+    CHECK(shapes.size() == 2 || shapes.size() == 3 || shapes.size() == 4)
+        << "Unsupported tensor shape sizes" << shapes.size();
+    const uint32_t batch = shapes.at(0);
+    const uint32_t channels = shapes.size() == 4 ? shapes.at(1) : 1;
+    const uint32_t rows = shapes.size() == 2 ? 1 : shapes.at(shapes.size() - 2);
+    const uint32_t cols = shapes.back();
+    const size_t batch_elem_size = lifetime.elem_size / batch;
+
+    float* arena_ptr = arenas_.at(lifetime.arena_index).data();
+    operand->datas.resize(batch);
+    for (uint32_t b = 0; b < batch; ++b) {
+      operand->datas.at(b) = std::make_shared<Tensor<float>>(
+          arena_ptr + b * batch_elem_size, channels, rows, cols);
+    }
+  }
+}
+
+const MemoryPlanReport& MemoryPlanner::report() const { return report_; }
+
+const std::vector<MemoryPlanner::OperandLifetime>& MemoryPlanner::lifetimes()
+    const {
+  return lifetimes_;
+}
+
+}  // namespace free_infer
@@ -1,26 +1,48 @@
 #include "runtime/runtime_ir.hpp"
 
 #include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <condition_variable>
 #include <cstdint>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <stack>
 #include <string>
+#include <thread>
 #include <type_traits>
 #include <utility>
 #include <vector>
 
 #include "pnnx/ir.h"
 #include "layer/layer.hpp"
+#include "layer/batchnorm2d.hpp"
+#include "layer/layer_activiation.hpp"
+#include "layer/layer_convolution.hpp"
 #include "layer/layer_factory.hpp"
+#include "runtime/conv_tuner.hpp"
+#include "runtime/memory_planner.hpp"
+#include "runtime/thread_pool.hpp"
 #include "runtime/status_code.hpp"
+#include "runtime/workspace.hpp"
 #include "tensor/tensor.hpp"
+#include "tensor/tensor_util.hpp"
 
 namespace free_infer {
 RuntimeGraph::RuntimeGraph(std::string param_path, std::string bin_path)
     : param_path_(std::move(param_path)), bin_path_(std::move(bin_path)) {}
 
+RuntimeGraph::~RuntimeGraph() {
+  // finish the queued requests before the contexts go away
+  if (request_queue_ != nullptr) {
+    request_queue_->Close();
+    for (std::thread& worker : context_workers_) {
+      worker.join();
+    }
+  }
+}
+
 void RuntimeGraph::set_bin_path(const std::string& bin_path) {
   this->bin_path_ = bin_path;
 }
@@ -288,8 +310,54 @@ RuntimeGraph::get_topo_queues() const {
 const RuntimeGraph::GraphState RuntimeGraph::graph_state() const {
   return this->graph_state_;
 }
+
+const MemoryPlanReport& RuntimeGraph::memory_plan_report() const {
+  CHECK(current_plan_ != nullptr)
+      << "No input shape has been planned yet, build the graph or forward it";
+  return current_plan_->memory_planner->report();
+}
+
+uint32_t RuntimeGraph::cached_plan_count() const {
+  return plan_cache_.size();
+}
+
+void RuntimeGraph::set_executor_mode(ExecutorMode mode, uint32_t num_workers) {
+  CHECK(graph_state_ != GraphState::Complete)
+      << "The executor mode must be set before building the graph";
+  executor_mode_ = mode;
+  executor_workers_ = num_workers;
+}
+
+RuntimeGraph::ExecutorMode RuntimeGraph::executor_mode() const {
+  return this->executor_mode_;
+}
+
+void RuntimeGraph::set_num_threads(uint32_t num_threads) {
+  num_threads_ = num_threads;
+}
+
+uint32_t RuntimeGraph::num_threads() const { return this->num_threads_; }
+
+void RuntimeGraph::set_max_batch_size(uint32_t max_batch_size) {
+  CHECK(graph_state_ != GraphState::Complete)
+      << "The max batch size must be set before building the graph";
+  max_batch_size_ = max_batch_size;
+}
+
+uint32_t RuntimeGraph::max_batch_size() const { return this->max_batch_size_; }
+
+void RuntimeGraph::set_conv_tuning(bool enable, const std::string& cache_path) {
+  CHECK(graph_state_ != GraphState::Complete)
+      << "The convolution tuning must be set before Build";
+  conv_tuning_ = enable;
+  tuning_cache_path_ = cache_path;
+}
+
+bool RuntimeGraph::conv_tuning() const { return this->conv_tuning_; }
+
 void RuntimeGraph::InitOperatorInput(
-    const std::vector<std::shared_ptr<RuntimeOperator>>& operators) {
+    const std::vector<std::shared_ptr<RuntimeOperator>>& operators,
+    uint32_t max_batch_size) {
   if (operators.empty()) {
     LOG(ERROR) << "Operators for init input shapes is empty!";
     return;
@@ -304,12 +372,16 @@ void RuntimeGraph::InitOperatorInput(
         const auto& type = input_operand->type;
         CHECK(type == RuntimeDataType::kTypeFloat32)
             << "The graph only support float32 yet!";
-        const auto& input_operand_shape = input_operand->shapes;
+        auto& input_operand_shape = input_operand->shapes;
 
         auto& input_datas = input_operand->datas;
         CHECK(!input_operand_shape.empty()) << "Operand shape error";
+        if (max_batch_size > 0) {
+          input_operand_shape.at(0) = int32_t(max_batch_size);
+        }
         const int32_t batch = input_operand_shape.at(0);
-        CHECK(batch >= 0) << "Dynaimc batch size is not supported yet!";
+        CHECK(batch > 0) << "Dynamic batch size needs a max batch size, "
+                            "please call set_max_batch_size";
         CHECK(input_operand_shape.size() == 2 ||
               input_operand_shape.size() == 3 ||
               input_operand_shape.size() == 4)
@@ -327,7 +399,8 @@ void RuntimeGraph::InitOperatorInput(
 
 void RuntimeGraph::InitOperatorOutput(
     const std::vector<pnnx::Operator*>& pnnx_operators,
-    const std::vector<std::shared_ptr<RuntimeOperator>>& operators) {
+    const std::vector<std::shared_ptr<RuntimeOperator>>& operators,
+    uint32_t max_batch_size) {
   CHECK(!pnnx_operators.empty() && !operators.empty());
   CHECK(pnnx_operators.size() == operators.size());
 
@@ -343,36 +416,27 @@ void RuntimeGraph::InitOperatorOutput(
     pnnx::Operand* operand = operands.front();
     const auto& runtime_op = operators.at(i);
     CHECK(operand != nullptr);
-    const std::vector<int32_t>& operand_shapes = operand->shape;
+    std::vector<int32_t> operand_shapes = operand->shape;
     const auto& output_tensors = runtime_op->output_operands;
     CHECK(operand != nullptr) << "Operand output is null";
+    CHECK(!operand_shapes.empty()) << "Operand shape error";
+    if (max_batch_size > 0) {
+      operand_shapes.at(0) = int32_t(max_batch_size);
+    }
     const int32_t batch = operand_shapes.at(0);
-    CHECK(batch >= 0) << "Dynamic batch size is not supported!";
+    CHECK(batch > 0) << "Dynamic batch size needs a max batch size, please "
+                        "call set_max_batch_size";
     CHECK(operand_shapes.size() == 2 || operand_shapes.size() == 3 ||
           operand_shapes.size() == 4)
         << "Unsupported tensor shape sizes" << operand_shapes.size();
 
     if (!output_tensors) {
+      // the output tensors are placed in the arenas by the memory planner
       std::shared_ptr<RuntimeOperand> output_operand =
           std::make_shared<RuntimeOperand>();
       output_operand->name = operand->name + "_output";
       output_operand->type = RuntimeDataType::kTypeFloat32;
       output_operand->shapes = operand_shapes;
-      for (uint32_t j = 0; j < batch; ++j) {
-        if (operand_shapes.size() == 4) {
-          sftensor output_tensor = std::make_shared<Tensor<float>>(
-              operand_shapes.at(1), operand_shapes.at(2), operand_shapes.at(3));
-          output_operand->datas.push_back(output_tensor);
-        } else if (operand_shapes.size() == 2) {
-          sftensor output_tensor =
-              std::make_shared<Tensor<float>>(operand_shapes.at(1));
-          output_operand->datas.push_back(output_tensor);
-        } else {
-          sftensor output_tensor = std::make_shared<Tensor<float>>(
-              operand_shapes.at(1), operand_shapes.at(2));
-          output_operand->datas.push_back(output_tensor);
-        }
-      }
       runtime_op->output_operands = std::move(output_operand);
     } else {
       CHECK(batch == output_tensors->datas.size());
@@ -427,6 +491,158 @@ std::shared_ptr<Layer> RuntimeGraph::CreateLayer(
   return layer;
 }
 
+void RuntimeGraph::BypassOperator(
+    const std::shared_ptr<RuntimeOperator>& producer,
+    const std::shared_ptr<RuntimeOperator>& op) {
+  // the consumers of the operator read the producer output from now on
+  producer->output_names = op->output_names;
+  for (const auto& consumer_name : op->output_names) {
+    const auto consumer = operators_maps_.find(consumer_name);
+    if (consumer == operators_maps_.end()) {
+      continue;
+    }
+    auto& input_operands_maps = consumer->second->input_operands_maps;
+    for (const auto& input_operand : consumer->second->input_operands) {
+      if (input_operand->name == op->name) {
+        input_operands_maps.erase(input_operand->name);
+        input_operand->name = producer->name;
+        input_operands_maps.insert({producer->name, input_operand});
+      }
+    }
+  }
+  operators_maps_.erase(op->name);
+  operators_.erase(std::find(operators_.begin(), operators_.end(), op));
+}
+
+void RuntimeGraph::FoldConvBatchNorm() {
+  std::vector<std::pair<std::shared_ptr<RuntimeOperator>,
+                        std::shared_ptr<RuntimeOperator>>>
+      folded_ops;
+  for (const auto& op : operators_) {
+    if (op->type != "nn.Conv2d" || op->output_names.size() != 1) {
+      continue;
+    }
+    const auto conv_layer =
+        std::dynamic_pointer_cast<ConvolutionLayer>(op->layer);
+    const auto next_op = operators_maps_.find(op->output_names.front());
+    if (conv_layer == nullptr || next_op == operators_maps_.end() ||
+        next_op->second->type != "nn.BatchNorm2d" ||
+        next_op->second->input_operands.size() != 1) {
+      continue;
+    }
+    const auto batchnorm_layer =
+        std::dynamic_pointer_cast<BatchNorm2dLayer>(next_op->second->layer);
+    CHECK(batchnorm_layer != nullptr)
+        << next_op->second->name << " has no batchnorm layer";
+    conv_layer->FoldScaleShift(batchnorm_layer->scale(),
+                               batchnorm_layer->shift());
+    folded_ops.push_back({op, next_op->second});
+  }
+
+  for (const auto& [producer, folded_op] : folded_ops) {
+    BypassOperator(producer, folded_op);
+  }
+  LOG_IF(INFO, !folded_ops.empty())
+      << "Folded " << folded_ops.size() << " batchnorms into convolutions";
+}
+
+void RuntimeGraph::FuseConvResidual() {
+  std::vector<std::pair<std::shared_ptr<RuntimeOperator>,
+                        std::shared_ptr<RuntimeOperator>>>
+      fused_ops;
+  for (const auto& op : operators_) {
+    if (op->type != "pnnx.Expression" || op->input_operands.size() != 2) {
+      continue;
+    }
+    const auto expr_param = op->params.find("expr");
+    if (expr_param == op->params.end()) {
+      continue;
+    }
+    const auto expr = std::dynamic_pointer_cast<RuntimeParameterString>(
+        expr_param->second);
+    if (expr == nullptr ||
+        (expr->value != "add(@0,@1)" && expr->value != "add(@1,@0)")) {
+      continue;
+    }
+    const auto& lhs = op->input_operands.at(0);
+    const auto& rhs = op->input_operands.at(1);
+    if (lhs->name == rhs->name || lhs->shapes != rhs->shapes) {
+      continue;
+    }
+
+    for (uint32_t i = 0; i < 2; ++i) {
+      const auto& conv_operand = op->input_operands.at(i);
+      const auto& residual_operand = op->input_operands.at(1 - i);
+      const auto conv_op = operators_maps_.find(conv_operand->name);
+      if (conv_op == operators_maps_.end() ||
+          conv_op->second->type != "nn.Conv2d" ||
+          conv_op->second->output_names.size() != 1) {
+        continue;
+      }
+      const auto conv_layer =
+          std::dynamic_pointer_cast<ConvolutionLayer>(conv_op->second->layer);
+      if (conv_layer == nullptr || conv_layer->use_residual() ||
+          conv_layer->activation() != ActivationType::kActivationNone) {
+        continue;
+      }
+
+      // the producer of the residual feeds the convolution from now on, it
+      // runs before the convolution since it can not depend on it
+      const std::shared_ptr<RuntimeOperator>& conv = conv_op->second;
+      const auto& residual_op = operators_maps_.at(residual_operand->name);
+      std::replace(residual_op->output_names.begin(),
+                   residual_op->output_names.end(), op->name, conv->name);
+      conv->input_operands.push_back(residual_operand);
+      conv->input_operands_maps.insert(
+          {residual_operand->name, residual_operand});
+      conv_layer->set_residual(true);
+      fused_ops.push_back({conv, op});
+      break;
+    }
+  }
+
+  for (const auto& [producer, fused_op] : fused_ops) {
+    BypassOperator(producer, fused_op);
+  }
+  LOG_IF(INFO, !fused_ops.empty())
+      << "Fused " << fused_ops.size() << " residual adds into convolutions";
+}
+
+void RuntimeGraph::FuseConvActivation() {
+  std::vector<std::pair<std::shared_ptr<RuntimeOperator>,
+                        std::shared_ptr<RuntimeOperator>>>
+      fused_ops;
+  for (const auto& op : operators_) {
+    if (op->type != "nn.Conv2d" || op->output_names.size() != 1) {
+      continue;
+    }
+    const auto conv_layer =
+        std::dynamic_pointer_cast<ConvolutionLayer>(op->layer);
+    if (conv_layer == nullptr ||
+        conv_layer->activation() != ActivationType::kActivationNone) {
+      continue;
+    }
+    const auto next_op = operators_maps_.find(op->output_names.front());
+    if (next_op == operators_maps_.end()) {
+      continue;
+    }
+    const ActivationType activation =
+        ActivationOfOperator(next_op->second->type);
+    if (activation == ActivationType::kActivationNone ||
+        next_op->second->input_operands.size() != 1) {
+      continue;
+    }
+    conv_layer->set_activation(activation);
+    fused_ops.push_back({op, next_op->second});
+  }
+
+  for (const auto& [producer, fused_op] : fused_ops) {
+    BypassOperator(producer, fused_op);
+  }
+  LOG_IF(INFO, !fused_ops.empty())
+      << "Fused " << fused_ops.size() << " activations into convolutions";
+}
+
 bool RuntimeGraph::Build(const std::string& input_name,
                          const std::string& output_name) {
   if (graph_state_ == GraphState::Complete) {
@@ -457,16 +673,50 @@ bool RuntimeGraph::Build(const std::string& input_name,
     }
   }
 
-  InitOperatorInput(operators_);
-  InitOperatorOutput(graph_->ops, operators_);
+  InitOperatorInput(operators_, max_batch_size_);
+  InitOperatorOutput(graph_->ops, operators_, max_batch_size_);
+  FoldConvBatchNorm();
+  FuseConvResidual();
+  FuseConvActivation();
 
   Topo();
 
   CHECK(operators_topo_.size() == operators_.size())
       << "Build wrong topo queue";
-  graph_state_ = GraphState::Complete;
+
   input_name_ = input_name;
   output_name_ = output_name;
+  CHECK(operators_maps_.find(input_name_) != operators_maps_.end())
+      << "Can not find the input operator " << input_name_;
+  CHECK(operators_maps_.find(output_name_) != operators_maps_.end())
+      << "Can not find the output operator " << output_name_;
+  const auto& input_op = operators_maps_.at(input_name_);
+  CHECK(input_op->output_operands != nullptr &&
+        !input_op->output_operands->shapes.empty())
+      << "The input operator " << input_name_ << " has no output";
+  const std::vector<int>& input_operand_shape =
+      input_op->output_operands->shapes;
+  if (max_batch_size_ == 0) {
+    max_batch_size_ = input_operand_shape.at(0);
+  }
+
+  // plan the input shape of the param file right away, a dynamic one is
+  // planned by the first Forward
+  bool static_shape = true;
+  for (uint32_t i = 1; i < input_operand_shape.size(); ++i) {
+    static_shape = static_shape && input_operand_shape.at(i) > 0;
+  }
+  if (static_shape) {
+    InputShape input_shape{1, 1, 1};
+    std::copy(input_operand_shape.begin() + 1, input_operand_shape.end(),
+              input_shape.end() - (input_operand_shape.size() - 1));
+    current_plan_ = PrepareExecutionPlan(input_shape);
+  }
+
+  if (executor_mode_ == ExecutorMode::kParallel) {
+    InitExecutor();
+  }
+  graph_state_ = GraphState::Complete;
   if (graph_ != nullptr) {
     graph_.reset();
     graph_ = nullptr;
@@ -475,29 +725,418 @@ bool RuntimeGraph::Build(const std::string& input_name,
   return true;
 }
 
-void RuntimeGraph::ProbeNextLayer(
-    const std::shared_ptr<RuntimeOperator>& current_op,
-    const std::vector<sftensor>& layer_output_datas) {
-  const auto& next_ops = current_op->output_operators_maps;
-  for (const auto& [_, next_op] : next_ops) {
-    const auto& next_input_operands = next_op->input_operands_maps;
-    if (next_input_operands.find(current_op->name) !=
-        next_input_operands.end()) {
-      std::vector<sftensor>& next_input_datas =
-          next_input_operands.at(current_op->name)->datas;
-      CHECK(next_input_datas.size() == layer_output_datas.size());
-      for (int i = 0; i < next_input_datas.size(); ++i) {
-        next_input_datas.at(i) = layer_output_datas.at(i);
+std::unique_ptr<RuntimeGraph> RuntimeGraph::Clone() const {
+  CHECK(graph_state_ == GraphState::Complete)
+      << "Only a built graph can be cloned";
+  std::unique_ptr<RuntimeGraph> clone =
+      std::make_unique<RuntimeGraph>(param_path_, bin_path_);
+  clone->input_name_ = input_name_;
+  clone->output_name_ = output_name_;
+  clone->executor_mode_ = executor_mode_;
+  clone->executor_workers_ = executor_workers_;
+  clone->num_threads_ = num_threads_;
+  clone->max_batch_size_ = max_batch_size_;
+
+  const auto clone_operand =
+      [](const std::shared_ptr<RuntimeOperand>& operand) {
+        std::shared_ptr<RuntimeOperand> operand_clone =
+            std::make_shared<RuntimeOperand>();
+        operand_clone->name = operand->name;
+        operand_clone->type = operand->type;
+        operand_clone->shapes = operand->shapes;
+        return operand_clone;
+      };
+
+  // the operators and operands hold the per graph state, the layers and the
+  // parameters are read only after Build and are shared
+  for (const auto& op : operators_) {
+    std::shared_ptr<RuntimeOperator> op_clone =
+        std::make_shared<RuntimeOperator>();
+    op_clone->type = op->type;
+    op_clone->name = op->name;
+    op_clone->output_names = op->output_names;
+    op_clone->layer = op->layer;
+    op_clone->params = op->params;
+    op_clone->attrs = op->attrs;
+    for (const auto& input_operand : op->input_operands) {
+      std::shared_ptr<RuntimeOperand> input_clone =
+          clone_operand(input_operand);
+      op_clone->input_operands.push_back(input_clone);
+      op_clone->input_operands_maps.insert({input_clone->name, input_clone});
+    }
+    // the output operator takes over its input operand when it is planned
+    if (op->type != "pnnx.Output" && op->output_operands != nullptr) {
+      op_clone->output_operands = clone_operand(op->output_operands);
+    }
+    clone->operators_.push_back(op_clone);
+    clone->operators_maps_.insert({op_clone->name, op_clone});
+  }
+  clone->Topo();
+  CHECK(clone->operators_topo_.size() == clone->operators_.size())
+      << "Build wrong topo queue";
+
+  if (current_plan_ != nullptr) {
+    clone->current_plan_ =
+        clone->PrepareExecutionPlan(current_plan_->input_shape);
+  }
+  if (executor_mode_ == ExecutorMode::kParallel) {
+    clone->InitExecutor();
+  }
+  clone->graph_state_ = GraphState::Complete;
+  return clone;
+}
+
+void RuntimeGraph::InferShapes(const InputShape& input_shape) {
+  const auto& input_op = operators_maps_.at(input_name_);
+  std::vector<int>& input_operand_shape = input_op->output_operands->shapes;
+  const uint32_t input_rank = input_operand_shape.size();
+  CHECK(input_rank == 4 || (input_rank == 3 && input_shape.at(0) == 1) ||
+        (input_rank == 2 && input_shape.at(0) == 1 && input_shape.at(1) == 1))
+      << "The input shape " << input_shape.at(0) << "x" << input_shape.at(1)
+      << "x" << input_shape.at(2) << " does not fit the " << input_rank
+      << " dims of the graph input";
+  input_operand_shape.at(0) = int32_t(max_batch_size_);
+  for (uint32_t i = 1; i < input_rank; ++i) {
+    input_operand_shape.at(i) = int32_t(input_shape.at(i + 3 - input_rank));
+  }
+
+  for (const auto& current_op : operators_topo_) {
+    if (current_op->type == "pnnx.Input") {
+      continue;
+    }
+    std::vector<std::vector<int>> input_shapes;
+    for (const auto& input_operand : current_op->input_operands) {
+      const auto& producer = operators_maps_.at(input_operand->name);
+      CHECK(producer->output_operands != nullptr)
+          << producer->name << " has no output";
+      input_operand->shapes = producer->output_operands->shapes;
+      input_shapes.push_back(input_operand->shapes);
+    }
+    if (current_op->type == "pnnx.Output") {
+      continue;
+    }
+
+    CHECK(current_op->layer != nullptr) << current_op->name << " has no layer";
+    std::vector<int> output_shape;
+    const InferStatus status =
+        current_op->layer->InferOutputShape(input_shapes, output_shape);
+    CHECK(status == InferStatus::kInferSuccess)
+        << "Can not infer the output shape of " << current_op->name
+        << ", error code: " << int(status);
+    current_op->output_operands->shapes = std::move(output_shape);
+  }
+}
+
+ExecutionPlan* RuntimeGraph::PrepareExecutionPlan(
+    const InputShape& input_shape) {
+  const auto plan_iter = plan_cache_.find(input_shape);
+  if (plan_iter != plan_cache_.end()) {
+    return plan_iter->second.get();
+  }
+
+  InferShapes(input_shape);
+  std::unique_ptr<ExecutionPlan> plan = std::make_unique<ExecutionPlan>();
+  plan->input_shape = input_shape;
+  plan->memory_planner = std::make_unique<MemoryPlanner>();
+  plan->memory_planner->Plan(operators_topo_,
+                             executor_mode_ == ExecutorMode::kParallel);
+  plan->memory_planner->Allocate();
+  const MemoryPlanReport& report = plan->memory_planner->report();
+  LOG(INFO) << "Memory plan for input " << input_shape.at(0) << "x"
+            << input_shape.at(1) << "x" << input_shape.at(2) << ": "
+            << report.operand_count << " operands in " << report.arena_count
+            << " arenas, planned " << report.planned_bytes << " bytes, naive "
+            << report.naive_bytes << " bytes";
+  BuildExecutionPlan(*plan);
+  if (conv_tuning_ && !conv_tuned_) {
+    TuneConvolutions(*plan);
+    conv_tuned_ = true;
+  }
+  // after the tuning, the workspace depends on the algorithms
+  PlanWorkspace(*plan);
+
+  ExecutionPlan* plan_ptr = plan.get();
+  plan_cache_.insert({input_shape, std::move(plan)});
+  return plan_ptr;
+}
+
+void RuntimeGraph::TuneConvolutions(ExecutionPlan& plan) {
+  ConvTuner tuner(tuning_cache_path_, param_path_);
+  LOG_IF(WARNING, !tuner.Load())
+      << "The tuning cache file is ignored, every convolution is tuned";
+  ParallelThreadsGuard threads_guard(num_threads_);
+  for (ExecutionStep& step : plan.steps) {
+    auto conv_layer = dynamic_cast<ConvolutionLayer*>(step.layer);
+    if (conv_layer == nullptr) {
+      continue;
+    }
+    // the planned inputs may hold the graph input, which is only bound by
+    // Forward, so the layer is timed on inputs of its own
+    std::vector<sftensor> inputs;
+    for (const auto& input_operand : step.op->input_operands) {
+      const std::vector<int>& shapes = input_operand->shapes;
+      CHECK(shapes.size() == 4)
+          << step.op->name << " needs inputs of 4 dims to be tuned";
+      for (uint32_t i = 0; i < max_batch_size_; ++i) {
+        sftensor input =
+            std::make_shared<Tensor<float>>(shapes.at(1), shapes.at(2),
+                                            shapes.at(3));
+        input->Rand();
+        inputs.push_back(input);
       }
     }
-    else {
-      InferStatus status = current_op->layer->Forward();
-      CHECK(status == InferStatus::kInferSuccess) << current_op->layer->layer_name()
+    tuner.Tune(step.op->name, *conv_layer, inputs, step.outputs);
+  }
+  LOG(INFO) << "Tuned " << tuner.tuned_count()
+            << " convolutions, reused the choices of " << tuner.cached_count()
+            << " from the tuning cache";
+  LOG_IF(WARNING, !tuner.Save()) << "The tuning choices are not saved";
+}
+
+void RuntimeGraph::PlanWorkspace(ExecutionPlan& plan) {
+  // the layers see the thread count of Forward
+  ParallelThreadsGuard threads_guard(num_threads_);
+  size_t slot_size = 0;
+  for (const ExecutionStep& step : plan.steps) {
+    if (step.layer == nullptr) {
+      continue;
+    }
+    std::vector<std::vector<int>> input_shapes;
+    for (const auto& input_operand : step.op->input_operands) {
+      input_shapes.push_back(input_operand->shapes);
+    }
+    slot_size = std::max(slot_size, step.layer->WorkspaceSize(input_shapes));
+  }
+
+  // the serial executor runs one operator at a time, the parallel one at
+  // most one per worker
+  const uint32_t slot_count =
+      executor_mode_ == ExecutorMode::kParallel ? ExecutorWorkers() : 1;
+  plan.workspace_slot_size = slot_size;
+  plan.workspace.assign(slot_size * slot_count, 0.f);
+  plan.free_workspace_slots.clear();
+  for (uint32_t i = 0; i < slot_count; ++i) {
+    plan.free_workspace_slots.push_back(i);
+  }
+  LOG(INFO) << "Workspace of " << slot_count << " slots, "
+            << slot_size * sizeof(float) << " bytes each";
+}
+
+void RuntimeGraph::BuildExecutionPlan(ExecutionPlan& plan) {
+  const uint32_t op_size = operators_topo_.size();
+  std::map<std::string, uint32_t> topo_index;
+  plan.operand_datas.assign(op_size, {});
+  for (uint32_t i = 0; i < op_size; ++i) {
+    const auto& current_op = operators_topo_.at(i);
+    topo_index.insert({current_op->name, i});
+    if (current_op->type != "pnnx.Input" && current_op->type != "pnnx.Output") {
+      // keep the tensors of this plan, the operands are planned again for
+      // the next input shape
+      plan.operand_datas.at(i) = current_op->output_operands->datas;
+    }
+  }
+
+  plan.steps.clear();
+  plan.steps.resize(op_size);
+  plan.graph_outputs = nullptr;
+  for (uint32_t i = 0; i < op_size; ++i) {
+    const auto& current_op = operators_topo_.at(i);
+    ExecutionStep& step = plan.steps.at(i);
+    step.op = current_op;
+    if (current_op->type == "pnnx.Input") {
+      continue;
+    }
+
+    if (current_op->type == "pnnx.Output") {
+      CHECK(current_op->input_operands.size() == 1);
+      const auto& producer =
+          operators_maps_.at(current_op->input_operands.front()->name);
+      // the output operator hands over the tensors of its producer
+      current_op->output_operands = current_op->input_operands.front();
+      if (producer->type != "pnnx.Input") {
+        current_op->output_operands->datas = producer->output_operands->datas;
+        if (current_op->name == output_name_) {
+          plan.graph_outputs =
+              &plan.operand_datas.at(topo_index.at(producer->name));
+        }
+      }
+      continue;
+    }
+
+    step.layer = current_op->layer.get();
+    CHECK(step.layer != nullptr) << current_op->name << " has no layer";
+    CHECK(plan.operand_datas.at(i).size() == max_batch_size_)
+        << current_op->name << " layer output data is not planned";
+    step.output_datas = &plan.operand_datas.at(i);
+
+    for (const auto& input_operand : current_op->input_operands) {
+      const auto& producer = operators_maps_.at(input_operand->name);
+      if (producer->type == "pnnx.Input") {
+        step.operand_datas.push_back(nullptr);
+        continue;
+      }
+      const std::vector<sftensor>& producer_datas =
+          plan.operand_datas.at(topo_index.at(producer->name));
+      CHECK(producer_datas.size() == max_batch_size_)
+          << "The batch size of " << producer->name << " and "
+          << current_op->name << " do not match";
+      input_operand->datas = producer_datas;
+      step.operand_datas.push_back(&producer_datas);
+    }
+    CHECK(!step.operand_datas.empty())
+        << current_op->name << " layer input data is empty";
+  }
+  BindBatch(plan, max_batch_size_);
+}
+
+void RuntimeGraph::BindBatch(ExecutionPlan& plan, uint32_t batch_size) {
+  CHECK(batch_size > 0 && batch_size <= max_batch_size_);
+  plan.input_bindings.clear();
+  const uint32_t step_size = plan.steps.size();
+  for (uint32_t i = 0; i < step_size; ++i) {
+    ExecutionStep& step = plan.steps[i];
+    if (step.layer == nullptr) {
+      continue;
+    }
+    step.inputs.clear();
+    for (const std::vector<sftensor>* operand_datas : step.operand_datas) {
+      if (operand_datas == nullptr) {
+        plan.input_bindings.push_back({i, uint32_t(step.inputs.size())});
+        step.inputs.resize(step.inputs.size() + batch_size);
+      } else {
+        step.inputs.insert(step.inputs.end(), operand_datas->begin(),
+                           operand_datas->begin() + batch_size);
+      }
+    }
+    step.outputs.assign(step.output_datas->begin(),
+                        step.output_datas->begin() + batch_size);
+  }
+  plan.bound_batch_size = batch_size;
+}
+
+void RuntimeGraph::BindGraphInputs(ExecutionPlan& plan,
+                                   const std::vector<sftensor>& inputs) {
+  for (const ExecutionPlan::InputBinding& binding : plan.input_bindings) {
+    std::vector<sftensor>& step_inputs = plan.steps[binding.step_index].inputs;
+    std::copy(inputs.begin(), inputs.end(),
+              step_inputs.begin() + binding.offset);
+  }
+}
+
+void RuntimeGraph::RunStep(uint32_t step_index) {
+  ExecutionStep& step = current_plan_->steps[step_index];
+  if (step.layer == nullptr) {
+    return;
+  }
+  InferStatus status = step.layer->Forward(step.inputs, step.outputs);
+  CHECK(status == InferStatus::kInferSuccess)
+      << step.layer->layer_name()
       << " layer forward failed, error code: " << int(status);
-      current_op->has_forward = true;
-      ProbeNextLayer(current_op, current_op->output_operands->datas);
+}
+
+void RuntimeGraph::InitExecutor() {
+  const uint32_t op_size = operators_topo_.size();
+  std::map<std::string, uint32_t> topo_index;
+  for (uint32_t i = 0; i < op_size; ++i) {
+    topo_index.insert({operators_topo_.at(i)->name, i});
+  }
+
+  dependency_counts_.assign(op_size, 0);
+  successor_indices_.assign(op_size, {});
+  for (uint32_t i = 0; i < op_size; ++i) {
+    const auto& current_op = operators_topo_.at(i);
+    for (const auto& [_, next_op] : current_op->output_operators_maps) {
+      const uint32_t next_index = topo_index.at(next_op->name);
+      successor_indices_.at(i).push_back(next_index);
+      dependency_counts_.at(next_index) += 1;
+    }
+  }
+
+  executor_pool_ = std::make_unique<ThreadPool>(ExecutorWorkers());
+}
+
+uint32_t RuntimeGraph::ExecutorWorkers() const {
+  if (executor_workers_ == 0) {
+    return std::max(1u, std::thread::hardware_concurrency());
+  }
+  return executor_workers_;
+}
+
+struct RuntimeGraph::ExecutorState {
+  std::unique_ptr<std::atomic<uint32_t>[]> dependency_counts;
+  std::mutex finish_mutex;
+  std::condition_variable finish_condition;
+  uint32_t finished_count = 0;
+};
+
+void RuntimeGraph::RunParallelTask(const std::shared_ptr<ExecutorState>& state,
+                                   uint32_t op_index) {
+  // run the operator, then keep running one of the successors made ready by
+  // it on the same thread and hand the other ready ones to the pool
+  ParallelThreadsGuard threads_guard(num_threads_);
+  // a task holds one workspace slot, at most one task runs per worker
+  ExecutionPlan& plan = *current_plan_;
+  uint32_t workspace_slot = 0;
+  {
+    std::lock_guard<std::mutex> lock(workspace_mutex_);
+    CHECK(!plan.free_workspace_slots.empty())
+        << "No workspace slot is left for the operator";
+    workspace_slot = plan.free_workspace_slots.back();
+    plan.free_workspace_slots.pop_back();
+  }
+  WorkspaceGuard workspace_guard(
+      plan.workspace.data() + workspace_slot * plan.workspace_slot_size,
+      plan.workspace_slot_size);
+  while (true) {
+    RunStep(op_index);
+
+    int32_t next_index = -1;
+    for (const uint32_t successor : successor_indices_.at(op_index)) {
+      if (state->dependency_counts[successor].fetch_sub(1) != 1) {
+        continue;
+      }
+      if (next_index < 0) {
+        next_index = int32_t(successor);
+      } else {
+        executor_pool_->Enqueue(
+            [this, state, successor] { RunParallelTask(state, successor); });
+      }
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(state->finish_mutex);
+      state->finished_count += 1;
+      state->finish_condition.notify_one();
     }
+    if (next_index < 0) {
+      break;
+    }
+    op_index = uint32_t(next_index);
   }
+  std::lock_guard<std::mutex> lock(workspace_mutex_);
+  plan.free_workspace_slots.push_back(workspace_slot);
+}
+
+void RuntimeGraph::ForwardParallel() {
+  CHECK(executor_pool_ != nullptr) << "The parallel executor is not ready";
+  const uint32_t op_size = operators_topo_.size();
+  // the tasks hold the state, so it outlives the wait below even if a worker
+  // is still leaving its task
+  std::shared_ptr<ExecutorState> state = std::make_shared<ExecutorState>();
+  state->dependency_counts.reset(new std::atomic<uint32_t>[op_size]);
+  for (uint32_t i = 0; i < op_size; ++i) {
+    state->dependency_counts[i].store(dependency_counts_.at(i));
+  }
+
+  for (uint32_t i = 0; i < op_size; ++i) {
+    if (dependency_counts_.at(i) == 0) {
+      executor_pool_->Enqueue([this, state, i] { RunParallelTask(state, i); });
+    }
+  }
+
+  std::unique_lock<std::mutex> lock(state->finish_mutex);
+  state->finish_condition.wait(
+      lock, [&state, op_size] { return state->finished_count == op_size; });
 }
 
 std::vector<sftensor> RuntimeGraph::Forward(
@@ -508,46 +1147,104 @@ std::vector<sftensor> RuntimeGraph::Forward(
   CHECK(graph_state_ == GraphState::Complete)
       << "Graph status error, current state is " << int(graph_state_);
 
-  CHECK(operators_topo_.size() == operators_.size())
-      << "Build wrong topo queue";
-
-  for (const auto& op : operators_topo_) {
-    op->has_forward = false;
+  const uint32_t batch_size = inputs.size();
+  CHECK(batch_size > 0 && batch_size <= max_batch_size_)
+      << "The batch size " << batch_size << " is out of the range [1, "
+      << max_batch_size_ << "]";
+  const sftensor& first_input = inputs.front();
+  CHECK(first_input != nullptr && !first_input->empty())
+      << "The input tensor of the graph is empty";
+  const InputShape input_shape{first_input->channels(), first_input->rows(),
+                               first_input->cols()};
+  for (const sftensor& input : inputs) {
+    CHECK(input != nullptr && input->channels() == input_shape.at(0) &&
+          input->rows() == input_shape.at(1) &&
+          input->cols() == input_shape.at(2))
+        << "The input tensors of a batch must have the same shape";
+  }
+  if (current_plan_ == nullptr || current_plan_->input_shape != input_shape) {
+    current_plan_ = PrepareExecutionPlan(input_shape);
   }
 
-  for (const auto& current_op : operators_topo_) {
-    if (current_op->type == "pnnx.Input") {
-      current_op->has_forward = true;
-      ProbeNextLayer(current_op, inputs);
-    } else if (current_op->type == "pnnx.Output") {
-      current_op->has_forward = true;
-      CHECK(current_op->input_operands.size() == 1);
-      current_op->output_operands = current_op->input_operands.front();
-    } else {
-      InferStatus status = current_op->layer->Forward();
-      CHECK(status == InferStatus::kInferSuccess)
-          << current_op->layer->layer_name()
-          << "layer forward failed, error code: " << int(status);
-      current_op->has_forward = true;
-      ProbeNextLayer(current_op, current_op->output_operands->datas);
+  ExecutionPlan& plan = *current_plan_;
+  if (batch_size != plan.bound_batch_size) {
+    BindBatch(plan, batch_size);
+  }
+  BindGraphInputs(plan, inputs);
+  if (executor_mode_ == ExecutorMode::kParallel) {
+    ForwardParallel();
+  } else {
+    ParallelThreadsGuard threads_guard(num_threads_);
+    WorkspaceGuard workspace_guard(plan.workspace.data(),
+                                   plan.workspace_slot_size);
+    const uint32_t step_size = plan.steps.size();
+    for (uint32_t i = 0; i < step_size; ++i) {
+      RunStep(i);
     }
   }
 
-  for (const auto& op : operators_topo_) {
-    LOG_IF(FATAL, !op->has_forward)
-        << "The operator: " << op->name << " has not been forward yet!";
+  if (plan.graph_outputs == nullptr) {
+    return inputs;
   }
+  return std::vector<sftensor>(plan.graph_outputs->begin(),
+                               plan.graph_outputs->begin() + batch_size);
+}
 
-  if (operators_maps_.find(output_name_) != operators_maps_.end()) {
-    const auto& output_op = operators_maps_.at(output_name_);
-    CHECK(output_op->output_operands != nullptr)
-        << "Output from" << output_op->name << " is empty";
-    const auto& output_operand = output_op->output_operands;
-    return output_operand->datas;
-  } else {
-    LOG(FATAL) << "Can not find the output operator " << output_name_;
-    return std::vector<std::shared_ptr<Tensor<float>>>{};
+void RuntimeGraph::set_num_contexts(uint32_t num_contexts) {
+  CHECK(num_contexts > 0) << "At least one execution context is needed";
+  CHECK(request_queue_ == nullptr)
+      << "The execution contexts must be set before the first ForwardAsync";
+  num_contexts_ = num_contexts;
+}
+
+uint32_t RuntimeGraph::num_contexts() const { return this->num_contexts_; }
+
+void RuntimeGraph::StartContexts() {
+  CHECK(graph_state_ == GraphState::Complete) << "Graph need be build!";
+  request_queue_ = std::make_unique<RequestQueue<ForwardRequest>>();
+  for (uint32_t i = 0; i < num_contexts_; ++i) {
+    contexts_.push_back(Clone());
   }
+  for (const auto& context : contexts_) {
+    context_workers_.emplace_back(
+        [this, context = context.get()] { RunContext(context); });
+  }
+}
+
+void RuntimeGraph::RunContext(RuntimeGraph* context) {
+  ForwardRequest request;
+  while (request_queue_->Pop(request)) {
+    const std::vector<sftensor> context_outputs =
+        context->Forward(request.inputs);
+    // the context reuses its buffers for the next request
+    std::vector<sftensor> outputs;
+    outputs.reserve(context_outputs.size());
+    for (const sftensor& output : context_outputs) {
+      outputs.push_back(TensorClone(output));
+    }
+    request.callback(std::move(outputs));
+    request = ForwardRequest();
+  }
+}
+
+std::future<std::vector<sftensor>> RuntimeGraph::ForwardAsync(
+    std::vector<sftensor> inputs) {
+  // std::function needs a copyable callable, so the promise is shared
+  auto promise = std::make_shared<std::promise<std::vector<sftensor>>>();
+  std::future<std::vector<sftensor>> future = promise->get_future();
+  ForwardAsync(std::move(inputs), [promise](std::vector<sftensor> outputs) {
+    promise->set_value(std::move(outputs));
+  });
+  return future;
+}
+
+void RuntimeGraph::ForwardAsync(std::vector<sftensor> inputs,
+                                ForwardCallback callback) {
+  CHECK(callback != nullptr) << "The callback of ForwardAsync is empty";
+  std::call_once(contexts_flag_, [this] { StartContexts(); });
+  const bool queued =
+      request_queue_->Push({std::move(inputs), std::move(callback)});
+  CHECK(queued) << "The request queue is closed";
 }
 
 void RuntimeAttribute::ClearWeight() {
@@ -0,0 +1,152 @@
+#include "runtime/thread_pool.hpp"
+
+#include <glog/logging.h>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+
+namespace free_infer {
+ThreadPool::ThreadPool(uint32_t num_threads) {
+  CHECK(num_threads > 0) << "The thread pool needs at least one thread";
+  workers_.reserve(num_threads);
+  for (uint32_t i = 0; i < num_threads; ++i) {
+    workers_.emplace_back(&ThreadPool::WorkerLoop, this);
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  condition_.notify_all();
+  for (auto& worker : workers_) {
+    if (worker.joinable()) {
+      worker.join();
+    }
+  }
+}
+
+void ThreadPool::Enqueue(std::function<void()> task) {
+  CHECK(task != nullptr);
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    CHECK(!stop_) << "Enqueue on a stopped thread pool";
+    tasks_.push(std::move(task));
+  }
+  condition_.notify_one();
+}
+
+uint32_t ThreadPool::num_threads() const { return workers_.size(); }
+
+ThreadPool& ThreadPool::Global() {
+  const uint32_t hardware_threads =
+      std::max(1u, std::thread::hardware_concurrency());
+  static ThreadPool global_pool(std::max(1u, hardware_threads - 1));
+  return global_pool;
+}
+
+void ThreadPool::WorkerLoop() {
+  while (true) {
+    std::function<void()> task;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      condition_.wait(lock, [this] { return stop_ || !tasks_.empty(); });
+      if (stop_ && tasks_.empty()) {
+        return;
+      }
+      task = std::move(tasks_.front());
+      tasks_.pop();
+    }
+    task();
+  }
+}
+
+namespace {
+thread_local uint32_t parallel_threads = 0;
+thread_local bool in_parallel_for = false;
+
+struct ParallelForState {
+  std::atomic<uint32_t> next_chunk{0};
+  std::mutex mutex;
+  std::condition_variable condition;
+  uint32_t finished_chunks = 0;
+};
+}  // namespace
+
+uint32_t GetParallelThreads() {
+  if (parallel_threads != 0) {
+    return parallel_threads;
+  }
+  return std::max(1u, std::thread::hardware_concurrency());
+}
+
+ParallelThreadsGuard::ParallelThreadsGuard(uint32_t num_threads)
+    : prev_num_threads_(parallel_threads) {
+  parallel_threads = num_threads;
+}
+
+ParallelThreadsGuard::~ParallelThreadsGuard() {
+  parallel_threads = prev_num_threads_;
+}
+
+void ParallelFor(uint32_t begin, uint32_t end,
+                 const std::function<void(uint32_t)>& func) {
+  if (begin >= end) {
+    return;
+  }
+  const uint32_t total = end - begin;
+  const uint32_t num_chunks = std::min(GetParallelThreads(), total);
+  if (num_chunks <= 1 || in_parallel_for) {
+    for (uint32_t i = begin; i < end; ++i) {
+      func(i);
+    }
+    return;
+  }
+
+  // the helpers keep the state alive, a late helper finds no chunk left and
+  // returns without touching func
+  std::shared_ptr<ParallelForState> state =
+      std::make_shared<ParallelForState>();
+  auto run_chunks = [state, begin, total, num_chunks, &func]() {
+    in_parallel_for = true;
+    uint32_t finished_chunks = 0;
+    while (true) {
+      const uint32_t chunk = state->next_chunk.fetch_add(1);
+      if (chunk >= num_chunks) {
+        break;
+      }
+      const uint32_t chunk_begin = begin + uint64_t(total) * chunk / num_chunks;
+      const uint32_t chunk_end =
+          begin + uint64_t(total) * (chunk + 1) / num_chunks;
+      for (uint32_t i = chunk_begin; i < chunk_end; ++i) {
+        func(i);
+      }
+      finished_chunks += 1;
+    }
+    in_parallel_for = false;
+    if (finished_chunks > 0) {
+      std::lock_guard<std::mutex> lock(state->mutex);
+      state->finished_chunks += finished_chunks;
+      state->condition.notify_all();
+    }
+  };
+
+  ThreadPool& pool = ThreadPool::Global();
+  for (uint32_t i = 1; i < num_chunks; ++i) {
+    pool.Enqueue(run_chunks);
+  }
+  run_chunks();
+
+  std::unique_lock<std::mutex> lock(state->mutex);
+  state->condition.wait(
+      lock, [&state, num_chunks] { return state->finished_chunks == num_chunks; });
+}
+}  // namespace free_infer
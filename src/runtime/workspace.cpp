@@ -0,0 +1,16 @@
+#include "runtime/workspace.hpp"
+
+namespace free_infer {
+namespace {
+thread_local Workspace current_workspace;
+}  // namespace
+
+Workspace GetWorkspace() { return current_workspace; }
+
+WorkspaceGuard::WorkspaceGuard(float* data, size_t size)
+    : prev_workspace_(current_workspace) {
+  current_workspace = Workspace{data, size, true};
+}
+
+WorkspaceGuard::~WorkspaceGuard() { current_workspace = prev_workspace_; }
+}  // namespace free_infer
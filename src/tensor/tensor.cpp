@@ -139,6 +139,19 @@ Tensor<float>::Tensor(uint32_t channels, uint32_t rows, uint32_t cols) {
   }
 }
 
+Tensor<float>::Tensor(float* raw_ptr, uint32_t channels, uint32_t rows,
+                      uint32_t cols) {
+  CHECK(raw_ptr != nullptr);
+  this->data_ = arma::fcube(raw_ptr, rows, cols, channels, false, true);
+  if (channels == 1 && rows == 1) {
+    this->raw_shapes_ = std::vector<uint32_t>{cols};
+  } else if (channels == 1) {
+    this->raw_shapes_ = std::vector<uint32_t>{rows, cols};
+  } else {
+    this->raw_shapes_ = std::vector<uint32_t>{rows, cols, channels};
+  }
+}
+
 Tensor<float>::Tensor(const std::vector<uint32_t>& shapes) {
   CHECK_LE(shapes.size(), 3);
 
@@ -0,0 +1,42 @@
+#include <glog/logging.h>
+#include <gtest/gtest.h>
+
+#include <cmath>
+
+#include <layer/batchnorm2d.hpp>
+#include <layer/layer.hpp>
+
+TEST(TestLayer, BatchNorm2dForward) {
+  using namespace free_infer;
+  const uint32_t channels = 3;
+  const std::vector<float> mean{0.5f, -1.f, 2.f};
+  const std::vector<float> var{1.f, 4.f, 0.25f};
+  const std::vector<float> gamma{1.f, 0.5f, 2.f};
+  const std::vector<float> beta{0.f, 1.f, -1.f};
+  const float eps = 1e-5f;
+  BatchNorm2dLayer batchnorm_layer(channels, eps, mean, var, gamma, beta);
+
+  std::vector<sftensor> inputs;
+  for (uint32_t i = 0; i < 2; ++i) {
+    sftensor input = std::make_shared<Tensor<float>>(channels, 4, 5);
+    input->Rand();
+    inputs.push_back(input);
+  }
+  std::vector<sftensor> outputs(inputs.size());
+  ASSERT_EQ(batchnorm_layer.Forward(inputs, outputs),
+            InferStatus::kInferSuccess);
+
+  for (uint32_t i = 0; i < inputs.size(); ++i) {
+    for (uint32_t c = 0; c < channels; ++c) {
+      for (uint32_t r = 0; r < 4; ++r) {
+        for (uint32_t w = 0; w < 5; ++w) {
+          const float expected =
+              (inputs.at(i)->at(c, r, w) - mean.at(c)) /
+                  std::sqrt(var.at(c) + eps) * gamma.at(c) +
+              beta.at(c);
+          ASSERT_NEAR(outputs.at(i)->at(c, r, w), expected, 1e-5f);
+        }
+      }
+    }
+  }
+}
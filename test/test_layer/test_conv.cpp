@@ -1,8 +1,13 @@
 
 #include <glog/logging.h>
 #include <gtest/gtest.h>
+
+#include <algorithm>
+
 #include <layer/layer.hpp>
 #include <layer/layer_convolution.hpp>
+#include <runtime/thread_pool.hpp>
+#include <runtime/workspace.hpp>
 
 TEST(TestLayer, ConvForward1) {
   using namespace free_infer;
@@ -50,4 +55,392 @@ TEST(TestLayer, ConvForward1) {
   conv_layer.set_weights(weights);
   conv_layer.Forward(inputs, outputs);
   outputs.at(0)->Show();
-}
\ No newline at end of file
+}
+TEST(TestLayer, ConvForwardGroups) {
+  using namespace free_infer;
+  const uint32_t in_channel = 4;
+  const uint32_t kernel_count = 6;
+  const uint32_t groups = 2;
+  const uint32_t kernel_h = 3;
+  const uint32_t kernel_w = 2;
+  const uint32_t padding = 1;
+  const uint32_t stride = 2;
+  const uint32_t input_h = 7;
+  const uint32_t input_w = 5;
+
+  sftensor input =
+      std::make_shared<Tensor<float>>(in_channel, input_h, input_w);
+  input->Rand();
+  std::vector<sftensor> weights;
+  std::vector<sftensor> bias;
+  for (uint32_t k = 0; k < kernel_count; ++k) {
+    sftensor kernel = std::make_shared<Tensor<float>>(in_channel / groups,
+                                                      kernel_h, kernel_w);
+    kernel->Rand();
+    weights.push_back(kernel);
+    sftensor kernel_bias = std::make_shared<Tensor<float>>(1, 1, 1);
+    kernel_bias->index(0) = float(k + 1);
+    bias.push_back(kernel_bias);
+  }
+
+  ConvolutionLayer conv_layer(kernel_count, in_channel, kernel_h, kernel_w,
+                              padding, padding, stride, stride, groups, true);
+  conv_layer.set_weights(weights);
+  conv_layer.set_bias(bias);
+  std::vector<sftensor> inputs{input};
+  std::vector<sftensor> outputs(1);
+  ASSERT_EQ(conv_layer.Forward(inputs, outputs), InferStatus::kInferSuccess);
+
+  // direct convolution, each kernel sees the input channels of its group
+  const uint32_t output_h = (input_h + 2 * padding - kernel_h) / stride + 1;
+  const uint32_t output_w = (input_w + 2 * padding - kernel_w) / stride + 1;
+  const sftensor& output = outputs.front();
+  ASSERT_EQ(output->channels(), kernel_count);
+  ASSERT_EQ(output->rows(), output_h);
+  ASSERT_EQ(output->cols(), output_w);
+  const uint32_t kernel_c = in_channel / groups;
+  for (uint32_t k = 0; k < kernel_count; ++k) {
+    const uint32_t group = k / (kernel_count / groups);
+    for (uint32_t r = 0; r < output_h; ++r) {
+      for (uint32_t c = 0; c < output_w; ++c) {
+        float expected = bias.at(k)->index(0);
+        for (uint32_t ic = 0; ic < kernel_c; ++ic) {
+          for (uint32_t kh = 0; kh < kernel_h; ++kh) {
+            for (uint32_t kw = 0; kw < kernel_w; ++kw) {
+              const int in_r = int(r * stride + kh) - int(padding);
+              const int in_c = int(c * stride + kw) - int(padding);
+              if (in_r < 0 || in_c < 0 || in_r >= int(input_h) ||
+                  in_c >= int(input_w)) {
+                continue;
+              }
+              expected += weights.at(k)->at(ic, kh, kw) *
+                          input->at(ic + group * kernel_c, in_r, in_c);
+            }
+          }
+        }
+        ASSERT_NEAR(output->at(k, r, c), expected, 1e-4f);
+      }
+    }
+  }
+}
+
+TEST(TestLayer, ConvWinogradMatchesIm2Col) {
+  using namespace free_infer;
+  const uint32_t in_channel = 16;
+  const uint32_t kernel_count = 24;
+  const uint32_t batch_size = 2;
+  for (const uint32_t padding : {0u, 1u, 2u}) {
+    std::vector<sftensor> weights;
+    std::vector<float> bias;
+    for (uint32_t k = 0; k < kernel_count; ++k) {
+      sftensor kernel = std::make_shared<Tensor<float>>(in_channel, 3, 3);
+      kernel->Rand();
+      kernel->Transform([](float value) { return value - 0.5f; });
+      weights.push_back(kernel);
+      bias.push_back(float(k) * 0.1f);
+    }
+    std::vector<sftensor> inputs;
+    for (uint32_t i = 0; i < batch_size; ++i) {
+      // the output is no multiple of the 4x4 Winograd tiles
+      sftensor input = std::make_shared<Tensor<float>>(in_channel, 13, 11);
+      input->Rand();
+      inputs.push_back(input);
+    }
+
+    ConvolutionLayer winograd_layer(kernel_count, in_channel, 3, 3, padding,
+                                    padding, 1, 1, 1, true);
+    winograd_layer.set_weights(weights);
+    winograd_layer.set_bias(bias);
+    ASSERT_TRUE(winograd_layer.winograd_supported());
+    ConvolutionLayer im2col_layer(kernel_count, in_channel, 3, 3, padding,
+                                  padding, 1, 1, 1, true);
+    im2col_layer.set_weights(weights);
+    im2col_layer.set_bias(bias);
+    im2col_layer.set_algorithm(ConvAlgorithm::kConvAlgorithmIm2Col);
+
+    std::vector<sftensor> winograd_outputs(batch_size);
+    std::vector<sftensor> im2col_outputs(batch_size);
+    ASSERT_EQ(winograd_layer.Forward(inputs, winograd_outputs),
+              InferStatus::kInferSuccess);
+    ASSERT_EQ(im2col_layer.Forward(inputs, im2col_outputs),
+              InferStatus::kInferSuccess);
+    for (uint32_t i = 0; i < batch_size; ++i) {
+      ASSERT_EQ(winograd_outputs.at(i)->shapes(),
+                im2col_outputs.at(i)->shapes());
+      const std::vector<float> winograd_values =
+          winograd_outputs.at(i)->values();
+      const std::vector<float> im2col_values = im2col_outputs.at(i)->values();
+      for (uint32_t j = 0; j < im2col_values.size(); ++j) {
+        ASSERT_NEAR(winograd_values.at(j), im2col_values.at(j), 1e-3f);
+      }
+    }
+  }
+
+  // strided and small layers keep im2col
+  ConvolutionLayer strided_layer(kernel_count, in_channel, 3, 3, 1, 1, 2, 2,
+                                 1, true);
+  ASSERT_FALSE(strided_layer.winograd_supported());
+  ConvolutionLayer grouped_layer(kernel_count, in_channel, 3, 3, 1, 1, 1, 1,
+                                 2, true);
+  ASSERT_FALSE(grouped_layer.winograd_supported());
+}
+
+TEST(TestLayer, ConvForwardPointwise) {
+  using namespace free_infer;
+  const uint32_t in_channel = 6;
+  const uint32_t kernel_count = 4;
+  const uint32_t input_h = 7;
+  const uint32_t input_w = 6;
+  sftensor input =
+      std::make_shared<Tensor<float>>(in_channel, input_h, input_w);
+  input->Rand();
+  std::vector<sftensor> weights;
+  for (uint32_t k = 0; k < kernel_count; ++k) {
+    sftensor kernel = std::make_shared<Tensor<float>>(in_channel, 1, 1);
+    kernel->Rand();
+    weights.push_back(kernel);
+  }
+  std::vector<float> bias{0.5f, -0.5f, 1.f, 0.f};
+
+  // the downsample of ResNet is a strided 1x1 convolution. Im2Col takes the
+  // pointwise path, which reads the input as the GEMM operand, the implicit
+  // GEMM the specialized 1x1 packers Auto picks
+  for (const ConvAlgorithm algorithm :
+       {ConvAlgorithm::kConvAlgorithmIm2Col,
+        ConvAlgorithm::kConvAlgorithmImplicitGemm}) {
+    for (const uint32_t stride : {1u, 2u}) {
+      ConvolutionLayer conv_layer(kernel_count, in_channel, 1, 1, 0, 0, stride,
+                                  stride, 1, true);
+      conv_layer.set_weights(weights);
+      conv_layer.set_bias(bias);
+      conv_layer.set_algorithm(algorithm);
+      std::vector<sftensor> inputs{input};
+      std::vector<sftensor> outputs(1);
+      ASSERT_EQ(conv_layer.Forward(inputs, outputs),
+                InferStatus::kInferSuccess);
+
+      const uint32_t output_h = (input_h - 1) / stride + 1;
+      const uint32_t output_w = (input_w - 1) / stride + 1;
+      const sftensor& output = outputs.front();
+      ASSERT_EQ(output->rows(), output_h);
+      ASSERT_EQ(output->cols(), output_w);
+      for (uint32_t k = 0; k < kernel_count; ++k) {
+        for (uint32_t r = 0; r < output_h; ++r) {
+          for (uint32_t c = 0; c < output_w; ++c) {
+            float expected = bias.at(k);
+            for (uint32_t ic = 0; ic < in_channel; ++ic) {
+              expected += weights.at(k)->at(ic, 0, 0) *
+                          input->at(ic, r * stride, c * stride);
+            }
+            ASSERT_NEAR(output->at(k, r, c), expected, 1e-4f)
+                << "algorithm " << int(algorithm) << " stride " << stride;
+          }
+        }
+      }
+    }
+  }
+}
+
+TEST(TestLayer, ConvDepthwiseMatchesIm2Col) {
+  using namespace free_infer;
+  const uint32_t channels = 6;
+  for (const uint32_t kernel_size : {3u, 5u}) {
+    for (const uint32_t stride : {1u, 2u}) {
+      const uint32_t padding = kernel_size / 2;
+      std::vector<sftensor> weights;
+      std::vector<float> bias;
+      for (uint32_t k = 0; k < channels; ++k) {
+        sftensor kernel =
+            std::make_shared<Tensor<float>>(1, kernel_size, kernel_size);
+        kernel->Rand();
+        kernel->Transform([](float value) { return value - 0.5f; });
+        weights.push_back(kernel);
+        bias.push_back(float(k) * 0.1f - 0.2f);
+      }
+      sftensor input = std::make_shared<Tensor<float>>(channels, 11, 9);
+      input->Rand();
+      std::vector<sftensor> inputs{input};
+
+      ConvolutionLayer depthwise_layer(channels, channels, kernel_size,
+                                       kernel_size, padding, padding, stride,
+                                       stride, channels, true);
+      depthwise_layer.set_weights(weights);
+      depthwise_layer.set_bias(bias);
+      depthwise_layer.set_activation(ActivationType::kActivationRelu);
+      ASSERT_TRUE(depthwise_layer.depthwise_supported());
+      ConvolutionLayer im2col_layer(channels, channels, kernel_size,
+                                    kernel_size, padding, padding, stride,
+                                    stride, channels, true);
+      im2col_layer.set_weights(weights);
+      im2col_layer.set_bias(bias);
+      im2col_layer.set_activation(ActivationType::kActivationRelu);
+      im2col_layer.set_algorithm(ConvAlgorithm::kConvAlgorithmIm2Col);
+
+      std::vector<sftensor> depthwise_outputs(1);
+      std::vector<sftensor> im2col_outputs(1);
+      ASSERT_EQ(depthwise_layer.Forward(inputs, depthwise_outputs),
+                InferStatus::kInferSuccess);
+      ASSERT_EQ(im2col_layer.Forward(inputs, im2col_outputs),
+                InferStatus::kInferSuccess);
+      ASSERT_EQ(depthwise_outputs.front()->shapes(),
+                im2col_outputs.front()->shapes());
+      const std::vector<float> depthwise_values =
+          depthwise_outputs.front()->values();
+      const std::vector<float> im2col_values =
+          im2col_outputs.front()->values();
+      for (uint32_t j = 0; j < im2col_values.size(); ++j) {
+        ASSERT_NEAR(depthwise_values.at(j), im2col_values.at(j), 1e-5f);
+      }
+    }
+  }
+}
+
+TEST(TestLayer, ConvImplicitGemmMatchesIm2Col) {
+  using namespace free_infer;
+  // 32 * 3 * 3 rows of the kernel matrix span two blocks of the GEMM
+  const uint32_t in_channel = 32;
+  const uint32_t kernel_count = 16;
+  for (const uint32_t groups : {1u, 2u}) {
+    for (const uint32_t stride : {1u, 2u}) {
+      std::vector<sftensor> weights;
+      std::vector<float> bias;
+      for (uint32_t k = 0; k < kernel_count; ++k) {
+        sftensor kernel =
+            std::make_shared<Tensor<float>>(in_channel / groups, 3, 3);
+        kernel->Rand();
+        kernel->Transform([](float value) { return value - 0.5f; });
+        weights.push_back(kernel);
+        bias.push_back(float(k) * 0.1f - 0.5f);
+      }
+      sftensor input = std::make_shared<Tensor<float>>(in_channel, 23, 19);
+      input->Rand();
+      std::vector<sftensor> inputs{input};
+
+      ConvolutionLayer implicit_layer(kernel_count, in_channel, 3, 3, 1, 1,
+                                      stride, stride, groups, true);
+      implicit_layer.set_weights(weights);
+      implicit_layer.set_bias(bias);
+      implicit_layer.set_activation(ActivationType::kActivationRelu);
+      implicit_layer.set_algorithm(ConvAlgorithm::kConvAlgorithmImplicitGemm);
+      ConvolutionLayer im2col_layer(kernel_count, in_channel, 3, 3, 1, 1,
+                                    stride, stride, groups, true);
+      im2col_layer.set_weights(weights);
+      im2col_layer.set_bias(bias);
+      im2col_layer.set_activation(ActivationType::kActivationRelu);
+      im2col_layer.set_algorithm(ConvAlgorithm::kConvAlgorithmIm2Col);
+
+      std::vector<sftensor> implicit_outputs(1);
+      std::vector<sftensor> im2col_outputs(1);
+      ASSERT_EQ(implicit_layer.Forward(inputs, implicit_outputs),
+                InferStatus::kInferSuccess);
+      ASSERT_EQ(im2col_layer.Forward(inputs, im2col_outputs),
+                InferStatus::kInferSuccess);
+      ASSERT_EQ(implicit_outputs.front()->shapes(),
+                im2col_outputs.front()->shapes());
+      const std::vector<float> implicit_values =
+          implicit_outputs.front()->values();
+      const std::vector<float> im2col_values =
+          im2col_outputs.front()->values();
+      for (uint32_t j = 0; j < im2col_values.size(); ++j) {
+        ASSERT_NEAR(implicit_values.at(j), im2col_values.at(j), 1e-5f);
+      }
+    }
+  }
+}
+
+TEST(TestLayer, ConvBorrowsWorkspace) {
+  using namespace free_infer;
+  const uint32_t in_channel = 4;
+  const uint32_t kernel_count = 8;
+  std::vector<sftensor> weights;
+  for (uint32_t k = 0; k < kernel_count; ++k) {
+    sftensor kernel = std::make_shared<Tensor<float>>(in_channel, 3, 3);
+    kernel->Rand();
+    weights.push_back(kernel);
+  }
+  sftensor input = std::make_shared<Tensor<float>>(in_channel, 9, 7);
+  input->Rand();
+  std::vector<sftensor> inputs{input};
+
+  ConvolutionLayer conv_layer(kernel_count, in_channel, 3, 3, 1, 1, 1, 1, 1,
+                              false);
+  conv_layer.set_weights(weights);
+  conv_layer.set_algorithm(ConvAlgorithm::kConvAlgorithmIm2Col);
+  ParallelThreadsGuard threads_guard(2);
+  // one input, so one task, whose im2col matrix is 9 * 7 x 4 * 3 * 3
+  const size_t workspace_size = conv_layer.WorkspaceSize({{1, 4, 9, 7}});
+  ASSERT_EQ(workspace_size, 9 * 7 * in_channel * 9);
+
+  std::vector<sftensor> outputs(1);
+  ASSERT_EQ(conv_layer.Forward(inputs, outputs), InferStatus::kInferSuccess);
+
+  // the im2col matrix is built in the lent workspace
+  std::vector<float> workspace(workspace_size, -1.f);
+  std::vector<sftensor> workspace_outputs(1);
+  {
+    WorkspaceGuard workspace_guard(workspace.data(), workspace.size());
+    ASSERT_EQ(conv_layer.Forward(inputs, workspace_outputs),
+              InferStatus::kInferSuccess);
+  }
+  ASSERT_NE(std::count(workspace.begin(), workspace.end(), -1.f),
+            workspace.size());
+  ASSERT_TRUE(arma::approx_equal(outputs.front()->data(),
+                                 workspace_outputs.front()->data(), "absdiff",
+                                 1e-6f));
+
+  // the implicit GEMM needs none
+  conv_layer.set_algorithm(ConvAlgorithm::kConvAlgorithmImplicitGemm);
+  ASSERT_EQ(conv_layer.WorkspaceSize({{1, 4, 9, 7}}), 0);
+}
+
+TEST(TestLayer, ConvIm2ColBorders) {
+  using namespace free_infer;
+  const uint32_t in_channel = 3;
+  const uint32_t kernel_count = 5;
+  std::vector<sftensor> weights;
+  for (uint32_t k = 0; k < kernel_count; ++k) {
+    sftensor kernel = std::make_shared<Tensor<float>>(in_channel, 3, 5);
+    kernel->Rand();
+    weights.push_back(kernel);
+  }
+  sftensor input = std::make_shared<Tensor<float>>(in_channel, 8, 11);
+  input->Rand();
+  std::vector<sftensor> inputs{input};
+
+  // a padding beyond the kernel leaves whole output rows and cols without
+  // any input, the strides skip input rows and cols
+  for (const uint32_t padding : {0u, 1u, 3u}) {
+    for (const uint32_t stride : {1u, 2u, 3u}) {
+      ConvolutionLayer conv_layer(kernel_count, in_channel, 3, 5, padding,
+                                  padding, stride, stride, 1, false);
+      conv_layer.set_weights(weights);
+      std::vector<sftensor> outputs(1);
+      conv_layer.set_algorithm(ConvAlgorithm::kConvAlgorithmIm2Col);
+      ASSERT_EQ(conv_layer.Forward(inputs, outputs),
+                InferStatus::kInferSuccess);
+
+      const sftensor& output = outputs.front();
+      for (uint32_t k = 0; k < kernel_count; ++k) {
+        for (uint32_t r = 0; r < output->rows(); ++r) {
+          for (uint32_t c = 0; c < output->cols(); ++c) {
+            float expected = 0.f;
+            for (uint32_t ic = 0; ic < in_channel; ++ic) {
+              for (uint32_t kh = 0; kh < 3; ++kh) {
+                for (uint32_t kw = 0; kw < 5; ++kw) {
+                  const int32_t row = int32_t(r * stride + kh - padding);
+                  const int32_t col = int32_t(c * stride + kw - padding);
+                  if (row >= 0 && col >= 0 && row < int32_t(input->rows()) &&
+                      col < int32_t(input->cols())) {
+                    expected +=
+                        weights.at(k)->at(ic, kh, kw) * input->at(ic, row, col);
+                  }
+                }
+              }
+            }
+            ASSERT_NEAR(output->at(k, r, c), expected, 1e-4f);
+          }
+        }
+      }
+    }
+  }
+}
@@ -0,0 +1,94 @@
+#include <glog/logging.h>
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include <layer/conv_kernels.hpp>
+#include <layer/gemm.hpp>
+
+namespace {
+using namespace free_infer;
+
+// packs blocks of the im2col matrix of inputs with and without padding with
+// the specialized and the generic packer, the blocks start inside a panel
+// row and inside an input channel to exercise partial panels and the
+// kernel element counters
+void ExpectMatchesGeneric(uint32_t kernel_size, uint32_t stride) {
+  const Im2ColPacker packer =
+      SelectIm2ColPacker(kernel_size, kernel_size, stride, stride);
+  ASSERT_NE(packer, nullptr);
+  ASSERT_NE(packer, GenericIm2ColPacker());
+
+  const uint32_t input_c = 3;
+  const uint32_t input_h = 19;
+  const uint32_t input_w = 15;
+  std::vector<float> input(input_c * input_h * input_w);
+  for (uint32_t i = 0; i < input.size(); ++i) {
+    input.at(i) = float(i % 23) * 0.5f - 5.f;
+  }
+
+  for (const uint32_t padding : {0u, 1u, 3u}) {
+    ConvGeometry geometry;
+    geometry.input_h = input_h;
+    geometry.input_w = input_w;
+    geometry.kernel_h = kernel_size;
+    geometry.kernel_w = kernel_size;
+    geometry.stride_h = stride;
+    geometry.stride_w = stride;
+    geometry.padding_h = padding;
+    geometry.padding_w = padding;
+    geometry.padding_value = -1.5f;
+    geometry.output_h = (input_h + 2 * padding - kernel_size) / stride + 1;
+    const uint32_t output_w =
+        (input_w + 2 * padding - kernel_size) / stride + 1;
+    const uint32_t im2col_h = geometry.output_h * output_w;
+    const uint32_t im2col_w = input_c * kernel_size * kernel_size;
+
+    // the last block is clamped to the im2col matrix, a 1x1 kernel has a
+    // single column per channel
+    const uint32_t inner_col =
+        std::min(kernel_size * kernel_size + 2, im2col_w - 1);
+    const std::vector<std::vector<uint32_t>> blocks{
+        {0, im2col_h, 0, im2col_w},
+        {3, im2col_h - 3, 1, im2col_w - 1},
+        {kGemmMR + 1, kGemmMR + 5, inner_col,
+         std::min(kernel_size * kernel_size, im2col_w - inner_col)}};
+    for (const auto& block : blocks) {
+      const uint32_t row_begin = block.at(0);
+      const uint32_t rows = block.at(1);
+      const uint32_t col_begin = block.at(2);
+      const uint32_t cols = block.at(3);
+      const uint32_t panels = (rows + kGemmMR - 1) / kGemmMR;
+      std::vector<float> expected(panels * kGemmMR * cols, 7.f);
+      std::vector<float> packed(panels * kGemmMR * cols, 9.f);
+      GenericIm2ColPacker()(geometry, input.data(), row_begin, rows,
+                            col_begin, cols, expected.data());
+      packer(geometry, input.data(), row_begin, rows, col_begin, cols,
+             packed.data());
+      ASSERT_EQ(packed, expected)
+          << "kernel " << kernel_size << " stride " << stride << " padding "
+          << padding << " rows " << row_begin << "+" << rows << " cols "
+          << col_begin << "+" << cols;
+    }
+  }
+}
+}  // namespace
+
+TEST(TestLayer, ConvKernel1x1Stride1) { ExpectMatchesGeneric(1, 1); }
+
+TEST(TestLayer, ConvKernel1x1Stride2) { ExpectMatchesGeneric(1, 2); }
+
+TEST(TestLayer, ConvKernel3x3Stride1) { ExpectMatchesGeneric(3, 1); }
+
+TEST(TestLayer, ConvKernel3x3Stride2) { ExpectMatchesGeneric(3, 2); }
+
+TEST(TestLayer, ConvKernel7x7Stride2) { ExpectMatchesGeneric(7, 2); }
+
+TEST(TestLayer, ConvKernelGenericFallback) {
+  using namespace free_infer;
+  EXPECT_EQ(SelectIm2ColPacker(5, 5, 1, 1), GenericIm2ColPacker());
+  EXPECT_EQ(SelectIm2ColPacker(3, 3, 1, 2), GenericIm2ColPacker());
+  EXPECT_EQ(SelectIm2ColPacker(7, 7, 1, 1), GenericIm2ColPacker());
+}
@@ -41,4 +41,96 @@ TEST(TestLayer, FlattenForward) {
   for (uint32_t i = 0; i < 3; ++i) {
     LOG(INFO) << outputs.front()->shapes()[i];
   }
-}
\ No newline at end of file
+}
+TEST(TestLayer, FlattenIntoPlannedOutput) {
+  using namespace free_infer;
+  FlattenLayer flatten_layer(1, -1);
+  sftensor input = std::make_shared<Tensor<float>>(3, 4, 5);
+  for (uint32_t i = 0; i < input->size(); ++i) {
+    input->index(i) = float(i);
+  }
+  const std::vector<float> expected = input->values(true);
+
+  // the planned outputs of flattening all dims and the last two dims
+  for (const auto& shape : std::vector<std::vector<uint32_t>>{
+           {1, 1, 60}, {1, 3, 20}}) {
+    std::vector<sftensor> inputs{input};
+    std::vector<sftensor> outputs{std::make_shared<Tensor<float>>(
+        shape.at(0), shape.at(1), shape.at(2))};
+    sftensor output = outputs.front();
+    ASSERT_EQ(flatten_layer.Forward(inputs, outputs),
+              InferStatus::kInferSuccess);
+    ASSERT_EQ(outputs.front(), output);
+    ASSERT_EQ(output->values(true), expected);
+  }
+}
+
+TEST(TestLayer, FlattenNegativeDimsMatchInferredShape) {
+  using namespace free_infer;
+  // a batch of two (4, 6) samples is a rank 3 operand, so -2 is dim 1
+  FlattenLayer flatten_layer(-2, -1);
+  std::vector<int> output_shape;
+  ASSERT_EQ(flatten_layer.InferOutputShape({{2, 4, 6}}, output_shape),
+            InferStatus::kInferSuccess);
+  ASSERT_EQ(output_shape, std::vector<int>({2, 24}));
+
+  std::vector<sftensor> inputs;
+  for (uint32_t i = 0; i < 2; ++i) {
+    sftensor input = std::make_shared<Tensor<float>>(1, 4, 6);
+    for (uint32_t j = 0; j < input->size(); ++j) {
+      input->index(j) = float(i * 100 + j);
+    }
+    inputs.push_back(input);
+  }
+  std::vector<sftensor> outputs(2);
+  ASSERT_EQ(flatten_layer.Forward(inputs, outputs),
+            InferStatus::kInferSuccess);
+  for (uint32_t i = 0; i < 2; ++i) {
+    ASSERT_EQ(outputs.at(i)->size(), 24);
+    ASSERT_EQ(outputs.at(i)->rows(), 1);
+    ASSERT_EQ(outputs.at(i)->values(true), inputs.at(i)->values(true));
+  }
+}
+
+TEST(TestLayer, FlattenSingleChannelExplicitDims) {
+  using namespace free_infer;
+  // a [2, 1, 4, 6] operand, whose samples are single channel tensors
+  FlattenLayer flatten_layer(1, 3);
+  std::vector<int> output_shape;
+  ASSERT_EQ(flatten_layer.InferOutputShape({{2, 1, 4, 6}}, output_shape),
+            InferStatus::kInferSuccess);
+  ASSERT_EQ(output_shape, std::vector<int>({2, 24}));
+
+  std::vector<sftensor> inputs;
+  for (uint32_t i = 0; i < 2; ++i) {
+    sftensor input = std::make_shared<Tensor<float>>(1, 4, 6);
+    for (uint32_t j = 0; j < input->size(); ++j) {
+      input->index(j) = float(i * 100 + j);
+    }
+    inputs.push_back(input);
+  }
+  std::vector<sftensor> outputs(2);
+  ASSERT_EQ(flatten_layer.Forward(inputs, outputs),
+            InferStatus::kInferSuccess);
+  for (uint32_t i = 0; i < 2; ++i) {
+    ASSERT_EQ(outputs.at(i)->shapes(), std::vector<uint32_t>({1, 1, 24}));
+    ASSERT_EQ(outputs.at(i)->values(true), inputs.at(i)->values(true));
+  }
+}
+
+TEST(TestLayer, FlattenLastDimsOfChannels) {
+  using namespace free_infer;
+  // flattening the rows and cols keeps the channels, without a planned
+  // output the layer allocates the (channels, rows * cols) output
+  FlattenLayer flatten_layer(2, 3);
+  sftensor input = std::make_shared<Tensor<float>>(3, 4, 5);
+  for (uint32_t i = 0; i < input->size(); ++i) {
+    input->index(i) = float(i);
+  }
+  std::vector<sftensor> inputs{input};
+  std::vector<sftensor> outputs(1);
+  ASSERT_EQ(flatten_layer.Forward(inputs, outputs),
+            InferStatus::kInferSuccess);
+  ASSERT_EQ(outputs.front()->shapes(), std::vector<uint32_t>({1, 3, 20}));
+  ASSERT_EQ(outputs.front()->values(true), input->values(true));
+}
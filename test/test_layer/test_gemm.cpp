@@ -0,0 +1,102 @@
+#include <glog/logging.h>
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include <vector>
+
+#include <layer/gemm.hpp>
+
+TEST(TestLayer, GemmMatchesNaive) {
+  using namespace free_infer;
+  // odd sizes leave partial micro tiles, k > kGemmKC spans two blocks
+  const std::vector<std::vector<uint32_t>> sizes{
+      {1, 7, 5}, {37, 300, 13}, {130, 9, 97}, {kGemmMR, kGemmKC, kGemmNR}};
+  for (const auto& size : sizes) {
+    const uint32_t m = size.at(0);
+    const uint32_t k = size.at(1);
+    const uint32_t n = size.at(2);
+    // A is column major, B is row major to exercise the strides of Pack
+    std::vector<float> a(m * k);
+    std::vector<float> b(k * n);
+    for (uint32_t i = 0; i < a.size(); ++i) {
+      a.at(i) = float(i % 17) * 0.25f - 2.f;
+    }
+    for (uint32_t i = 0; i < b.size(); ++i) {
+      b.at(i) = float(i % 13) * 0.5f - 3.f;
+    }
+
+    PackedMatrix packed;
+    packed.Pack(b.data(), k, n, n, 1);
+    ASSERT_EQ(packed.rows(), k);
+    ASSERT_EQ(packed.cols(), n);
+
+    std::vector<float> c(m * n, -1.f);
+    Gemm(a.data(), m, packed, m, c.data(), m);
+    for (uint32_t j = 0; j < n; ++j) {
+      for (uint32_t i = 0; i < m; ++i) {
+        float expected = 0.f;
+        for (uint32_t p = 0; p < k; ++p) {
+          expected += a.at(p * m + i) * b.at(p * n + j);
+        }
+        ASSERT_LE(std::abs(c.at(j * m + i) - expected),
+                  1e-4f * (1.f + std::abs(expected)));
+      }
+    }
+  }
+}
+
+TEST(TestLayer, GemmEpilogueCoversEveryBlockOnce) {
+  using namespace free_infer;
+  // several row and column blocks and two k blocks, the epilogue must only
+  // see the final values of C
+  const uint32_t m = 2 * kGemmMC + 7;
+  const uint32_t k = kGemmKC + 3;
+  const uint32_t n = kGemmNC + 5;
+  std::vector<float> a(m * k);
+  std::vector<float> b(k * n);
+  for (uint32_t i = 0; i < a.size(); ++i) {
+    a.at(i) = float(i % 17) * 0.25f - 2.f;
+  }
+  for (uint32_t i = 0; i < b.size(); ++i) {
+    b.at(i) = float(i % 13) * 0.5f - 3.f;
+  }
+  PackedMatrix packed;
+  packed.Pack(b.data(), k, n, n, 1);
+
+  std::vector<float> expected(m * n, 0.f);
+  for (uint32_t j = 0; j < n; ++j) {
+    for (uint32_t p = 0; p < k; ++p) {
+      for (uint32_t i = 0; i < m; ++i) {
+        expected.at(j * m + i) += a.at(p * m + i) * b.at(p * n + j);
+      }
+    }
+  }
+
+  std::vector<float> c(m * n, -1.f);
+  std::vector<uint32_t> visits(m * n, 0);
+  Gemm(a.data(), m, packed, m, c.data(), m,
+       [&](uint32_t row_begin, uint32_t rows, uint32_t col_begin,
+           uint32_t cols, float* c_block, uint32_t ldc) {
+         ASSERT_EQ(ldc, m);
+         ASSERT_EQ(c_block, c.data() + col_begin * m + row_begin);
+         for (uint32_t j = 0; j < cols; ++j) {
+           for (uint32_t i = 0; i < rows; ++i) {
+             const uint32_t index = (col_begin + j) * m + row_begin + i;
+             ASSERT_LE(std::abs(c_block[j * ldc + i] - expected.at(index)),
+                       1e-3f * (1.f + std::abs(expected.at(index))));
+             // a bias per column and a relu
+             const float value = c_block[j * ldc + i] + float(col_begin + j);
+             c_block[j * ldc + i] = value > 0.f ? value : 0.f;
+             visits.at(index) += 1;
+           }
+         }
+       });
+  for (uint32_t j = 0; j < n; ++j) {
+    for (uint32_t i = 0; i < m; ++i) {
+      ASSERT_EQ(visits.at(j * m + i), 1);
+      const float value = expected.at(j * m + i) + float(j);
+      ASSERT_LE(std::abs(c.at(j * m + i) - (value > 0.f ? value : 0.f)),
+                1e-3f * (1.f + std::abs(value)));
+    }
+  }
+}
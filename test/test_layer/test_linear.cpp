@@ -61,4 +61,64 @@ TEST(TestLayer, LinearForward2) {
       ASSERT_EQ(output_tensor->index(j), in_features);
     }
   }
-}
\ No newline at end of file
+}
+TEST(TestLayer, LinearBatchMatchesPerSample) {
+  using namespace free_infer;
+  // more input features than one depth block of the GEMM and, with several
+  // rows per sample, panels of rows which span two samples
+  const uint32_t in_features = 300;
+  const uint32_t out_features = 13;
+  std::vector<float> weights(in_features * out_features);
+  for (uint32_t i = 0; i < weights.size(); ++i) {
+    weights.at(i) = float(i % 11) * 0.125f - 0.5f;
+  }
+  std::vector<float> bias(out_features);
+  for (uint32_t i = 0; i < out_features; ++i) {
+    bias.at(i) = float(i) - 6.f;
+  }
+
+  for (const bool use_bias : {false, true}) {
+    LinearLayer linear_layer(in_features, out_features, use_bias);
+    linear_layer.set_weights(weights);
+    if (use_bias) {
+      linear_layer.set_bias(bias);
+    }
+    const sftensor& weight = linear_layer.weights().front();
+
+    // batch size and rows of each sample
+    for (const auto& shape : std::vector<std::vector<uint32_t>>{
+             {1, 7}, {5, 7}, {70, 1}}) {
+      const uint32_t batch_size = shape.at(0);
+      const uint32_t input_h = shape.at(1);
+      std::vector<sftensor> inputs;
+      std::vector<sftensor> outputs(batch_size);
+      for (uint32_t i = 0; i < batch_size; ++i) {
+        sftensor input =
+            std::make_shared<Tensor<float>>(1, input_h, in_features);
+        for (uint32_t j = 0; j < input->size(); ++j) {
+          input->index(j) = float((i * 31 + j * 7) % 19) * 0.25f - 2.f;
+        }
+        inputs.push_back(input);
+      }
+
+      ASSERT_EQ(linear_layer.Forward(inputs, outputs),
+                InferStatus::kInferSuccess);
+      for (uint32_t i = 0; i < batch_size; ++i) {
+        const sftensor& output = outputs.at(i);
+        ASSERT_NE(output, nullptr);
+        ASSERT_EQ(output->rows(), input_h);
+        ASSERT_EQ(output->cols(), out_features);
+        for (uint32_t r = 0; r < input_h; ++r) {
+          for (uint32_t o = 0; o < out_features; ++o) {
+            float expected = use_bias ? bias.at(o) : 0.f;
+            for (uint32_t p = 0; p < in_features; ++p) {
+              expected += inputs.at(i)->at(0, r, p) * weight->at(0, o, p);
+            }
+            ASSERT_NEAR(output->at(0, r, o), expected, 1e-3f)
+                << "batch " << batch_size << " sample " << i << " row " << r;
+          }
+        }
+      }
+    }
+  }
+}
@@ -0,0 +1,181 @@
+#include <glog/logging.h>
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#include <layer/gemm.hpp>
+#include <layer/simd_kernels.hpp>
+
+namespace {
+using namespace free_infer;
+
+// the instruction sets the CPU running the test supports
+std::vector<CpuIsa> SupportedIsas() {
+  std::vector<CpuIsa> isas;
+  for (const CpuIsa isa : {CpuIsa::kCpuIsaSse42, CpuIsa::kCpuIsaAvx2,
+                           CpuIsa::kCpuIsaAvx512}) {
+    if (isa <= DetectCpuIsa()) {
+      isas.push_back(isa);
+    }
+  }
+  return isas;
+}
+}  // namespace
+
+TEST(TestLayer, SimdKernelsSelected) {
+  using namespace free_infer;
+  const SimdKernels& kernels = GetSimdKernels();
+  EXPECT_LE(kernels.isa, DetectCpuIsa());
+  EXPECT_EQ(&SimdKernelsOf(kernels.isa), &kernels);
+  for (const CpuIsa isa : SupportedIsas()) {
+    EXPECT_EQ(SimdKernelsOf(isa).isa, isa);
+  }
+}
+
+TEST(TestLayer, SimdGemmMicroKernel) {
+  using namespace free_infer;
+  const uint32_t k = 37;
+  std::vector<float> a(kGemmMR * k);
+  std::vector<float> b(k * kGemmNR);
+  for (uint32_t i = 0; i < a.size(); ++i) {
+    a.at(i) = float(i % 17) * 0.25f - 2.f;
+  }
+  for (uint32_t i = 0; i < b.size(); ++i) {
+    b.at(i) = float(i % 13) * 0.5f - 3.f;
+  }
+
+  // full and partial tiles, C has a gap between its columns which must stay
+  // untouched
+  const std::vector<std::vector<uint32_t>> tiles{
+      {kGemmMR, kGemmNR, 0}, {kGemmMR, kGemmNR, 1}, {5, 3, 0}, {20, 6, 1}};
+  for (const CpuIsa isa : SupportedIsas()) {
+    for (const auto& tile : tiles) {
+      const uint32_t m = tile.at(0);
+      const uint32_t n = tile.at(1);
+      const bool accumulate = tile.at(2) != 0;
+      const uint32_t ldc = m + 3;
+      std::vector<float> c(ldc * n, 1.f);
+      SimdKernelsOf(isa).gemm_micro_kernel(k, a.data(), b.data(), c.data(),
+                                           ldc, m, n, accumulate);
+      for (uint32_t j = 0; j < n; ++j) {
+        for (uint32_t i = 0; i < ldc; ++i) {
+          float expected = 1.f;
+          if (i < m) {
+            expected = accumulate ? 1.f : 0.f;
+            for (uint32_t p = 0; p < k; ++p) {
+              expected += a.at(p * kGemmMR + i) * b.at(p * kGemmNR + j);
+            }
+          }
+          ASSERT_LE(std::abs(c.at(j * ldc + i) - expected),
+                    1e-4f * (1.f + std::abs(expected)))
+              << CpuIsaName(isa) << " m " << m << " n " << n;
+        }
+      }
+    }
+  }
+}
+
+TEST(TestLayer, SimdMaxPool) {
+  using namespace free_infer;
+  const uint32_t input_h = 13;
+  const uint32_t input_w = 11;
+  std::vector<float> input(input_h * input_w);
+  for (uint32_t i = 0; i < input.size(); ++i) {
+    input.at(i) = float((i * 7) % 19) - 9.f;
+  }
+
+  // kernel, stride and padding
+  const std::vector<std::vector<uint32_t>> windows{
+      {3, 2, 1}, {2, 2, 0}, {3, 1, 1}, {5, 3, 2}};
+  for (const CpuIsa isa : SupportedIsas()) {
+    for (const auto& window : windows) {
+      ConvGeometry geometry;
+      geometry.input_h = input_h;
+      geometry.input_w = input_w;
+      geometry.kernel_h = geometry.kernel_w = window.at(0);
+      geometry.stride_h = geometry.stride_w = window.at(1);
+      geometry.padding_h = geometry.padding_w = window.at(2);
+      geometry.output_h =
+          (input_h + 2 * window.at(2) - window.at(0)) / window.at(1) + 1;
+      const uint32_t output_w =
+          (input_w + 2 * window.at(2) - window.at(0)) / window.at(1) + 1;
+
+      std::vector<float> output(geometry.output_h * output_w);
+      SimdKernelsOf(isa).max_pool(geometry, output_w, input.data(),
+                                  output.data());
+      for (uint32_t ow = 0; ow < output_w; ++ow) {
+        for (uint32_t oh = 0; oh < geometry.output_h; ++oh) {
+          float expected = std::numeric_limits<float>::lowest();
+          for (uint32_t pw = 0; pw < geometry.kernel_w; ++pw) {
+            for (uint32_t ph = 0; ph < geometry.kernel_h; ++ph) {
+              const int32_t row = int32_t(oh * geometry.stride_h + ph) -
+                                  int32_t(geometry.padding_h);
+              const int32_t col = int32_t(ow * geometry.stride_w + pw) -
+                                  int32_t(geometry.padding_w);
+              if (row >= 0 && row < int32_t(input_h) && col >= 0 &&
+                  col < int32_t(input_w)) {
+                expected = std::max(expected, input.at(col * input_h + row));
+              }
+            }
+          }
+          ASSERT_EQ(output.at(ow * geometry.output_h + oh), expected)
+              << CpuIsaName(isa) << " window " << window.at(0) << " stride "
+              << window.at(1) << " padding " << window.at(2);
+        }
+      }
+    }
+  }
+}
+
+TEST(TestLayer, SimdElementwise) {
+  using namespace free_infer;
+  // an odd size leaves a tail after the vectors
+  const uint32_t size = 103;
+  std::vector<float> input1(size);
+  std::vector<float> input2(size);
+  for (uint32_t i = 0; i < size; ++i) {
+    input1.at(i) = float(i % 11) - 5.f;
+    input2.at(i) = float(i % 7) * 0.5f - 1.f;
+  }
+  for (const CpuIsa isa : SupportedIsas()) {
+    const SimdKernels& kernels = SimdKernelsOf(isa);
+    std::vector<float> relu(size);
+    std::vector<float> sigmoid(size);
+    std::vector<float> sum(size);
+    std::vector<float> product(size);
+    kernels.relu(input1.data(), relu.data(), size);
+    kernels.sigmoid(input1.data(), sigmoid.data(), size);
+    kernels.add(input1.data(), input2.data(), sum.data(), size);
+    kernels.multiply(input1.data(), input2.data(), product.data(), size);
+    for (uint32_t i = 0; i < size; ++i) {
+      ASSERT_EQ(relu.at(i), std::max(input1.at(i), 0.f)) << CpuIsaName(isa);
+      ASSERT_NEAR(sigmoid.at(i), 1.f / (1.f + std::exp(-input1.at(i))), 1e-6f)
+          << CpuIsaName(isa);
+      ASSERT_EQ(sum.at(i), input1.at(i) + input2.at(i)) << CpuIsaName(isa);
+      ASSERT_EQ(product.at(i), input1.at(i) * input2.at(i)) << CpuIsaName(isa);
+    }
+  }
+}
+
+TEST(TestLayer, SimdSigmoidRange) {
+  using namespace free_infer;
+  // the exp of the vector kernels is an approximation, it is checked over
+  // the whole range including the saturated ends
+  std::vector<float> input;
+  for (float x = -100.f; x <= 100.f; x += 0.0137f) {
+    input.push_back(x);
+  }
+  const uint32_t size = input.size();
+  for (const CpuIsa isa : SupportedIsas()) {
+    std::vector<float> sigmoid(size);
+    SimdKernelsOf(isa).sigmoid(input.data(), sigmoid.data(), size);
+    for (uint32_t i = 0; i < size; ++i) {
+      const double expected = 1. / (1. + std::exp(-double(input.at(i))));
+      ASSERT_LE(std::abs(sigmoid.at(i) - expected), 1e-6 * expected + 1e-30)
+          << CpuIsaName(isa) << " x " << input.at(i);
+    }
+  }
+}
@@ -0,0 +1,759 @@
+#include <glog/logging.h>
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <future>
+#include <map>
+#include <memory>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <layer/batchnorm2d.hpp>
+#include <layer/layer_convolution.hpp>
+#include <layer/relu.hpp>
+#include <layer/sigmoid.hpp>
+#include <pnnx/ir.h>
+#include <runtime/batch_scheduler.hpp>
+#include <runtime/memory_planner.hpp>
+#include <runtime/runtime_ir.hpp>
+#include <tensor/tensor_util.hpp>
+
+namespace {
+using namespace free_infer;
+
+pnnx::Operand* AddOperator(pnnx::Graph& graph, const std::string& type,
+                           const std::string& name,
+                           const std::vector<pnnx::Operand*>& inputs,
+                           const std::vector<int>& shape) {
+  pnnx::Operator* op = graph.new_operator(type, name);
+  for (pnnx::Operand* input : inputs) {
+    op->inputs.push_back(input);
+    input->consumers.push_back(op);
+  }
+  if (shape.empty()) {
+    return nullptr;
+  }
+  pnnx::Operand* output = graph.new_operand(name + "_out");
+  output->type = 1;
+  output->shape = shape;
+  output->producer = op;
+  op->outputs.push_back(output);
+  return output;
+}
+
+// input -> relu -> {sigmoid -> relu, relu -> sigmoid, sigmoid} -> add
+void SaveBranchGraph(const std::string& param_path, const std::string& bin_path,
+                     int batch_size) {
+  const std::vector<int> shape{batch_size, 4, 6, 6};
+  pnnx::Graph graph;
+  pnnx::Operand* input =
+      AddOperator(graph, "pnnx.Input", "pnnx_input_0", {}, shape);
+  pnnx::Operand* stem = AddOperator(graph, "nn.ReLU", "stem", {input}, shape);
+  pnnx::Operand* a1 = AddOperator(graph, "nn.Sigmoid", "a1", {stem}, shape);
+  pnnx::Operand* a2 = AddOperator(graph, "nn.ReLU", "a2", {a1}, shape);
+  pnnx::Operand* b1 = AddOperator(graph, "nn.ReLU", "b1", {stem}, shape);
+  pnnx::Operand* b2 = AddOperator(graph, "nn.Sigmoid", "b2", {b1}, shape);
+  pnnx::Operand* c1 = AddOperator(graph, "nn.Sigmoid", "c1", {stem}, shape);
+  pnnx::Operand* sum = AddOperator(graph, "pnnx.Expression", "sum",
+                                   {a2, b2, c1}, shape);
+  sum->producer->params["expr"] = "add(add(@0,@1),@2)";
+  AddOperator(graph, "pnnx.Output", "pnnx_output_0", {sum}, {});
+  CHECK(graph.save(param_path, bin_path) == 0);
+}
+
+// input -> max pooling -> relu, the pooling changes the spatial size
+void SavePoolingGraph(const std::string& param_path,
+                      const std::string& bin_path, int input_h, int input_w) {
+  const int output_h = input_h < 0 ? -1 : (input_h + 2 - 3) / 2 + 1;
+  const int output_w = input_w < 0 ? -1 : (input_w + 2 - 3) / 2 + 1;
+  pnnx::Graph graph;
+  pnnx::Operand* input = AddOperator(graph, "pnnx.Input", "pnnx_input_0", {},
+                                     {1, 4, input_h, input_w});
+  pnnx::Operand* pool = AddOperator(graph, "nn.MaxPool2d", "pool", {input},
+                                    {1, 4, output_h, output_w});
+  pool->producer->params["kernel_size"] = std::vector<int>{3, 3};
+  pool->producer->params["stride"] = std::vector<int>{2, 2};
+  pool->producer->params["padding"] = std::vector<int>{1, 1};
+  pnnx::Operand* relu =
+      AddOperator(graph, "nn.ReLU", "relu", {pool}, {1, 4, output_h, output_w});
+  AddOperator(graph, "pnnx.Output", "pnnx_output_0", {relu}, {});
+  CHECK(graph.save(param_path, bin_path) == 0);
+}
+
+pnnx::Operand* AddConv(pnnx::Graph& graph, const std::string& name,
+                       pnnx::Operand* input, int out_channels) {
+  const std::vector<int>& input_shape = input->shape;
+  const int in_channels = input_shape.at(1);
+  pnnx::Operand* output =
+      AddOperator(graph, "nn.Conv2d", name, {input},
+                  {input_shape.at(0), out_channels, input_shape.at(2),
+                   input_shape.at(3)});
+  pnnx::Operator* op = output->producer;
+  op->params["in_channels"] = in_channels;
+  op->params["out_channels"] = out_channels;
+  op->params["kernel_size"] = std::vector<int>{3, 3};
+  op->params["padding"] = std::vector<int>{1, 1};
+  op->params["stride"] = std::vector<int>{1, 1};
+  op->params["dilation"] = std::vector<int>{1, 1};
+  op->params["groups"] = 1;
+  op->params["bias"] = true;
+  op->params["padding_mode"] = std::string("zeros");
+  Tensor<float> weight(1, 1, out_channels * in_channels * 9);
+  weight.Rand();
+  weight.Transform([](float value) { return value - 0.5f; });
+  Tensor<float> bias(1, 1, out_channels);
+  bias.Rand();
+  op->attrs["weight"] =
+      pnnx::Attribute({out_channels, in_channels, 3, 3}, weight.values());
+  op->attrs["bias"] = pnnx::Attribute({out_channels}, bias.values());
+  return output;
+}
+
+// input -> conv -> relu -> conv -> sigmoid, both activations can be fused
+void SaveConvGraph(const std::string& param_path, const std::string& bin_path) {
+  pnnx::Graph graph;
+  pnnx::Operand* input =
+      AddOperator(graph, "pnnx.Input", "pnnx_input_0", {}, {1, 4, 6, 6});
+  pnnx::Operand* conv1 = AddConv(graph, "conv1", input, 5);
+  pnnx::Operand* relu =
+      AddOperator(graph, "nn.ReLU", "relu", {conv1}, conv1->shape);
+  pnnx::Operand* conv2 = AddConv(graph, "conv2", relu, 4);
+  pnnx::Operand* sigmoid =
+      AddOperator(graph, "nn.Sigmoid", "sigmoid", {conv2}, conv2->shape);
+  AddOperator(graph, "pnnx.Output", "pnnx_output_0", {sigmoid}, {});
+  CHECK(graph.save(param_path, bin_path) == 0);
+}
+
+// two residual blocks, input -> conv1 -> add input -> relu1 -> conv2 ->
+// add relu1 -> relu2, the adds and relus can be fused into the convs
+void SaveResidualGraph(const std::string& param_path,
+                       const std::string& bin_path) {
+  pnnx::Graph graph;
+  pnnx::Operand* input =
+      AddOperator(graph, "pnnx.Input", "pnnx_input_0", {}, {1, 4, 6, 6});
+  pnnx::Operand* conv1 = AddConv(graph, "conv1", input, 4);
+  pnnx::Operand* sum1 =
+      AddOperator(graph, "pnnx.Expression", "sum1", {conv1, input},
+                  conv1->shape);
+  sum1->producer->params["expr"] = "add(@0,@1)";
+  pnnx::Operand* relu1 =
+      AddOperator(graph, "nn.ReLU", "relu1", {sum1}, sum1->shape);
+  pnnx::Operand* conv2 = AddConv(graph, "conv2", relu1, 4);
+  pnnx::Operand* sum2 =
+      AddOperator(graph, "pnnx.Expression", "sum2", {relu1, conv2},
+                  conv2->shape);
+  sum2->producer->params["expr"] = "add(@0,@1)";
+  pnnx::Operand* relu2 =
+      AddOperator(graph, "nn.ReLU", "relu2", {sum2}, sum2->shape);
+  AddOperator(graph, "pnnx.Output", "pnnx_output_0", {relu2}, {});
+  CHECK(graph.save(param_path, bin_path) == 0);
+}
+
+std::vector<float> AttributeValues(const pnnx::Attribute& attr) {
+  const float* values = reinterpret_cast<const float*>(attr.data.data());
+  return std::vector<float>(values, values + attr.data.size() / sizeof(float));
+}
+
+std::vector<sftensor> MakeInputs(int batch_size, uint32_t rows = 6,
+                                 uint32_t cols = 6) {
+  std::vector<sftensor> inputs;
+  for (int i = 0; i < batch_size; ++i) {
+    sftensor input = std::make_shared<Tensor<float>>(4, rows, cols);
+    input->Rand();
+    input->Transform([](float value) { return value - 0.5f; });
+    inputs.push_back(input);
+  }
+  return inputs;
+}
+}  // namespace
+
+TEST(TestExecutor, ParallelMatchesSerial) {
+  using namespace free_infer;
+  const int batch_size = 2;
+  const std::string param_path = testing::TempDir() + "executor.pnnx.param";
+  const std::string bin_path = testing::TempDir() + "executor.pnnx.bin";
+  SaveBranchGraph(param_path, bin_path, batch_size);
+
+  RuntimeGraph serial_graph(param_path, bin_path);
+  serial_graph.Build("pnnx_input_0", "pnnx_output_0");
+  RuntimeGraph parallel_graph(param_path, bin_path);
+  parallel_graph.set_executor_mode(RuntimeGraph::ExecutorMode::kParallel, 3);
+  ASSERT_EQ(parallel_graph.executor_mode(),
+            RuntimeGraph::ExecutorMode::kParallel);
+  parallel_graph.Build("pnnx_input_0", "pnnx_output_0");
+
+  const std::vector<sftensor> inputs = MakeInputs(batch_size);
+  const std::vector<sftensor> serial_outputs = serial_graph.Forward(inputs);
+  const std::vector<sftensor> parallel_outputs = parallel_graph.Forward(inputs);
+  ASSERT_EQ(serial_outputs.size(), batch_size);
+  ASSERT_EQ(parallel_outputs.size(), batch_size);
+  for (int i = 0; i < batch_size; ++i) {
+    ASSERT_TRUE(arma::approx_equal(serial_outputs.at(i)->data(),
+                                   parallel_outputs.at(i)->data(), "absdiff",
+                                   1e-6f));
+  }
+}
+
+TEST(TestExecutor, ConcurrentPlanKeepsBranchesApart) {
+  using namespace free_infer;
+  const std::string param_path = testing::TempDir() + "executor2.pnnx.param";
+  const std::string bin_path = testing::TempDir() + "executor2.pnnx.bin";
+  SaveBranchGraph(param_path, bin_path, 1);
+
+  RuntimeGraph graph(param_path, bin_path);
+  graph.set_executor_mode(RuntimeGraph::ExecutorMode::kParallel, 2);
+  graph.Build("pnnx_input_0", "pnnx_output_0");
+
+  std::map<std::string, const float*> output_ptrs;
+  for (const auto& op : graph.get_topo_queues()) {
+    if (op->output_operands != nullptr &&
+        !op->output_operands->datas.empty()) {
+      output_ptrs.insert({op->name, op->output_operands->datas.front()->raw_ptr()});
+    }
+  }
+  // a1 and b1 may run at the same time as c1, so none of the branch outputs
+  // can share storage with another branch
+  const std::vector<std::string> branch_ops{"a1", "a2", "b1", "b2", "c1"};
+  for (const auto& lhs : branch_ops) {
+    for (const auto& rhs : branch_ops) {
+      if (lhs.front() != rhs.front()) {
+        ASSERT_NE(output_ptrs.at(lhs), output_ptrs.at(rhs))
+            << lhs << " and " << rhs;
+      }
+    }
+  }
+}
+
+TEST(TestExecutor, RepeatedForward) {
+  using namespace free_infer;
+  const int batch_size = 2;
+  const std::string param_path = testing::TempDir() + "executor3.pnnx.param";
+  const std::string bin_path = testing::TempDir() + "executor3.pnnx.bin";
+  SaveBranchGraph(param_path, bin_path, batch_size);
+
+  RuntimeGraph graph(param_path, bin_path);
+  graph.Build("pnnx_input_0", "pnnx_output_0");
+  RuntimeGraph fresh_graph(param_path, bin_path);
+  fresh_graph.Build("pnnx_input_0", "pnnx_output_0");
+
+  // the plan is bound once at build time, later calls only rebind the inputs
+  const std::vector<sftensor> first_inputs = MakeInputs(batch_size);
+  const std::vector<sftensor> second_inputs = MakeInputs(batch_size);
+  graph.Forward(first_inputs);
+  const std::vector<sftensor> outputs = graph.Forward(second_inputs);
+  const std::vector<sftensor> fresh_outputs = fresh_graph.Forward(second_inputs);
+  ASSERT_EQ(outputs.size(), batch_size);
+  for (int i = 0; i < batch_size; ++i) {
+    ASSERT_TRUE(arma::approx_equal(outputs.at(i)->data(),
+                                   fresh_outputs.at(i)->data(), "absdiff",
+                                   0.f));
+  }
+}
+
+TEST(TestExecutor, DynamicBatch) {
+  using namespace free_infer;
+  const std::string param_path = testing::TempDir() + "executor4.pnnx.param";
+  const std::string bin_path = testing::TempDir() + "executor4.pnnx.bin";
+  // -1 is saved as a dynamic batch dimension
+  SaveBranchGraph(param_path, bin_path, -1);
+
+  RuntimeGraph graph(param_path, bin_path);
+  graph.set_max_batch_size(4);
+  graph.Build("pnnx_input_0", "pnnx_output_0");
+  ASSERT_EQ(graph.max_batch_size(), 4);
+
+  RuntimeGraph single_graph(param_path, bin_path);
+  single_graph.set_max_batch_size(1);
+  single_graph.Build("pnnx_input_0", "pnnx_output_0");
+
+  for (const int batch_size : {3, 1, 4, 2}) {
+    const std::vector<sftensor> inputs = MakeInputs(batch_size);
+    const std::vector<sftensor> outputs = graph.Forward(inputs);
+    ASSERT_EQ(outputs.size(), batch_size);
+    for (int i = 0; i < batch_size; ++i) {
+      const std::vector<sftensor> single_outputs =
+          single_graph.Forward({inputs.at(i)});
+      ASSERT_EQ(single_outputs.size(), 1);
+      ASSERT_TRUE(arma::approx_equal(outputs.at(i)->data(),
+                                     single_outputs.front()->data(), "absdiff",
+                                     1e-6f));
+    }
+  }
+}
+
+TEST(TestExecutor, InputShapePlanCache) {
+  using namespace free_infer;
+  const std::string param_path = testing::TempDir() + "executor5.pnnx.param";
+  const std::string bin_path = testing::TempDir() + "executor5.pnnx.bin";
+  SavePoolingGraph(param_path, bin_path, 8, 8);
+  const std::string dynamic_param_path =
+      testing::TempDir() + "executor6.pnnx.param";
+  const std::string dynamic_bin_path =
+      testing::TempDir() + "executor6.pnnx.bin";
+  // -1 is saved as a dynamic spatial dimension
+  SavePoolingGraph(dynamic_param_path, dynamic_bin_path, -1, -1);
+
+  RuntimeGraph graph(param_path, bin_path);
+  graph.Build("pnnx_input_0", "pnnx_output_0");
+  ASSERT_EQ(graph.cached_plan_count(), 1);
+  RuntimeGraph dynamic_graph(dynamic_param_path, dynamic_bin_path);
+  dynamic_graph.Build("pnnx_input_0", "pnnx_output_0");
+  ASSERT_EQ(dynamic_graph.cached_plan_count(), 0);
+
+  const std::vector<std::pair<uint32_t, uint32_t>> input_sizes{
+      {8, 8}, {13, 10}, {8, 8}, {5, 7}, {13, 10}};
+  for (const auto& [rows, cols] : input_sizes) {
+    const std::vector<sftensor> inputs = MakeInputs(1, rows, cols);
+    const std::vector<sftensor> outputs = graph.Forward(inputs);
+    const std::vector<sftensor> dynamic_outputs = dynamic_graph.Forward(inputs);
+    ASSERT_EQ(outputs.size(), 1);
+    ASSERT_EQ(outputs.front()->rows(), (rows - 1) / 2 + 1);
+    ASSERT_EQ(outputs.front()->cols(), (cols - 1) / 2 + 1);
+
+    const std::string sized_param_path =
+        testing::TempDir() + "executor7.pnnx.param";
+    const std::string sized_bin_path =
+        testing::TempDir() + "executor7.pnnx.bin";
+    SavePoolingGraph(sized_param_path, sized_bin_path, rows, cols);
+    RuntimeGraph sized_graph(sized_param_path, sized_bin_path);
+    sized_graph.Build("pnnx_input_0", "pnnx_output_0");
+    const std::vector<sftensor> sized_outputs = sized_graph.Forward(inputs);
+    ASSERT_TRUE(arma::approx_equal(outputs.front()->data(),
+                                   sized_outputs.front()->data(), "absdiff",
+                                   0.f));
+    ASSERT_TRUE(arma::approx_equal(dynamic_outputs.front()->data(),
+                                   sized_outputs.front()->data(), "absdiff",
+                                   0.f));
+  }
+  // every distinct input shape is planned once
+  ASSERT_EQ(graph.cached_plan_count(), 3);
+  ASSERT_EQ(dynamic_graph.cached_plan_count(), 3);
+}
+
+TEST(TestExecutor, CloneSharesLayers) {
+  using namespace free_infer;
+  const int batch_size = 2;
+  const std::string param_path = testing::TempDir() + "executor8.pnnx.param";
+  const std::string bin_path = testing::TempDir() + "executor8.pnnx.bin";
+  SaveBranchGraph(param_path, bin_path, batch_size);
+
+  RuntimeGraph graph(param_path, bin_path);
+  graph.Build("pnnx_input_0", "pnnx_output_0");
+  std::vector<std::unique_ptr<RuntimeGraph>> clones;
+  for (int i = 0; i < 3; ++i) {
+    clones.push_back(graph.Clone());
+  }
+
+  const auto& topo_queue = graph.get_topo_queues();
+  for (const auto& clone : clones) {
+    const auto& clone_topo_queue = clone->get_topo_queues();
+    ASSERT_EQ(clone_topo_queue.size(), topo_queue.size());
+    for (uint32_t i = 0; i < topo_queue.size(); ++i) {
+      ASSERT_EQ(clone_topo_queue.at(i)->name, topo_queue.at(i)->name);
+      ASSERT_EQ(clone_topo_queue.at(i)->layer, topo_queue.at(i)->layer);
+    }
+  }
+
+  std::vector<std::vector<sftensor>> inputs;
+  std::vector<std::vector<arma::fcube>> expected_outputs;
+  for (uint32_t c = 0; c < clones.size(); ++c) {
+    inputs.push_back(MakeInputs(batch_size));
+    std::vector<arma::fcube> outputs;
+    for (const sftensor& output : graph.Forward(inputs.back())) {
+      outputs.push_back(output->data());
+    }
+    expected_outputs.push_back(outputs);
+  }
+
+  // every clone owns its activations, so they can run at the same time
+  std::vector<std::vector<sftensor>> clone_outputs(clones.size());
+  std::vector<std::thread> threads;
+  for (uint32_t c = 0; c < clones.size(); ++c) {
+    threads.emplace_back([&, c] {
+      for (int iter = 0; iter < 20; ++iter) {
+        clone_outputs.at(c) = clones.at(c)->Forward(inputs.at(c));
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  for (uint32_t c = 0; c < clones.size(); ++c) {
+    ASSERT_EQ(clone_outputs.at(c).size(), batch_size);
+    for (int i = 0; i < batch_size; ++i) {
+      ASSERT_TRUE(arma::approx_equal(clone_outputs.at(c).at(i)->data(),
+                                     expected_outputs.at(c).at(i), "absdiff",
+                                     0.f));
+    }
+  }
+}
+
+TEST(TestExecutor, ForwardAsync) {
+  using namespace free_infer;
+  const int batch_size = 2;
+  const std::string param_path = testing::TempDir() + "executor9.pnnx.param";
+  const std::string bin_path = testing::TempDir() + "executor9.pnnx.bin";
+  SaveBranchGraph(param_path, bin_path, batch_size);
+
+  RuntimeGraph graph(param_path, bin_path);
+  graph.Build("pnnx_input_0", "pnnx_output_0");
+  graph.set_num_contexts(2);
+  ASSERT_EQ(graph.num_contexts(), 2);
+
+  const uint32_t request_count = 12;
+  std::vector<std::vector<sftensor>> inputs;
+  std::vector<std::vector<arma::fcube>> expected_outputs;
+  for (uint32_t r = 0; r < request_count; ++r) {
+    inputs.push_back(MakeInputs(batch_size));
+    std::vector<arma::fcube> outputs;
+    for (const sftensor& output : graph.Forward(inputs.back())) {
+      outputs.push_back(output->data());
+    }
+    expected_outputs.push_back(outputs);
+  }
+
+  // several producers queue requests at the same time
+  std::vector<std::future<std::vector<sftensor>>> futures(request_count);
+  std::vector<std::thread> producers;
+  for (uint32_t p = 0; p < 3; ++p) {
+    producers.emplace_back([&, p] {
+      for (uint32_t r = p; r < request_count; r += 3) {
+        futures.at(r) = graph.ForwardAsync(inputs.at(r));
+      }
+    });
+  }
+  for (auto& producer : producers) {
+    producer.join();
+  }
+
+  std::promise<std::vector<sftensor>> callback_promise;
+  graph.ForwardAsync(inputs.front(), [&](std::vector<sftensor> outputs) {
+    callback_promise.set_value(std::move(outputs));
+  });
+
+  for (uint32_t r = 0; r < request_count; ++r) {
+    const std::vector<sftensor> outputs = futures.at(r).get();
+    ASSERT_EQ(outputs.size(), batch_size);
+    for (int i = 0; i < batch_size; ++i) {
+      ASSERT_TRUE(arma::approx_equal(outputs.at(i)->data(),
+                                     expected_outputs.at(r).at(i), "absdiff",
+                                     0.f));
+    }
+  }
+  const std::vector<sftensor> callback_outputs =
+      callback_promise.get_future().get();
+  ASSERT_EQ(callback_outputs.size(), batch_size);
+  for (int i = 0; i < batch_size; ++i) {
+    ASSERT_TRUE(arma::approx_equal(callback_outputs.at(i)->data(),
+                                   expected_outputs.front().at(i), "absdiff",
+                                   0.f));
+  }
+}
+
+TEST(TestExecutor, BatchScheduler) {
+  using namespace free_infer;
+  const std::string param_path = testing::TempDir() + "executor10.pnnx.param";
+  const std::string bin_path = testing::TempDir() + "executor10.pnnx.bin";
+  SaveBranchGraph(param_path, bin_path, -1);
+
+  RuntimeGraph graph(param_path, bin_path);
+  graph.set_max_batch_size(4);
+  graph.Build("pnnx_input_0", "pnnx_output_0");
+  RuntimeGraph single_graph(param_path, bin_path);
+  single_graph.set_max_batch_size(1);
+  single_graph.Build("pnnx_input_0", "pnnx_output_0");
+
+  const uint32_t request_count = 10;
+  const std::vector<sftensor> inputs = MakeInputs(request_count);
+  std::vector<std::future<sftensor>> futures;
+  {
+    BatchScheduler scheduler(graph, 4, std::chrono::milliseconds(200));
+    ASSERT_EQ(scheduler.max_batch_size(), 4);
+    for (const sftensor& input : inputs) {
+      futures.push_back(scheduler.Submit(input));
+    }
+    for (uint32_t r = 0; r < request_count; ++r) {
+      const sftensor output = futures.at(r).get();
+      const std::vector<sftensor> single_outputs =
+          single_graph.Forward({inputs.at(r)});
+      ASSERT_TRUE(arma::approx_equal(output->data(),
+                                     single_outputs.front()->data(), "absdiff",
+                                     1e-6f));
+    }
+
+    // the requests arrive at once, so they are batched up to the max batch
+    const BatchSchedulerStats stats = scheduler.stats();
+    ASSERT_EQ(stats.request_count, request_count);
+    ASSERT_LT(stats.batch_count, request_count);
+    ASSERT_GE(stats.batch_count, (request_count + 3) / 4);
+    ASSERT_LE(stats.max_queue_latency.count(),
+              std::chrono::microseconds(std::chrono::seconds(5)).count());
+
+    // a lone request leaves after the max wait time
+    const sftensor lone_output = scheduler.Submit(inputs.front()).get();
+    const std::vector<sftensor> single_outputs =
+        single_graph.Forward({inputs.front()});
+    ASSERT_TRUE(arma::approx_equal(lone_output->data(),
+                                   single_outputs.front()->data(), "absdiff",
+                                   1e-6f));
+    ASSERT_EQ(scheduler.stats().request_count, request_count + 1);
+  }
+}
+
+TEST(TestExecutor, ConvActivationFusion) {
+  using namespace free_infer;
+  const std::string param_path = testing::TempDir() + "executor11.pnnx.param";
+  const std::string bin_path = testing::TempDir() + "executor11.pnnx.bin";
+  SaveConvGraph(param_path, bin_path);
+
+  RuntimeGraph graph(param_path, bin_path);
+  graph.Build("pnnx_input_0", "pnnx_output_0");
+  std::map<std::string, std::shared_ptr<ConvolutionLayer>> conv_layers;
+  for (const auto& op : graph.get_topo_queues()) {
+    ASSERT_NE(op->type, "nn.ReLU");
+    ASSERT_NE(op->type, "nn.Sigmoid");
+    if (op->type == "nn.Conv2d") {
+      conv_layers.insert(
+          {op->name, std::dynamic_pointer_cast<ConvolutionLayer>(op->layer)});
+    }
+  }
+  ASSERT_EQ(graph.get_topo_queues().size(), 4);
+  ASSERT_EQ(conv_layers.at("conv1")->activation(),
+            ActivationType::kActivationRelu);
+  ASSERT_EQ(conv_layers.at("conv2")->activation(),
+            ActivationType::kActivationSigmoid);
+
+  const std::vector<sftensor> inputs = MakeInputs(1);
+  const std::vector<sftensor> outputs = graph.Forward(inputs);
+
+  // run the same layers unfused
+  const auto run_conv = [&](const std::string& name,
+                            const std::vector<sftensor>& conv_inputs) {
+    const auto& fused_layer = conv_layers.at(name);
+    const sftensor& kernel = fused_layer->weights().front();
+    ConvolutionLayer conv_layer(fused_layer->weights().size(),
+                                kernel->channels(), 3, 3, 1, 1, 1, 1, 1, true);
+    conv_layer.set_weights(fused_layer->weights());
+    conv_layer.set_bias(fused_layer->bias());
+    std::vector<sftensor> conv_outputs(1);
+    CHECK(conv_layer.Forward(conv_inputs, conv_outputs) ==
+          InferStatus::kInferSuccess);
+    return conv_outputs;
+  };
+  std::vector<sftensor> relu_outputs(1);
+  ReluLayer relu_layer;
+  ASSERT_EQ(relu_layer.Forward(run_conv("conv1", inputs), relu_outputs),
+            InferStatus::kInferSuccess);
+  std::vector<sftensor> sigmoid_outputs(1);
+  SigmoidLayer sigmoid_layer;
+  ASSERT_EQ(sigmoid_layer.Forward(run_conv("conv2", relu_outputs),
+                                  sigmoid_outputs),
+            InferStatus::kInferSuccess);
+  ASSERT_TRUE(arma::approx_equal(outputs.front()->data(),
+                                 sigmoid_outputs.front()->data(), "absdiff",
+                                 1e-5f));
+}
+
+TEST(TestExecutor, ConvBatchNormFolding) {
+  using namespace free_infer;
+  const std::string param_path = testing::TempDir() + "executor12.pnnx.param";
+  const std::string bin_path = testing::TempDir() + "executor12.pnnx.bin";
+  const int channels = 5;
+  const std::vector<float> mean{0.5f, -1.f, 2.f, 0.f, 0.1f};
+  const std::vector<float> var{1.f, 4.f, 0.25f, 2.f, 0.5f};
+  const std::vector<float> gamma{1.f, 0.5f, 2.f, -1.f, 1.5f};
+  const std::vector<float> beta{0.f, 1.f, -1.f, 0.5f, 0.2f};
+  const float eps = 1e-5f;
+
+  // input -> conv -> batchnorm -> relu
+  pnnx::Graph pnnx_graph;
+  pnnx::Operand* input = AddOperator(pnnx_graph, "pnnx.Input", "pnnx_input_0",
+                                     {}, {1, 4, 6, 6});
+  pnnx::Operand* conv = AddConv(pnnx_graph, "conv", input, channels);
+  pnnx::Operand* batchnorm = AddOperator(pnnx_graph, "nn.BatchNorm2d", "bn",
+                                         {conv}, conv->shape);
+  batchnorm->producer->params["num_features"] = channels;
+  batchnorm->producer->params["eps"] = eps;
+  batchnorm->producer->attrs["running_mean"] =
+      pnnx::Attribute({channels}, mean);
+  batchnorm->producer->attrs["running_var"] = pnnx::Attribute({channels}, var);
+  batchnorm->producer->attrs["weight"] = pnnx::Attribute({channels}, gamma);
+  batchnorm->producer->attrs["bias"] = pnnx::Attribute({channels}, beta);
+  pnnx::Operand* relu =
+      AddOperator(pnnx_graph, "nn.ReLU", "relu", {batchnorm}, conv->shape);
+  AddOperator(pnnx_graph, "pnnx.Output", "pnnx_output_0", {relu}, {});
+  ASSERT_EQ(pnnx_graph.save(param_path, bin_path), 0);
+
+  RuntimeGraph graph(param_path, bin_path);
+  graph.Build("pnnx_input_0", "pnnx_output_0");
+  // the batchnorm is folded into the conv weights and the relu into its
+  // epilogue
+  ASSERT_EQ(graph.get_topo_queues().size(), 3);
+  for (const auto& op : graph.get_topo_queues()) {
+    ASSERT_NE(op->type, "nn.BatchNorm2d");
+    ASSERT_NE(op->type, "nn.ReLU");
+  }
+
+  const std::vector<sftensor> inputs = MakeInputs(1);
+  const std::vector<sftensor> outputs = graph.Forward(inputs);
+
+  // run the layers unfused
+  const pnnx::Operator* conv_op = conv->producer;
+  ConvolutionLayer conv_layer(channels, 4, 3, 3, 1, 1, 1, 1, 1, true);
+  conv_layer.set_weights(AttributeValues(conv_op->attrs.at("weight")));
+  conv_layer.set_bias(AttributeValues(conv_op->attrs.at("bias")));
+  BatchNorm2dLayer batchnorm_layer(channels, eps, mean, var, gamma, beta);
+  ReluLayer relu_layer;
+  std::vector<sftensor> conv_outputs(1);
+  std::vector<sftensor> batchnorm_outputs(1);
+  std::vector<sftensor> relu_outputs(1);
+  ASSERT_EQ(conv_layer.Forward(inputs, conv_outputs),
+            InferStatus::kInferSuccess);
+  ASSERT_EQ(batchnorm_layer.Forward(conv_outputs, batchnorm_outputs),
+            InferStatus::kInferSuccess);
+  ASSERT_EQ(relu_layer.Forward(batchnorm_outputs, relu_outputs),
+            InferStatus::kInferSuccess);
+  ASSERT_TRUE(arma::approx_equal(outputs.front()->data(),
+                                 relu_outputs.front()->data(), "absdiff",
+                                 1e-4f));
+}
+
+TEST(TestExecutor, ConvResidualFusion) {
+  using namespace free_infer;
+  const std::string param_path = testing::TempDir() + "executor13.pnnx.param";
+  const std::string bin_path = testing::TempDir() + "executor13.pnnx.bin";
+  SaveResidualGraph(param_path, bin_path);
+
+  RuntimeGraph graph(param_path, bin_path);
+  graph.set_max_batch_size(2);
+  graph.Build("pnnx_input_0", "pnnx_output_0");
+  std::map<std::string, std::shared_ptr<ConvolutionLayer>> conv_layers;
+  for (const auto& op : graph.get_topo_queues()) {
+    ASSERT_NE(op->type, "pnnx.Expression");
+    ASSERT_NE(op->type, "nn.ReLU");
+    if (op->type == "nn.Conv2d") {
+      ASSERT_EQ(op->input_operands.size(), 2);
+      conv_layers.insert(
+          {op->name, std::dynamic_pointer_cast<ConvolutionLayer>(op->layer)});
+    }
+  }
+  ASSERT_EQ(graph.get_topo_queues().size(), 4);
+  for (const auto& [_, conv_layer] : conv_layers) {
+    ASSERT_TRUE(conv_layer->use_residual());
+    ASSERT_EQ(conv_layer->activation(), ActivationType::kActivationRelu);
+  }
+
+  const std::vector<sftensor> inputs = MakeInputs(2);
+  const std::vector<sftensor> outputs = graph.Forward(inputs);
+  ASSERT_EQ(outputs.size(), 2);
+
+  // run the same layers unfused
+  const auto run_block = [&](const std::string& name,
+                             const std::vector<sftensor>& block_inputs) {
+    const auto& fused_layer = conv_layers.at(name);
+    ConvolutionLayer conv_layer(fused_layer->weights().size(),
+                                fused_layer->weights().front()->channels(), 3,
+                                3, 1, 1, 1, 1, 1, true);
+    conv_layer.set_weights(fused_layer->weights());
+    conv_layer.set_bias(fused_layer->bias());
+    std::vector<sftensor> conv_outputs(block_inputs.size());
+    CHECK(conv_layer.Forward(block_inputs, conv_outputs) ==
+          InferStatus::kInferSuccess);
+    std::vector<sftensor> sums;
+    for (uint32_t i = 0; i < block_inputs.size(); ++i) {
+      sums.push_back(TensorElementAdd(conv_outputs.at(i), block_inputs.at(i)));
+    }
+    ReluLayer relu_layer;
+    std::vector<sftensor> relu_outputs(block_inputs.size());
+    CHECK(relu_layer.Forward(sums, relu_outputs) ==
+          InferStatus::kInferSuccess);
+    return relu_outputs;
+  };
+  const std::vector<sftensor> expected =
+      run_block("conv2", run_block("conv1", inputs));
+  for (uint32_t i = 0; i < outputs.size(); ++i) {
+    ASSERT_TRUE(arma::approx_equal(outputs.at(i)->data(),
+                                   expected.at(i)->data(), "absdiff", 1e-5f));
+  }
+}
+
+TEST(TestExecutor, ConvTuningCache) {
+  using namespace free_infer;
+  const std::string param_path = testing::TempDir() + "executor14.pnnx.param";
+  const std::string bin_path = testing::TempDir() + "executor14.pnnx.bin";
+  const std::string cache_path = testing::TempDir() + "executor14.tuning";
+  SaveResidualGraph(param_path, bin_path);
+  std::remove(cache_path.c_str());
+
+  const auto conv_algorithms = [](const RuntimeGraph& graph) {
+    std::map<std::string, ConvAlgorithm> algorithms;
+    for (const auto& op : graph.get_topo_queues()) {
+      if (op->type == "nn.Conv2d") {
+        const auto conv_layer =
+            std::dynamic_pointer_cast<ConvolutionLayer>(op->layer);
+        algorithms.insert({op->name, conv_layer->algorithm()});
+      }
+    }
+    return algorithms;
+  };
+
+  RuntimeGraph graph(param_path, bin_path);
+  graph.set_max_batch_size(2);
+  graph.set_conv_tuning(true, cache_path);
+  graph.Build("pnnx_input_0", "pnnx_output_0");
+  const auto tuned_algorithms = conv_algorithms(graph);
+  ASSERT_EQ(tuned_algorithms.size(), 2);
+  for (const auto& [_, algorithm] : tuned_algorithms) {
+    ASSERT_NE(algorithm, ConvAlgorithm::kConvAlgorithmAuto);
+  }
+
+  // the tuned graph computes the same as the untuned one
+  RuntimeGraph untuned_graph(param_path, bin_path);
+  untuned_graph.set_max_batch_size(2);
+  untuned_graph.Build("pnnx_input_0", "pnnx_output_0");
+  const std::vector<sftensor> inputs = MakeInputs(2);
+  const std::vector<sftensor> outputs = graph.Forward(inputs);
+  const std::vector<sftensor> expected = untuned_graph.Forward(inputs);
+  for (uint32_t i = 0; i < outputs.size(); ++i) {
+    ASSERT_TRUE(arma::approx_equal(outputs.at(i)->data(),
+                                   expected.at(i)->data(), "absdiff", 1e-5f));
+  }
+
+  // one line per layer, force every choice to the implicit GEMM so a graph
+  // taking them from the cache can be told apart from one tuning again
+  std::vector<std::string> lines;
+  {
+    std::ifstream cache_file(cache_path);
+    std::string line;
+    while (std::getline(cache_file, line)) {
+      lines.push_back(line.substr(0, line.rfind('\t') + 1) +
+                      std::to_string(int(
+                          ConvAlgorithm::kConvAlgorithmImplicitGemm)));
+    }
+  }
+  ASSERT_EQ(lines.size(), 2);
+  {
+    std::ofstream cache_file(cache_path, std::ios::trunc);
+    for (const std::string& line : lines) {
+      cache_file << line << '\n';
+    }
+  }
+
+  RuntimeGraph cached_graph(param_path, bin_path);
+  cached_graph.set_max_batch_size(2);
+  cached_graph.set_conv_tuning(true, cache_path);
+  cached_graph.Build("pnnx_input_0", "pnnx_output_0");
+  for (const auto& [_, algorithm] : conv_algorithms(cached_graph)) {
+    ASSERT_EQ(algorithm, ConvAlgorithm::kConvAlgorithmImplicitGemm);
+  }
+  const std::vector<sftensor> cached_outputs = cached_graph.Forward(inputs);
+  for (uint32_t i = 0; i < cached_outputs.size(); ++i) {
+    ASSERT_TRUE(arma::approx_equal(cached_outputs.at(i)->data(),
+                                   expected.at(i)->data(), "absdiff", 1e-5f));
+  }
+}
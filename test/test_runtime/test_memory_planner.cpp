@@ -0,0 +1,110 @@
+#include <glog/logging.h>
+#include <gtest/gtest.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <runtime/memory_planner.hpp>
+#include <runtime/runtime_ir.hpp>
+
+namespace {
+using namespace free_infer;
+
+std::shared_ptr<RuntimeOperator> MakeOperator(const std::string& type,
+                                              const std::string& name,
+                                              const std::vector<int>& shapes) {
+  std::shared_ptr<RuntimeOperator> op = std::make_shared<RuntimeOperator>();
+  op->type = type;
+  op->name = name;
+  if (!shapes.empty()) {
+    op->output_operands = std::make_shared<RuntimeOperand>();
+    op->output_operands->name = name + "_output";
+    op->output_operands->type = RuntimeDataType::kTypeFloat32;
+    op->output_operands->shapes = shapes;
+  }
+  return op;
+}
+
+void Connect(const std::shared_ptr<RuntimeOperator>& from,
+             const std::shared_ptr<RuntimeOperator>& to) {
+  from->output_operators_maps.insert({to->name, to});
+}
+}  // namespace
+
+TEST(TestMemoryPlanner, ChainReuse) {
+  using namespace free_infer;
+  const std::vector<int> shapes{1, 4, 8, 8};
+  auto input = MakeOperator("pnnx.Input", "input", shapes);
+  auto op1 = MakeOperator("nn.ReLU", "op1", shapes);
+  auto op2 = MakeOperator("nn.ReLU", "op2", shapes);
+  auto op3 = MakeOperator("nn.ReLU", "op3", shapes);
+  auto op4 = MakeOperator("nn.ReLU", "op4", shapes);
+  auto output = MakeOperator("pnnx.Output", "output", {});
+  Connect(input, op1);
+  Connect(op1, op2);
+  Connect(op2, op3);
+  Connect(op3, op4);
+  Connect(op4, output);
+
+  MemoryPlanner planner;
+  planner.Plan({input, op1, op2, op3, op4, output});
+  planner.Allocate();
+
+  const size_t operand_bytes = 4 * 8 * 8 * sizeof(float);
+  const MemoryPlanReport& report = planner.report();
+  ASSERT_EQ(report.operand_count, 4);
+  ASSERT_EQ(report.arena_count, 2);
+  ASSERT_EQ(report.naive_bytes, 4 * operand_bytes);
+  ASSERT_EQ(report.planned_bytes, 2 * operand_bytes);
+
+  ASSERT_TRUE(input->output_operands->datas.empty());
+  ASSERT_EQ(op1->output_operands->datas.size(), 1);
+  ASSERT_EQ(op1->output_operands->datas.front()->shapes(),
+            std::vector<uint32_t>({4, 8, 8}));
+  // producer and consumer never share the storage
+  ASSERT_NE(op1->output_operands->datas.front()->raw_ptr(),
+            op2->output_operands->datas.front()->raw_ptr());
+  ASSERT_NE(op3->output_operands->datas.front()->raw_ptr(),
+            op4->output_operands->datas.front()->raw_ptr());
+  ASSERT_EQ(op1->output_operands->datas.front()->raw_ptr(),
+            op3->output_operands->datas.front()->raw_ptr());
+}
+
+TEST(TestMemoryPlanner, BranchLifetime) {
+  using namespace free_infer;
+  const std::vector<int> shapes{2, 4, 8, 8};
+  auto input = MakeOperator("pnnx.Input", "input", shapes);
+  auto op1 = MakeOperator("nn.ReLU", "op1", shapes);
+  auto op2 = MakeOperator("nn.ReLU", "op2", shapes);
+  auto op3 = MakeOperator("nn.ReLU", "op3", shapes);
+  auto add = MakeOperator("pnnx.Expression", "add", shapes);
+  auto output = MakeOperator("pnnx.Output", "output", {});
+  Connect(input, op1);
+  Connect(op1, op2);
+  Connect(op1, add);
+  Connect(op2, op3);
+  Connect(op3, add);
+  Connect(add, output);
+
+  MemoryPlanner planner;
+  planner.Plan({input, op1, op2, op3, add, output});
+  planner.Allocate();
+
+  // op1 is alive until add, so op2, op3 and add can not reuse its storage
+  const float* op1_ptr = op1->output_operands->datas.front()->raw_ptr();
+  ASSERT_NE(op1_ptr, op2->output_operands->datas.front()->raw_ptr());
+  ASSERT_NE(op1_ptr, op3->output_operands->datas.front()->raw_ptr());
+  ASSERT_NE(op1_ptr, add->output_operands->datas.front()->raw_ptr());
+  ASSERT_EQ(op2->output_operands->datas.front()->raw_ptr(),
+            add->output_operands->datas.front()->raw_ptr());
+
+  const MemoryPlanReport& report = planner.report();
+  ASSERT_EQ(report.arena_count, 3);
+  ASSERT_LT(report.planned_bytes, report.naive_bytes);
+
+  // batches of the same operand are laid out one after another
+  const auto& op3_datas = op3->output_operands->datas;
+  ASSERT_EQ(op3_datas.size(), 2);
+  ASSERT_EQ(op3_datas.at(0)->raw_ptr() + 4 * 8 * 8, op3_datas.at(1)->raw_ptr());
+}
@@ -0,0 +1,103 @@
+#include <glog/logging.h>
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <memory>
+#include <vector>
+
+#include <layer/layer_convolution.hpp>
+#include <layer/maxpooling.hpp>
+#include <runtime/thread_pool.hpp>
+
+TEST(TestThreadPool, ParallelForCoversRange) {
+  using namespace free_infer;
+  for (uint32_t num_threads : {1u, 2u, 3u, 8u}) {
+    ParallelThreadsGuard threads_guard(num_threads);
+    ASSERT_EQ(GetParallelThreads(), num_threads);
+    std::vector<std::atomic<uint32_t>> visits(37);
+    ParallelFor(5, 37, [&](uint32_t i) { visits.at(i) += 1; });
+    for (uint32_t i = 0; i < visits.size(); ++i) {
+      ASSERT_EQ(visits.at(i), i < 5 ? 0 : 1) << i;
+    }
+  }
+}
+
+TEST(TestThreadPool, NestedParallelFor) {
+  using namespace free_infer;
+  ParallelThreadsGuard threads_guard(4);
+  std::vector<std::atomic<uint32_t>> visits(8 * 16);
+  ParallelFor(0, 8, [&](uint32_t i) {
+    ParallelFor(0, 16, [&](uint32_t j) { visits.at(i * 16 + j) += 1; });
+  });
+  for (const auto& visit : visits) {
+    ASSERT_EQ(visit, 1);
+  }
+}
+
+TEST(TestThreadPool, ConvDeterministic) {
+  using namespace free_infer;
+  const uint32_t batch_size = 3;
+  const uint32_t in_channel = 4;
+  const uint32_t kernel_count = 6;
+  std::vector<sftensor> inputs(batch_size);
+  for (uint32_t i = 0; i < batch_size; ++i) {
+    inputs.at(i) = std::make_shared<Tensor<float>>(in_channel, 9, 9);
+    inputs.at(i)->Rand();
+  }
+  std::vector<sftensor> weights;
+  for (uint32_t i = 0; i < kernel_count; ++i) {
+    sftensor kernel = std::make_shared<Tensor<float>>(in_channel, 3, 3);
+    kernel->Rand();
+    weights.push_back(kernel);
+  }
+  ConvolutionLayer conv_layer(kernel_count, in_channel, 3, 3, 1, 1, 1, 1, 1,
+                              false);
+  conv_layer.set_weights(weights);
+
+  std::vector<sftensor> serial_outputs(batch_size);
+  {
+    ParallelThreadsGuard threads_guard(1);
+    ASSERT_EQ(conv_layer.Forward(inputs, serial_outputs),
+              InferStatus::kInferSuccess);
+  }
+  std::vector<sftensor> parallel_outputs(batch_size);
+  {
+    ParallelThreadsGuard threads_guard(4);
+    ASSERT_EQ(conv_layer.Forward(inputs, parallel_outputs),
+              InferStatus::kInferSuccess);
+  }
+  for (uint32_t i = 0; i < batch_size; ++i) {
+    ASSERT_TRUE(arma::approx_equal(serial_outputs.at(i)->data(),
+                                   parallel_outputs.at(i)->data(), "absdiff",
+                                   0.f));
+  }
+}
+
+TEST(TestThreadPool, MaxPoolingDeterministic) {
+  using namespace free_infer;
+  const uint32_t batch_size = 2;
+  std::vector<sftensor> inputs(batch_size);
+  for (uint32_t i = 0; i < batch_size; ++i) {
+    inputs.at(i) = std::make_shared<Tensor<float>>(5, 8, 8);
+    inputs.at(i)->Rand();
+  }
+  MaxPoolingLayer max_layer(3, 3, 1, 1, 2, 2);
+
+  std::vector<sftensor> serial_outputs(batch_size);
+  {
+    ParallelThreadsGuard threads_guard(1);
+    ASSERT_EQ(max_layer.Forward(inputs, serial_outputs),
+              InferStatus::kInferSuccess);
+  }
+  std::vector<sftensor> parallel_outputs(batch_size);
+  {
+    ParallelThreadsGuard threads_guard(3);
+    ASSERT_EQ(max_layer.Forward(inputs, parallel_outputs),
+              InferStatus::kInferSuccess);
+  }
+  for (uint32_t i = 0; i < batch_size; ++i) {
+    ASSERT_TRUE(arma::approx_equal(serial_outputs.at(i)->data(),
+                                   parallel_outputs.at(i)->data(), "absdiff",
+                                   0.f));
+  }
+}